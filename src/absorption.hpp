@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "lightning.hpp"
+
+namespace Sapphire
+{
+    // AtmosphericAbsorption renders thunder like Thunder::renderAudio does,
+    // except that high frequencies are attenuated more for distant segments than for near ones.
+    // Filtering every ThunderSegment separately would be far too expensive,
+    // so segments are grouped into bins of similar distance. Each bin is rendered
+    // into its own scratch buffer, low-pass filtered once, and mixed into the output.
+    // The cost of filtering therefore scales with the number of bins, not the number of segments.
+    template <typename real_t = double>
+    class BasicAtmosphericAbsorption
+    {
+    private:
+        using segment_t = BasicThunderSegment<real_t>;
+        using seglist_t = BasicThunderSegmentList<real_t>;
+
+        const int numBins;
+        const double cutoffHzMeters;
+        std::vector<float> scratch;
+
+        static int Frame(real_t distance, real_t minDistance, int sampleRateHz)
+        {
+            real_t t = (distance - minDistance) / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            return static_cast<int>(std::round(t * sampleRateHz));
+        }
+
+    public:
+        // `_numBins` is the number of distance bins between the nearest and farthest segments.
+        // `_cutoffHzMeters` is the product of the low-pass cutoff frequency and the distance;
+        // the default puts the cutoff at 10 kHz for a segment 1 km away, and 1 kHz at 10 km.
+        explicit BasicAtmosphericAbsorption(int _numBins = 32, double _cutoffHzMeters = AIR_ABSORPTION_HZ_METERS)
+            : numBins(_numBins)
+            , cutoffHzMeters(_cutoffHzMeters)
+        {
+            if (numBins < 1)
+                throw std::range_error("AtmosphericAbsorption must have at least one distance bin.");
+
+            if (cutoffHzMeters <= 0.0)
+                throw std::range_error("AtmosphericAbsorption cutoff must be positive.");
+        }
+
+        int bins() const
+        {
+            return numBins;
+        }
+
+        double cutoffFrequency(double distance, int sampleRateHz) const
+        {
+            // A cutoff at or above the Nyquist frequency removes nothing that can be sampled,
+            // so it is reported as the Nyquist frequency, and such bins are not filtered at all.
+            const double nyquist = 0.5 * sampleRateHz;
+            if (distance <= 0.0)
+                return nyquist;
+            return std::min(nyquist, cutoffHzMeters / distance);
+        }
+
+        AudioBuffer render(const BasicThunder<real_t>& thunder, int sampleRateHz)
+        {
+            AudioBuffer audio;
+            renderInto(thunder, sampleRateHz, audio);
+            return audio;
+        }
+
+        void renderInto(const BasicThunder<real_t>& thunder, int sampleRateHz, AudioBuffer& audio)
+        {
+            // Same as render, but reuses the memory already owned by `audio`.
+            const int nchannels = static_cast<int>(thunder.numEars());
+            const real_t minDistance = thunder.getMinDistance();
+            const real_t maxDistance = thunder.getMaxDistance();
+
+            if (!(minDistance < maxDistance))
+            {
+                audio.reset(0, nchannels);
+                return;
+            }
+
+            // Use the same timing as Thunder::renderAudio, so the two can be compared directly.
+            real_t durationSeconds = (maxDistance - minDistance) / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            int durationFrames = static_cast<int>(std::ceil(sampleRateHz * durationSeconds));
+            audio.reset(durationFrames, nchannels, thunder.startFrame(sampleRateHz));
+            float *buffer = audio.samples();
+
+            const real_t binWidth = (maxDistance - minDistance) / numBins;
+
+            for (int c = 0; c < nchannels; ++c)
+            {
+                const seglist_t& seglist = thunder.segments(c);
+                auto binBegin = seglist.begin();
+                for (int b = 0; b < numBins && binBegin != seglist.end(); ++b)
+                {
+                    // The segment list is sorted by `distance1`, so each bin is a contiguous range.
+                    segment_t edge;
+                    edge.distance1 = minDistance + (b+1)*binWidth;
+                    auto binEnd = (b+1 == numBins) ? seglist.end() : std::lower_bound(binBegin, seglist.end(), edge);
+                    if (binBegin == binEnd)
+                        continue;
+
+                    // Find the range of frames touched by this bin's segments.
+                    int firstFrame = Frame(binBegin->distance1, minDistance, sampleRateHz);
+                    int lastFrame = firstFrame;
+                    for (auto s = binBegin; s != binEnd; ++s)
+                        lastFrame = std::max(lastFrame, Frame(s->distance2, minDistance, sampleRateHz));
+                    lastFrame = std::min(lastFrame, durationFrames);
+
+                    scratch.assign(static_cast<std::size_t>(lastFrame - firstFrame), 0.0f);
+                    for (auto s = binBegin; s != binEnd; ++s)
+                    {
+                        // Do a linear interpolation using the inverse square law at the range of distances.
+                        real_t amp1 = s->gain / (s->distance1 * s->distance1);
+                        real_t amp2 = s->gain / (s->distance2 * s->distance2);
+                        int f1 = Frame(s->distance1, minDistance, sampleRateHz);
+                        int f2 = Frame(s->distance2, minDistance, sampleRateHz);
+                        for (int f = f1; f < f2; ++f)
+                        {
+                            real_t x = static_cast<real_t>(f-f1) / static_cast<real_t>(f2-f1);
+                            if (f < lastFrame)
+                                scratch[f - firstFrame] += (1-x)*amp1 + x*amp2;
+                        }
+                    }
+
+                    // Run a one-pole low-pass filter over the bin, using the distance at the bin's center.
+                    // Keep running the filter past the end of the bin until its decaying tail is negligible.
+                    double centerDistance = minDistance + (b+0.5)*binWidth;
+                    double cutoff = cutoffFrequency(centerDistance, sampleRateHz);
+                    double alpha = (cutoff < 0.5*sampleRateHz) ? 1 - std::exp(-2 * M_PI * cutoff / sampleRateHz) : 1.0;
+                    double y = 0.0;
+                    double peak = 0.0;
+                    for (int f = firstFrame; f < durationFrames; ++f)
+                    {
+                        double x = (f < lastFrame) ? scratch[f - firstFrame] : 0.0;
+                        y += alpha * (x - y);
+                        peak = std::max(peak, std::abs(y));
+                        if (f >= lastFrame && std::abs(y) <= 1.0e-9 * peak)
+                            break;
+                        buffer[static_cast<std::size_t>(nchannels)*f + c] += y;
+                    }
+
+                    binBegin = binEnd;
+                }
+            }
+        }
+    };
+
+
+    using AtmosphericAbsorption = BasicAtmosphericAbsorption<double>;
+}
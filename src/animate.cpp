@@ -25,15 +25,29 @@
 #include <cstdio>
 #include <cmath>
 #include <cinttypes>
-#include <mutex>
+#include <algorithm>
+#include <vector>
 
 #include "raylib.h"
+#include "rlgl.h"
 #include "wavefile.hpp"
 #include "lightning.hpp"
 #include "convolution.hpp"
+#include "sparse_convolution.hpp"
+#include "absorption.hpp"
+#include "snapshot.hpp"
+#include "segment_bvh.hpp"
+#include "pipeline.hpp"
+#include "streaming.hpp"
+#include "playback.hpp"
+#include "audio_buffer_pool.hpp"
+
+// Build with -DTHUNDER_RT_AUDIT to report any allocation or locking on the audio thread.
+#include "rtaudit_impl.hpp"
 
 #define RENDER_MODE_RAW 0
 #define RENDER_MODE_CONVOLUTION 1
+#define RENDER_MODE_ABSORPTION 2
 
 #define SELECTED_RENDER_MODE    RENDER_MODE_RAW
 
@@ -46,10 +60,12 @@ static Sapphire::AudioBuffer ConvolutionAudio;
 static bool LoadConvolutionAudio();
 #endif
 
-static void Render(const Sapphire::LightningBolt& bolt);
+static void UpdateBoltVertices(const Sapphire::LightningBolt& bolt);
+static void Render();
 static void Save(const Sapphire::LightningBolt& bolt);
 static void AudioInputCallback(void *buffer, unsigned frames);
 static void MakeThunder(Sapphire::LightningBolt& bolt);
+static void PickSegment(const Sapphire::LightningBolt& bolt, Ray ray);
 
 // Create a pair of ears for stereo audio output.
 static const Sapphire::BoltPointList Listener
@@ -60,6 +76,22 @@ static const Sapphire::BoltPointList Listener
 
 const std::size_t MAX_SEGMENTS = 2000;
 static Sapphire::Thunder BackgroundThunder{Listener, MAX_SEGMENTS};
+static Sapphire::AudioBufferPool BufferPool;
+
+// A spatial index over the current bolt, for picking a segment with the mouse.
+static Sapphire::SegmentBvh BoltIndex;
+static std::size_t PickedSegment = Sapphire::SegmentBvh::npos;
+
+// The bolt's vertices in raylib coordinates, two per segment. The bolt only changes
+// when we generate a new one, so its vertices are converted once per bolt instead of once per frame.
+static std::vector<Vector3> BoltVertices;
+
+// The most vertices sent to rlgl's render batch at once. Any chunk this size fits in an empty batch,
+// even on OpenGL ES, where the default batch holds the fewest vertices (8192).
+const std::size_t LINE_CHUNK_VERTICES = 4096;
+
+// Both endpoints of the segment picked with the mouse, in raylib coordinates.
+static Vector3 PickedVertices[2];
 
 int main(int argc, const char *argv[])
 {
@@ -101,13 +133,16 @@ int main(int argc, const char *argv[])
         if (IsKeyPressed(KEY_S))
             Save(bolt);
 
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
+            PickSegment(bolt, GetMouseRay(GetMousePosition(), camera));
+
         viewAngle = std::fmod(viewAngle + 0.002f, 2.0 * M_PI);
         UpdateCamera(&camera, CAMERA_ORBITAL);
         BeginDrawing();
         ClearBackground(BLACK);
         BeginMode3D(camera);
         DrawGrid(10, 1.0f);
-        Render(bolt);
+        Render();
         EndMode3D();
         EndDrawing();
     }
@@ -115,40 +150,72 @@ int main(int argc, const char *argv[])
     UnloadAudioStream(stream);
     CloseAudioDevice();
     CloseWindow();
+    Sapphire::RealTimeAudit::PrintReport(stdout);
     return 0;
 }
 
 
-static void Render(const Sapphire::LightningBolt& bolt)
+const float RenderScale = 10.0 / 4000.0;      // world-units per meter
+
+
+static Vector3 WorldVector(const Sapphire::BoltPoint& p)
+{
+    // Convert my coordinates with the x-y plane as horizontal,
+    // to raylib coordinates with x-z plane as horizontal.
+    // Preserve the right-hand rule.
+    // Convert meters to world-units.
+    Vector3 v;
+    v.x = RenderScale * p.x;
+    v.y = RenderScale * p.z;
+    v.z = -RenderScale * p.y;
+    return v;
+}
+
+
+static Sapphire::BoltPoint BoltVector(const Vector3& v)
 {
-    const float scale = 10.0 / 4000.0;      // world-units per meter
-    Vector3 startPos, endPos;
-    Color color = PURPLE;
+    // The inverse of WorldVector: convert raylib world-units back to meters in my coordinates.
+    return Sapphire::BoltPoint{v.x / RenderScale, -v.z / RenderScale, v.y / RenderScale};
+}
 
+
+static void UpdateBoltVertices(const Sapphire::LightningBolt& bolt)
+{
+    BoltVertices.clear();
     for (const Sapphire::BoltSegment& seg : bolt.segments())
     {
-        // Convert my coordinates with the x-y plane as horizontal,
-        // to raylib coordinates with x-z plane as horizontal.
-        // Preserve the right-hand rule.
-        // Convert meters to world-units.
+        BoltVertices.push_back(WorldVector(seg.a));
+        BoltVertices.push_back(WorldVector(seg.b));
+    }
+}
 
-        startPos.x = scale * seg.a.x;
-        startPos.y = scale * seg.a.z;
-        startPos.z = -scale * seg.a.y;
 
-        endPos.x = scale * seg.b.x;
-        endPos.y = scale * seg.b.z;
-        endPos.z = -scale * seg.b.y;
+static void Render()
+{
+    const float scale = RenderScale;
 
-        DrawLine3D(startPos, endPos, color);
+    // Send the whole bolt through rlgl's line batch. Consecutive lines in one batch are drawn
+    // together, so this is a single draw call per batch's worth of vertices, not one per segment.
+    // Making room for each chunk before it starts flushes the batch only when it is full.
+    const Color color = PURPLE;
+    for (std::size_t first = 0; first < BoltVertices.size(); first += LINE_CHUNK_VERTICES)
+    {
+        const std::size_t last = std::min(BoltVertices.size(), first + LINE_CHUNK_VERTICES);
+        rlCheckRenderBatchLimit(static_cast<int>(last - first));
+        rlBegin(RL_LINES);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        for (std::size_t i = first; i < last; ++i)
+            rlVertex3f(BoltVertices[i].x, BoltVertices[i].y, BoltVertices[i].z);
+        rlEnd();
     }
 
+    // Highlight the segment picked with the mouse, if any.
+    if (PickedSegment != Sapphire::SegmentBvh::npos)
+        DrawLine3D(PickedVertices[0], PickedVertices[1], YELLOW);
+
     // Draw an arrow pointing down to the left ear of the listener.
     // At rendering scale, the distance between the ears is negligible.
-    Vector3 arrowBottom;
-    arrowBottom.x = scale * Listener.at(0).x;
-    arrowBottom.y = scale * Listener.at(0).z;
-    arrowBottom.z = -scale * Listener.at(0).y;
+    Vector3 arrowBottom = WorldVector(Listener.at(0));
 
     Vector3 arrowTop = arrowBottom;
     arrowTop.y += (scale * 100);
@@ -175,50 +242,50 @@ static void Save(const Sapphire::LightningBolt& bolt)
     Thunder thunder{Listener, bolt.getMaxSegments()};
     thunder.start(bolt);
 
-    // Save lightning and thunder for study.
-    FILE *outfile = fopen("output/thunder.txt", "wt");
-    if (outfile != nullptr)
-    {
-        fprintf(outfile, "LightningBolt\n");
-        for (const BoltSegment &b : bolt.segments())
-            fprintf(outfile, "    (%lg, %lg, %lg) (%lg, %lg, %lg)\n", b.a.x, b.a.y, b.a.z, b.b.x, b.b.y, b.b.z);
+    // Append lightning and thunder to a binary archive for study.
+    // Any saved bolt can be re-rendered later using the `replay` program.
+    const char *outFileName = "output/thunder.snap";
+    SnapshotWriter writer;
+    if (writer.Open(outFileName))
+        writer.Write(bolt, thunder);
+    else
+        printf("ERROR: Save cannot open output file: %s\n", outFileName);
+}
 
-        const std::size_t n = thunder.numEars();
-        fprintf(outfile, "\nEar count = %d\n", static_cast<int>(n));
 
-        for (std::size_t i = 0; i < n; ++i)
-        {
-            fprintf(outfile, "\nThunder[%d]\n", static_cast<int>(i));
-            for (const ThunderSegment &t : thunder.segments(i))
-                fprintf(outfile, "    (%lg, %lg)\n", t.distance1, t.distance2);
-        }
+static void PickSegment(const Sapphire::LightningBolt& bolt, Ray ray)
+{
+    // Find the bolt segment passing closest to the mouse ray, within a tolerance of a few pixels
+    // at typical viewing distance, and report where it is and when the listener hears it.
+    using namespace Sapphire;
 
-        fclose(outfile);
-    }
+    const double toleranceMeters = 25.0;
+    PickedSegment = BoltIndex.pick(BoltVector(ray.position), BoltVector(ray.direction), toleranceMeters);
+    if (PickedSegment == SegmentBvh::npos)
+        return;
+
+    const BoltSegment& seg = bolt.segments().at(PickedSegment);
+    PickedVertices[0] = WorldVector(seg.a);
+    PickedVertices[1] = WorldVector(seg.b);
+    const double d1 = Distance(Listener.at(0), seg.a);
+    const double d2 = Distance(Listener.at(0), seg.b);
+    printf("Segment %lu: (%0.1lf, %0.1lf, %0.1lf) to (%0.1lf, %0.1lf, %0.1lf) meters, heard %0.3lf to %0.3lf seconds after the flash.\n",
+        static_cast<unsigned long>(PickedSegment),
+        seg.a.x, seg.a.y, seg.a.z,
+        seg.b.x, seg.b.y, seg.b.z,
+        std::min(d1, d2) / SPEED_OF_SOUND_IN_AIR,
+        std::max(d1, d2) / SPEED_OF_SOUND_IN_AIR);
 }
 
 
-static std::vector<int16_t> AudioBuffer;
-static std::size_t AudioBufferIndex;
-static std::mutex AudioMutex;
+static Sapphire::PlaybackQueue<NUM_CHANNELS> Playback;
 
 
 static void AudioInputCallback(void *buffer, unsigned frames)
 {
-    using namespace std;
-
-    int16_t *data = static_cast<int16_t *>(buffer);
-    unsigned s = 0;
-
-    {
-        lock_guard<mutex> guard(AudioMutex);
-        std::size_t n = AudioBuffer.size();
-        for (unsigned i = 0; i < frames; ++i)
-        {
-            data[s++] = (AudioBufferIndex < n) ? AudioBuffer[AudioBufferIndex++] : 0;
-            data[s++] = (AudioBufferIndex < n) ? AudioBuffer[AudioBufferIndex++] : 0;
-        }
-    }
+    // This runs on the audio thread, so it must not allocate memory or lock a mutex.
+    Sapphire::RealTimeAudit::AudioThreadScope scope("AudioInputCallback");
+    Playback.fill(static_cast<int16_t *>(buffer), frames);
 }
 
 
@@ -227,54 +294,60 @@ static void MakeThunder(Sapphire::LightningBolt& bolt)
     using namespace std;
 
     bolt.generate();
+    UpdateBoltVertices(bolt);
+    BoltIndex.build(bolt);
+    PickedSegment = Sapphire::SegmentBvh::npos;
     BackgroundThunder.start(bolt);
-    Sapphire::AudioBuffer rawBuffer = BackgroundThunder.renderAudio(SAMPLE_RATE);
 
+    // Normalize the audio to fit within 16-bit integer samples, straight into the playback buffer.
+    std::vector<int16_t>& samples = Playback.acquire();
+    Sapphire::NormalizingPipeline pipeline;
+    Sapphire::VectorStage playbackStage(samples);
+    pipeline.AddStage(playbackStage);
+
+    // The viewer plays the thunder as soon as the bolt appears,
+    // so the audio's leading silence (its start frame) is deliberately left out here.
 #if SELECTED_RENDER_MODE == RENDER_MODE_RAW
-    const std::vector<float>& audioData = rawBuffer.buffer();
-#elif SELECTED_RENDER_MODE == RENDER_MODE_CONVOLUTION
+    // The raw thunder's peak is known in advance, so it is rendered and converted
+    // one block at a time, without ever holding the whole event as floating-point audio.
+    static Sapphire::ThunderStreamer streamer;
+    streamer.streamRaw(BackgroundThunder, SAMPLE_RATE, pipeline, false);
+#else
+    // Render into recycled memory, so producing an event does not churn the allocator.
+    int frames = BackgroundThunder.durationFrames(SAMPLE_RATE);
+#if SELECTED_RENDER_MODE == RENDER_MODE_CONVOLUTION
+    frames += ConvolutionAudio.frames();
+#endif
+    Sapphire::AudioBuffer audio = BufferPool.acquire(frames, NUM_CHANNELS);
+
+#if SELECTED_RENDER_MODE == RENDER_MODE_CONVOLUTION
+    static Sapphire::ThunderConvolver convolver{ConvolutionAudio};
     printf("Starting convolution...\n");
-    Sapphire::AudioBuffer audioBuffer = Sapphire::Convolution(rawBuffer, ConvolutionAudio);
-    printf("Finished convolution.\n");
-    const std::vector<float>& audioData = audioBuffer.buffer();
+    convolver.renderInto(BackgroundThunder, SAMPLE_RATE, audio);
+    printf("Finished %s convolution.\n", (convolver.lastMethodUsed() == Sapphire::ConvolutionMethod::Sparse) ? "sparse" : "dense");
+#elif SELECTED_RENDER_MODE == RENDER_MODE_ABSORPTION
+    static Sapphire::AtmosphericAbsorption absorption;
+    absorption.renderInto(BackgroundThunder, SAMPLE_RATE, audio);
 #else
     #error unknown render mode
 #endif
 
-    // Normalize the raw audio to fit within 16-bit integer samples.
-    float maxSample = 0.0f;
-    for (float x : audioData)
-        maxSample = std::max(maxSample, std::abs(x));
-
-    if (maxSample == 0.0f)
-        maxSample = 1.0f;       // avoid division by zero
-
-    vector<int16_t> audio;
-    for (float x : audioData)
-    {
-        int16_t s = static_cast<int16_t>((x / maxSample) * 32700.0f);
-        audio.push_back(s);
-    }
-
-    {
-        lock_guard<mutex> guard(AudioMutex);
-        AudioBuffer = audio;
-        AudioBufferIndex = 0;
-    }
+    pipeline.Run(audio.samples(), audio.buffer().size());
+    BufferPool.release(std::move(audio));
+#endif
 
-    {
-        // Now that we have started the new audio render, save the audio at our leisure.
-        Sapphire::ScaledWaveFileWriter wave;
-        const char *outWaveFileName = "output/thunder.wav";
-        if (wave.Open(outWaveFileName, SAMPLE_RATE, NUM_CHANNELS))
-        {
-            wave.WriteSamples(audioData.data(), static_cast<int>(audioData.size()));
-        }
-        else
-        {
-            printf("ERROR: MakeThunder cannot open output file: %s\n", outWaveFileName);
-        }
-    }
+    // Hand the new samples to the audio thread without copying them or waiting for it.
+    Playback.publish();
+
+    // Only now, while the thunder is already playing, save the same samples to the WAV file.
+    // The published slot is only read from here on, by the audio thread and by this thread,
+    // and acquire() will not hand it out again until the next publish().
+    Sapphire::WaveFileWriter wave;
+    const char *outWaveFileName = "output/thunder.wav";
+    if (wave.Open(outWaveFileName, SAMPLE_RATE, NUM_CHANNELS))
+        wave.WriteSamples(samples.data(), static_cast<int>(samples.size()));
+    else
+        printf("ERROR: MakeThunder cannot open output file: %s\n", outWaveFileName);
 }
 
 #if SELECTED_RENDER_MODE == RENDER_MODE_CONVOLUTION
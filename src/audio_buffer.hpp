@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <stdexcept>
 
@@ -10,6 +12,8 @@ namespace Sapphire
     private:
         std::vector<float> data;
         int nChannels;
+        int nFrames;
+        int nStartFrame = 0;
 
         static std::size_t DataLength(int frames, int channels)
         {
@@ -26,25 +30,81 @@ namespace Sapphire
         // Placeholder audio with 1 channel and 0 frames.
         AudioBuffer()
             : nChannels(1)
+            , nFrames(0)
             {}
 
         // Construct an AudioBuffer with a pre-calculated float array.
         AudioBuffer(const std::vector<float>& _data, int _channels)
             : data(_data)
             , nChannels(_channels)
+            , nFrames(0)
         {
             if (nChannels < 1)
                 throw std::range_error("Invalid number of channels for AudioBuffer.");
 
             if (data.size() % static_cast<std::size_t>(nChannels) != 0)
                 throw std::range_error("Data length is not an integer multiple of the channel count.");
+
+            nFrames = static_cast<int>(data.size() / static_cast<std::size_t>(nChannels));
         }
 
         // Construct an AudioBuffer with all zero samples for a frame count and channel count.
         AudioBuffer(int _frames, int _channels)
             : data(DataLength(_frames, _channels))
             , nChannels(_channels)
+            , nFrames(_frames)
+        {
+        }
+
+        // Change the size of the buffer and set every sample to zero.
+        // The existing memory is reused whenever its capacity is large enough,
+        // so a buffer that is reset for every event stops allocating once it has grown to full size.
+        void reset(int _frames, int _channels)
+        {
+            data.assign(DataLength(_frames, _channels), 0.0f);
+            nChannels = _channels;
+            nFrames = _frames;
+            nStartFrame = 0;
+        }
+
+        void reset(int _frames, int _channels, int _startFrame)
+        {
+            reset(_frames, _channels);
+            setStartFrame(_startFrame);
+        }
+
+        // The stored frames are not necessarily the beginning of the sound.
+        // A distant listener hears nothing at all until the first sound arrives,
+        // which can be many seconds after the lightning. Instead of storing all that silence,
+        // the buffer remembers how many silent frames come before its first stored frame.
+        // Frame numbers passed to at() and get() are still relative to the first stored frame;
+        // use startFrame() to convert them to absolute time.
+        int startFrame() const
+        {
+            return nStartFrame;
+        }
+
+        void setStartFrame(int _startFrame)
         {
+            if (_startFrame < 0)
+                throw std::range_error("Start frame is not allowed to be negative.");
+            nStartFrame = _startFrame;
+        }
+
+        // One past the absolute frame number of the last stored frame.
+        int endFrame() const
+        {
+            return nStartFrame + nFrames;
+        }
+
+        void reserve(std::size_t samples)
+        {
+            data.reserve(samples);
+        }
+
+        std::size_t capacity() const
+        {
+            return data.capacity();
         }
 
         const std::vector<float>& buffer() const
@@ -52,6 +112,16 @@ namespace Sapphire
             return data;
         }
 
+        float *samples()
+        {
+            return data.data();
+        }
+
+        const float *samples() const
+        {
+            return data.data();
+        }
+
         int channels() const
         {
             return nChannels;
@@ -59,7 +129,7 @@ namespace Sapphire
 
         int frames() const
         {
-            return static_cast<int>(data.size()) / nChannels;
+            return nFrames;
         }
 
         std::size_t index(int channel, int frame) const
@@ -79,5 +149,165 @@ namespace Sapphire
             const std::size_t i = index(channel, frame);
             return (i < data.size()) ? data[i] : 0.0f;
         }
+
+        float getAbsolute(int channel, int absoluteFrame) const
+        {
+            // Like get(), but the frame number counts from the start of the sound,
+            // including the leading silence that is not stored.
+            if (absoluteFrame < nStartFrame || absoluteFrame >= endFrame())
+                return 0.0f;
+            return data[index(channel, absoluteFrame - nStartFrame)];
+        }
     };
+
+
+    // FixedAudioBuffer is like AudioBuffer, except the number of channels is a compile-time constant.
+    // That allows loops over frames and channels to be fully unrolled and vectorized.
+    // Use AudioBuffer when the number of channels is only known at runtime.
+    template <int N>
+    class FixedAudioBuffer
+    {
+        static_assert(N >= 1, "FixedAudioBuffer must have at least one channel.");
+
+    private:
+        std::vector<float> data;
+        int nFrames;
+        int nStartFrame = 0;
+
+    public:
+        FixedAudioBuffer()
+            : nFrames(0)
+            {}
+
+        explicit FixedAudioBuffer(int _frames)
+            : data(static_cast<std::size_t>(std::max(0, _frames)) * N)
+            , nFrames(_frames)
+        {
+            if (_frames < 0)
+                throw std::range_error("Frame count is not allowed to be negative.");
+        }
+
+        explicit FixedAudioBuffer(const AudioBuffer& audio)
+            : data(audio.buffer())
+            , nFrames(audio.frames())
+            , nStartFrame(audio.startFrame())
+        {
+            if (audio.channels() != N)
+                throw std::range_error("AudioBuffer has the wrong number of channels for FixedAudioBuffer.");
+        }
+
+        AudioBuffer toAudioBuffer() const
+        {
+            AudioBuffer audio(data, N);
+            audio.setStartFrame(nStartFrame);
+            return audio;
+        }
+
+        // The number of silent frames before the first stored frame, as in AudioBuffer.
+        int startFrame() const
+        {
+            return nStartFrame;
+        }
+
+        void setStartFrame(int _startFrame)
+        {
+            if (_startFrame < 0)
+                throw std::range_error("Start frame is not allowed to be negative.");
+            nStartFrame = _startFrame;
+        }
+
+        int endFrame() const
+        {
+            return nStartFrame + nFrames;
+        }
+
+        const std::vector<float>& buffer() const
+        {
+            return data;
+        }
+
+        float *samples()
+        {
+            return data.data();
+        }
+
+        const float *samples() const
+        {
+            return data.data();
+        }
+
+        static constexpr int channels()
+        {
+            return N;
+        }
+
+        int frames() const
+        {
+            return nFrames;
+        }
+
+        static std::size_t index(int channel, int frame)
+        {
+            return static_cast<std::size_t>(frame)*N + static_cast<std::size_t>(channel);
+        }
+
+        float& at(int channel, int frame)
+        {
+            return data.at(index(channel, frame));
+        }
+
+        float get(int channel, int frame) const
+        {
+            const std::size_t i = index(channel, frame);
+            return (i < data.size()) ? data[i] : 0.0f;
+        }
+    };
+
+
+    inline void MixInto(AudioBuffer& target, const AudioBuffer& source, float gain = 1.0f, int delayFrames = 0)
+    {
+        // Adds `gain` times `source` into `target`, lining the two up by absolute frame number,
+        // after moving `source` `delayFrames` frames later.
+        // Only frames stored by both buffers are touched, so mixing a distant event
+        // into a short output block costs nothing for the silence in between.
+        // `source` must have the same number of channels as `target`, or exactly one channel,
+        // which is then mixed into every channel of `target`.
+        const int nc = target.channels();
+        const int sc = source.channels();
+        if (sc != nc && sc != 1)
+            throw std::range_error("MixInto requires matching channel counts, or a single-channel source.");
+
+        const int sourceStart = source.startFrame() + delayFrames;
+        const int first = std::max(target.startFrame(), sourceStart);
+        const int last = std::min(target.endFrame(), source.endFrame() + delayFrames);
+        float *y = target.samples();
+        const float *x = source.samples();
+        for (int f = first; f < last; ++f)
+        {
+            float *yf = y + static_cast<std::size_t>(f - target.startFrame()) * nc;
+            const float *xf = x + static_cast<std::size_t>(f - sourceStart) * sc;
+            for (int c = 0; c < nc; ++c)
+                yf[c] += gain * xf[(sc == 1) ? 0 : c];
+        }
+    }
+
+
+    template <int N>
+    inline void CopyFramesWithSilence(int16_t *output, unsigned frames, const std::vector<int16_t>& input, std::size_t& inputIndex)
+    {
+        // Copy as many whole frames from `input` as are available, starting at `inputIndex`,
+        // then pad the remainder of `output` with silence.
+        const std::size_t available = (inputIndex < input.size()) ? (input.size() - inputIndex) / N : 0;
+        const unsigned ncopy = static_cast<unsigned>(std::min<std::size_t>(frames, available));
+        const int16_t *source = input.data() + inputIndex;
+        for (unsigned f = 0; f < ncopy; ++f)
+            for (int c = 0; c < N; ++c)
+                output[f*N + c] = source[f*N + c];
+
+        for (unsigned f = ncopy; f < frames; ++f)
+            for (int c = 0; c < N; ++c)
+                output[f*N + c] = 0;
+
+        inputIndex += static_cast<std::size_t>(ncopy) * N;
+    }
 }
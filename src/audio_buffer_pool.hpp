@@ -0,0 +1,106 @@
+#pragma once
+
+// audio_buffer_pool.hpp  -  Recycles AudioBuffer memory between thunder events.
+//
+// Each event needs a few buffers of a few megabytes each, and their exact sizes vary
+// from one event to the next. Instead of freeing them and allocating new ones every time,
+// release them back to the pool. The pool sorts buffers into size classes by powers of two,
+// so a released buffer can be handed out again for any later request of a similar size.
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "audio_buffer.hpp"
+
+namespace Sapphire
+{
+    class AudioBufferPool
+    {
+    private:
+        static const int NumClasses = 40;           // up to 2^39 samples, far more than any thunder event
+        static const int MaxClassWaste = 2;         // hand out buffers up to 2^2 = 4 times larger than requested
+
+        const std::size_t maxBuffersPerClass;
+        std::vector<std::vector<AudioBuffer>> freeBuffers;
+
+        static int ClassHolding(std::size_t samples)
+        {
+            // The smallest class whose buffers all hold at least `samples` samples.
+            int k = 0;
+            while (k < NumClasses-1 && (static_cast<std::size_t>(1) << k) < samples)
+                ++k;
+            return k;
+        }
+
+        static int ClassOf(std::size_t capacity)
+        {
+            // The largest class whose size does not exceed `capacity`.
+            int k = 0;
+            while (k < NumClasses-1 && (static_cast<std::size_t>(2) << k) <= capacity)
+                ++k;
+            return k;
+        }
+
+    public:
+        explicit AudioBufferPool(std::size_t _maxBuffersPerClass = 4)
+            : maxBuffersPerClass(_maxBuffersPerClass)
+            , freeBuffers(NumClasses)
+        {
+            // Reserve the free lists now, so releasing a buffer never allocates.
+            for (std::vector<AudioBuffer>& list : freeBuffers)
+                list.reserve(maxBuffersPerClass);
+        }
+
+        // Returns a zeroed buffer of the requested size, reusing pooled memory when possible.
+        // A newly allocated buffer gets the full capacity of its size class,
+        // so it can satisfy any request in that class after it is released.
+        AudioBuffer acquire(int frames, int channels)
+        {
+            if (frames < 0 || channels < 1)
+                throw std::range_error("Invalid buffer size requested from AudioBufferPool.");
+
+            const std::size_t samples = static_cast<std::size_t>(frames) * channels;
+            const int k = ClassHolding(samples);
+            AudioBuffer buffer;
+            bool found = false;
+            for (int j = k; j <= k + MaxClassWaste && j < NumClasses && !found; ++j)
+            {
+                std::vector<AudioBuffer>& list = freeBuffers[j];
+                if (!list.empty())
+                {
+                    buffer = std::move(list.back());
+                    list.pop_back();
+                    found = true;
+                }
+            }
+
+            if (!found)
+                buffer.reserve(static_cast<std::size_t>(1) << k);
+
+            buffer.reset(frames, channels);
+            return buffer;
+        }
+
+        // Gives a buffer's memory back to the pool.
+        // If its size class is already full, the memory is simply freed.
+        void release(AudioBuffer&& buffer)
+        {
+            const std::size_t capacity = buffer.capacity();
+            if (capacity == 0)
+                return;
+
+            std::vector<AudioBuffer>& list = freeBuffers[ClassOf(capacity)];
+            if (list.size() < maxBuffersPerClass)
+                list.push_back(std::move(buffer));
+        }
+
+        std::size_t pooledBuffers() const
+        {
+            std::size_t count = 0;
+            for (const std::vector<AudioBuffer>& list : freeBuffers)
+                count += list.size();
+            return count;
+        }
+    };
+}
@@ -0,0 +1,261 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// bench.cpp  -  A fixed, repeatable workload that exercises every kernel the way the
+// real programs do, timing each stage. Used for comparing instruction-set variants
+// and as the training run for the profile-guided build (see the `pgo` script).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "kernels.hpp"
+#include "lightning.hpp"
+#include "convolution.hpp"
+#include "sparse_convolution.hpp"
+#include "ir_bank.hpp"
+#include "listener_map.hpp"
+#include "segment_bvh.hpp"
+#include "multi_stroke.hpp"
+#include "pipeline.hpp"
+
+using namespace Sapphire;
+using Kernels::InstructionSet;
+
+const int SAMPLE_RATE = 44100;
+const std::size_t MAX_SEGMENTS = 2000;
+
+static const BoltPointList Listener
+{
+    BoltPoint{2500.0, +0.1, 0.0},
+    BoltPoint{2500.0, -0.1, 0.0}
+};
+
+
+enum Stage
+{
+    STAGE_RENDER,
+    STAGE_PARALLEL_RENDER,
+    STAGE_DIRECT_CONVOLUTION,
+    STAGE_SPARSE_CONVOLUTION,
+    STAGE_IR_BANK,
+    STAGE_MULTI_STROKE,
+    STAGE_CONVERSION,
+    STAGE_LISTENER_MAP,
+    STAGE_OCCLUSION,
+    NUM_STAGES
+};
+
+static const char *StageNames[NUM_STAGES] =
+{
+    "render",
+    "parallel render",
+    "direct convolution",
+    "sparse convolution",
+    "impulse bank (3)",
+    "multi-stroke (4)",
+    "int16 conversion",
+    "listener map",
+    "occlusion",
+};
+
+
+class Stopwatch
+{
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+    double lap()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        start = now;
+        return elapsed;
+    }
+};
+
+
+static AudioBuffer MakeImpulse(int frames, unsigned seed = 99)
+{
+    // A decaying noise burst, roughly like a room or terrain echo.
+    std::default_random_engine engine(seed);
+    std::normal_distribution<float> noise;
+    AudioBuffer ir(frames, 1);
+    for (int f = 0; f < frames; ++f)
+        ir.at(0, f) = noise(engine) * std::exp(-6.0f * f / frames);
+    return ir;
+}
+
+
+static void RunWorkload(int events, double seconds[NUM_STAGES])
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(Listener, MAX_SEGMENTS);
+    AudioBuffer raw;
+    AudioBuffer processed;
+    AudioBuffer shortImpulse = MakeImpulse(256);
+    ThunderConvolver convolver(MakeImpulse(16384));
+    ImpulseResponseBank bank;
+    bank.add(MakeImpulse(16384, 101));
+    bank.add(MakeImpulse(4096, 102));
+    bank.add(MakeImpulse(1024, 103));
+    const std::vector<double> bankGains { 0.6, 0.3, 0.1 };
+    MultiStrokeFlash flash;
+    AudioBuffer flashAudio;
+    ReturnStrokeList strokes;
+    RandomReturnStrokes(strokes, 4, 1);
+    std::vector<int16_t> samples;
+    VectorStage stage(samples);
+    NormalizingPipeline pipeline;
+    pipeline.AddStage(stage);
+
+    ListenerMapper mapper;
+    ListenerGrid grid;
+    grid.origin = BoltPoint{-5000.0, -5000.0, 0.0};
+    grid.spacingX = grid.spacingY = 10000.0 / 63;
+    grid.nx = grid.ny = 64;
+    std::vector<ListenerPointMetrics> metrics;
+
+    // A building between the listener and most bolts, hiding the lower part of each one.
+    SegmentBvh bvh;
+    const OccluderList occluders { Occluder{BoltPoint{2300.0, -100.0, 0.0}, BoltPoint{2350.0, 100.0, 60.0}} };
+
+    for (int s = 0; s < NUM_STAGES; ++s)
+        seconds[s] = 0.0;
+
+    for (int event = 1; event <= events; ++event)
+    {
+        bolt.setSeed(static_cast<unsigned>(event));
+        bolt.generate();
+        thunder.start(bolt);
+
+        Stopwatch watch;
+        thunder.renderAudioInto(SAMPLE_RATE, raw);
+        seconds[STAGE_RENDER] += watch.lap();
+
+        thunder.renderAudioParallelInto(SAMPLE_RATE, processed);
+        seconds[STAGE_PARALLEL_RENDER] += watch.lap();
+
+        ConvolveInto(processed, raw, shortImpulse);
+        seconds[STAGE_DIRECT_CONVOLUTION] += watch.lap();
+
+        convolver.renderInto(thunder, SAMPLE_RATE, processed, ConvolutionMethod::Sparse);
+        seconds[STAGE_SPARSE_CONVOLUTION] += watch.lap();
+
+        bank.convolveInto(processed, raw, bankGains);
+        seconds[STAGE_IR_BANK] += watch.lap();
+
+        // The stroke is the raw render above; only the extra strokes' mixing is timed.
+        flash.stroke() = raw;
+        watch.lap();
+        flash.renderInto(flashAudio, strokes, SAMPLE_RATE);
+        seconds[STAGE_MULTI_STROKE] += watch.lap();
+
+        pipeline.Run(processed.samples(), processed.buffer().size());
+        seconds[STAGE_CONVERSION] += watch.lap();
+
+        mapper.load(bolt);
+        mapper.evaluateGrid(grid, metrics, 1);
+        seconds[STAGE_LISTENER_MAP] += watch.lap();
+
+        bvh.build(bolt);
+        thunder.start(bolt, bvh, occluders, 0.25);
+        seconds[STAGE_OCCLUSION] += watch.lap();
+    }
+}
+
+
+static int PrintUsage()
+{
+    printf(
+        "USAGE: bench [-n events] [-k kernels]\n"
+        "\n"
+        "    -n events       number of thunder events to produce (default 10)\n"
+        "    -k kernels      auto, baseline, avx2, avx512, or all (default auto)\n"
+    );
+    return 1;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    int events = 10;
+    std::string kernels = "auto";
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i+1 >= argc)
+            return PrintUsage();
+
+        if (!strcmp(argv[i], "-n"))
+            events = atoi(argv[i+1]);
+        else if (!strcmp(argv[i], "-k"))
+            kernels = argv[i+1];
+        else
+            return PrintUsage();
+    }
+
+    if (events < 1)
+        return PrintUsage();
+
+    std::vector<InstructionSet> sets;
+    if (kernels == "auto")
+        sets.push_back(Kernels::Selected());
+    else if (kernels == "all")
+        sets = { InstructionSet::Baseline, InstructionSet::AVX2, InstructionSet::AVX512 };
+    else if (kernels == "baseline")
+        sets.push_back(InstructionSet::Baseline);
+    else if (kernels == "avx2")
+        sets.push_back(InstructionSet::AVX2);
+    else if (kernels == "avx512")
+        sets.push_back(InstructionSet::AVX512);
+    else
+        return PrintUsage();
+
+    for (InstructionSet set : sets)
+    {
+        if (!Kernels::IsAvailable(set))
+        {
+            printf("bench: %s kernels are not available on this machine.\n", Kernels::InstructionSetName(set));
+            continue;
+        }
+
+        Kernels::Select(set);
+        double seconds[NUM_STAGES];
+        RunWorkload(events, seconds);
+
+        double total = 0.0;
+        printf("bench: %s kernels, %d events\n", Kernels::InstructionSetName(set), events);
+        for (int s = 0; s < NUM_STAGES; ++s)
+        {
+            printf("    %-20s %9.3lf ms/event\n", StageNames[s], 1000.0 * seconds[s] / events);
+            total += seconds[s];
+        }
+        printf("    %-20s %9.3lf ms/event\n", "total", 1000.0 * total / events);
+    }
+    return 0;
+}
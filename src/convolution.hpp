@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <memory>
 #include <vector>
 #include <stdexcept>
 #include "audio_buffer.hpp"
+#include "fft.hpp"
+#include "kernels.hpp"
 
 namespace Sapphire
 {
@@ -10,7 +16,45 @@ namespace Sapphire
     {
         int channels = std::max(f.channels(), g.channels());
         int frames = f.frames() + g.frames();
-        return AudioBuffer(frames, channels);
+        AudioBuffer y(frames, channels);
+        y.setStartFrame(f.startFrame() + g.startFrame());
+        return y;
+    }
+
+    inline double L1Norm(const AudioBuffer& g, int channel)
+    {
+        // The sum of absolute values of one channel. Convolving any signal with `g`
+        // can multiply its peak amplitude by at most this much.
+        double sum = 0.0;
+        for (int i = 0; i < g.frames(); ++i)
+            sum += std::abs(static_cast<double>(g.get(channel, i)));
+        return sum;
+    }
+
+    inline void InitConvolutionBufferInto(AudioBuffer& y, const AudioBuffer& f, const AudioBuffer& g)
+    {
+        // Same as InitConvolutionBuffer, but reuses the memory already owned by `y`.
+        int channels = std::max(f.channels(), g.channels());
+        int frames = f.frames() + g.frames();
+
+        // Leading silence in either input delays the result without being convolved.
+        y.reset(frames, channels, f.startFrame() + g.startFrame());
+    }
+
+    template <int YC, int FC, int GC>
+    inline void ConvolveStrided(
+        float *y, int yframes, int ystride, int yc,
+        const float *f, int fframes, int fstride, int fc,
+        const float *g, int gframes, int gstride, int gc)
+    {
+        // Convolve one channel of the interleaved signal `f` with one channel of `g`,
+        // storing the result in one channel of `y`.
+        // Each of YC, FC, GC is a channel count known at compile time,
+        // or 0 to use the corresponding runtime stride instead.
+        const int ys = (YC > 0) ? YC : ystride;
+        const int fs = (FC > 0) ? FC : fstride;
+        const int gs = (GC > 0) ? GC : gstride;
+        Kernels::ConvolveChannel(y + yc, yframes, ys, f + fc, fframes, fs, g + gc, gframes, gs);
     }
 
     inline void ConvolveChannelPair(
@@ -20,19 +64,20 @@ namespace Sapphire
         const AudioBuffer& g,
         int gc)
     {
-        const int yf = y.frames();
-        const int gf = g.frames();
-        for (int i = 0; i < yf; ++i)
-        {
-            float sum = 0.0f;
-            for (int k = gf-1; k >= 0; --k)
-                sum += g.get(gc, k) * f.get(fc, i-k);
-            y.at(fc, i) = sum;
-        }
+        // The kernel picks an unrolled loop for the most common combinations of channel counts.
+        ConvolveStrided<0, 0, 0>(
+            y.samples(), y.frames(), y.channels(), fc,
+            f.samples(), f.frames(), f.channels(), fc,
+            g.samples(), g.frames(), g.channels(), gc);
     }
 
-    inline AudioBuffer Convolution(const AudioBuffer& f, const AudioBuffer& g)
+    inline void ConvolveInto(AudioBuffer& y, const AudioBuffer& f, const AudioBuffer& g)
     {
+        // Stores the convolution of `f` and `g` in `y`, reusing the memory `y` already owns.
+        // `y` must not be the same object as `f` or `g`.
+        if (&y == &f || &y == &g)
+            throw std::logic_error("ConvolveInto cannot store its result in one of its inputs.");
+
         const int fc = f.channels();
         const int gc = g.channels();
 
@@ -41,10 +86,10 @@ namespace Sapphire
         {
             // Case 1: `f` and `g` have the same number of channels.
             // Convolve corresponding channels in `f` and `g` to produce the result.
-            AudioBuffer y = InitConvolutionBuffer(f, g);
+            InitConvolutionBufferInto(y, f, g);
             for (int c = 0; c < fc; ++c)
                 ConvolveChannelPair(y, f, c, g, c);
-            return y;
+            return;
         }
 
         if (gc == 1)
@@ -52,18 +97,145 @@ namespace Sapphire
             // Case 2: `f` has more than one channel and `g` has exactly one channel.
             // Convolve the single channel of `g` with every channel of `f` to produce
             // a result that has the same number of channels as `f`.
-            AudioBuffer y = InitConvolutionBuffer(f, g);
+            InitConvolutionBufferInto(y, f, g);
             for (int c = 0; c < fc; ++c)
                 ConvolveChannelPair(y, f, c, g, 0);
-            return y;
+            return;
         }
 
         if (fc == 1)
         {
             // Use recursion to flip `f` and `g`, resulting in a commutation of Case 2.
-            return Convolution(g, f);
+            ConvolveInto(y, g, f);
+            return;
         }
 
         throw std::range_error("The audio buffers have an incompatible number of channels for convolution.");
     }
+
+    inline AudioBuffer Convolution(const AudioBuffer& f, const AudioBuffer& g)
+    {
+        AudioBuffer y;
+        ConvolveInto(y, f, g);
+        return y;
+    }
+
+
+    inline void FftConvolveChannelPair(
+        AudioBuffer& y,
+        const AudioBuffer& f,
+        int fc,
+        const AudioBuffer& g,
+        int gc,
+        const FourierTransform<double>& fft,
+        std::vector<std::complex<double>>& fspec,
+        std::vector<std::complex<double>>& gspec)
+    {
+        // Same result as ConvolveChannelPair, calculated by multiplying spectra.
+        // The FFT size must be at least the number of frames in `y`, so the circular
+        // convolution does not wrap around.
+        const std::size_t n = fft.size();
+        if (n < static_cast<std::size_t>(y.frames()))
+            throw std::range_error("FFT is too small for convolution.");
+
+        fspec.assign(n, 0.0);
+        gspec.assign(n, 0.0);
+        for (int i = 0; i < f.frames(); ++i)
+            fspec[i] = f.get(fc, i);
+        for (int i = 0; i < g.frames(); ++i)
+            gspec[i] = g.get(gc, i);
+
+        fft.forward(fspec.data());
+        fft.forward(gspec.data());
+        for (std::size_t k = 0; k < n; ++k)
+            fspec[k] *= gspec[k];
+        fft.inverse(fspec.data());
+
+        const int yf = y.frames();
+        for (int i = 0; i < yf; ++i)
+            y.at(fc, i) = static_cast<float>(fspec[i].real());
+    }
+
+    // Memory reused by FftConvolveInto from one call to the next:
+    // one FourierTransform per power-of-two size, created the first time it is needed,
+    // and the spectrum buffers.
+    class FftWorkspace
+    {
+    private:
+        std::vector<std::unique_ptr<FourierTransform<double>>> transforms;
+
+    public:
+        std::vector<std::complex<double>> fspec;
+        std::vector<std::complex<double>> gspec;
+
+        const FourierTransform<double>& transform(std::size_t size)
+        {
+            int k = 0;
+            while ((static_cast<std::size_t>(1) << k) < size)
+                ++k;
+
+            if (transforms.size() <= static_cast<std::size_t>(k))
+                transforms.resize(static_cast<std::size_t>(k) + 1);
+
+            if (!transforms[k])
+                transforms[k].reset(new FourierTransform<double>(static_cast<std::size_t>(1) << k));
+
+            return *transforms[k];
+        }
+    };
+
+    inline void FftConvolveInto(AudioBuffer& y, const AudioBuffer& f, const AudioBuffer& g, FftWorkspace& workspace)
+    {
+        // Produces the same result as ConvolveInto, up to roundoff error,
+        // in O(n log n) time instead of O(n*m). The channel rules are the same.
+        if (&y == &f || &y == &g)
+            throw std::logic_error("FftConvolveInto cannot store its result in one of its inputs.");
+
+        const int fc = f.channels();
+        const int gc = g.channels();
+
+        if (fc != gc && gc != 1)
+        {
+            if (fc == 1)
+            {
+                FftConvolveInto(y, g, f, workspace);
+                return;
+            }
+
+            throw std::range_error("The audio buffers have an incompatible number of channels for convolution.");
+        }
+
+        InitConvolutionBufferInto(y, f, g);
+        const FourierTransform<double>& fft = workspace.transform(static_cast<std::size_t>(std::max(1, y.frames())));
+        for (int c = 0; c < fc; ++c)
+            FftConvolveChannelPair(y, f, c, g, (gc == 1) ? 0 : c, fft, workspace.fspec, workspace.gspec);
+    }
+
+    inline AudioBuffer FftConvolution(const AudioBuffer& f, const AudioBuffer& g)
+    {
+        AudioBuffer y;
+        FftWorkspace workspace;
+        FftConvolveInto(y, f, g, workspace);
+        return y;
+    }
+
+
+    template <int N, int M>
+    inline FixedAudioBuffer<N> Convolution(const FixedAudioBuffer<N>& f, const FixedAudioBuffer<M>& g)
+    {
+        // The same rules as the dynamic version, but resolved at compile time:
+        // either `g` has the same number of channels as `f`, or `g` has a single channel.
+        static_assert(M == N || M == 1, "The audio buffers have an incompatible number of channels for convolution.");
+
+        FixedAudioBuffer<N> y(f.frames() + g.frames());
+        y.setStartFrame(f.startFrame() + g.startFrame());
+        for (int c = 0; c < N; ++c)
+        {
+            ConvolveStrided<N, N, M>(
+                y.samples(), y.frames(), N, c,
+                f.samples(), f.frames(), N, c,
+                g.samples(), g.frames(), M, (M == 1) ? 0 : c);
+        }
+        return y;
+    }
 }
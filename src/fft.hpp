@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+
+namespace Sapphire
+{
+    inline std::size_t NextPowerOfTwo(std::size_t n)
+    {
+        std::size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+
+    // An in-place radix-2 complex FFT of a fixed power-of-two size.
+    // The twiddle factors and bit-reversal table are calculated once at construction,
+    // so transforms can be repeated any number of times without allocating memory.
+    template <typename real_t = double>
+    class FourierTransform
+    {
+    private:
+        using complex_t = std::complex<real_t>;
+
+        std::size_t n;
+        std::vector<complex_t> twiddle;         // exp(-2*pi*i*k/n) for k = 0 .. n/2-1
+        std::vector<std::size_t> reversal;
+
+        void transform(complex_t *data, bool inverse) const
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                if (i < reversal[i])
+                    std::swap(data[i], data[reversal[i]]);
+
+            for (std::size_t len = 2; len <= n; len <<= 1)
+            {
+                const std::size_t half = len / 2;
+                const std::size_t step = n / len;
+                for (std::size_t start = 0; start < n; start += len)
+                {
+                    for (std::size_t k = 0; k < half; ++k)
+                    {
+                        complex_t w = twiddle[k * step];
+                        if (inverse)
+                            w = std::conj(w);
+                        complex_t u = data[start + k];
+                        complex_t v = data[start + k + half] * w;
+                        data[start + k] = u + v;
+                        data[start + k + half] = u - v;
+                    }
+                }
+            }
+        }
+
+    public:
+        explicit FourierTransform(std::size_t _size)
+            : n(_size)
+            , twiddle(_size / 2)
+            , reversal(_size)
+        {
+            if (n < 1 || (n & (n-1)) != 0)
+                throw std::range_error("FFT size must be a positive power of two.");
+
+            for (std::size_t k = 0; k < n/2; ++k)
+            {
+                double angle = -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(n);
+                twiddle[k] = complex_t(static_cast<real_t>(std::cos(angle)), static_cast<real_t>(std::sin(angle)));
+            }
+
+            int bits = 0;
+            while ((static_cast<std::size_t>(1) << bits) < n)
+                ++bits;
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                std::size_t r = 0;
+                for (int b = 0; b < bits; ++b)
+                    if (i & (static_cast<std::size_t>(1) << b))
+                        r |= static_cast<std::size_t>(1) << (bits - 1 - b);
+                reversal[i] = r;
+            }
+        }
+
+        std::size_t size() const
+        {
+            return n;
+        }
+
+        void forward(complex_t *data) const
+        {
+            transform(data, false);
+        }
+
+        void inverse(complex_t *data) const
+        {
+            // The inverse includes the 1/n scale factor, so forward followed by inverse is the identity.
+            transform(data, true);
+            const real_t scale = static_cast<real_t>(1) / static_cast<real_t>(n);
+            for (std::size_t i = 0; i < n; ++i)
+                data[i] *= scale;
+        }
+    };
+}
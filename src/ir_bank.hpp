@@ -0,0 +1,317 @@
+#pragma once
+
+// ir_bank.hpp  -  Convolves thunder with a weighted blend of several impulse responses at once.
+//
+// Convolution is linear, so convolving with each impulse response separately and mixing
+// the results is the same as convolving once with the mix of the impulse responses.
+// In the frequency domain that mix is just a weighted sum of the impulse response spectra.
+// The bank keeps every impulse response's spectrum cached, so each event needs one forward
+// FFT of the thunder per channel, a complex multiply-accumulate per impulse response,
+// and one inverse FFT per channel, no matter how many impulse responses are blended.
+// The spectra are cached separately for each FFT size, so every event is convolved
+// at the smallest FFT size that fits it, however long the events before it were.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "audio_buffer.hpp"
+#include "convolution.hpp"
+#include "fft.hpp"
+#include "lightning.hpp"
+
+namespace Sapphire
+{
+    class ImpulseResponseBank
+    {
+    private:
+        using complex_t = std::complex<double>;
+        using spectrum_t = std::vector<complex_t>;
+
+        struct Entry
+        {
+            AudioBuffer impulse;
+            std::vector<double> norm;               // L1 norm of each impulse response channel
+        };
+
+        struct SpectrumSet
+        {
+            std::size_t size = 0;                   // FFT size of every spectrum in the set
+            std::vector<std::vector<spectrum_t>> spectrum;     // [entry][impulse response channel]
+        };
+
+        std::vector<Entry> entries;
+        std::vector<SpectrumSet> spectra;           // one set per FFT size used so far, usually only a few
+        int minStartFrame = 0;                      // earliest start frame of any impulse response
+        int span = 0;                               // frames from `minStartFrame` to the end of the longest impulse response
+        FftWorkspace workspace;
+        spectrum_t blend;                           // the weighted sum of the impulse response spectra for one channel
+        AudioBuffer raw;                            // rasterized thunder for renderInto
+
+        void updateSpan()
+        {
+            minStartFrame = entries[0].impulse.startFrame();
+            for (const Entry& e : entries)
+                minStartFrame = std::min(minStartFrame, e.impulse.startFrame());
+
+            span = 0;
+            for (const Entry& e : entries)
+                span = std::max(span, e.impulse.endFrame() - minStartFrame);
+        }
+
+        static std::size_t FftSize(int frames, int span)
+        {
+            return NextPowerOfTwo(static_cast<std::size_t>(std::max(1, frames + span)));
+        }
+
+        const SpectrumSet& spectraFor(std::size_t n)
+        {
+            for (const SpectrumSet& set : spectra)
+                if (set.size == n)
+                    return set;
+
+            // Each impulse response is placed in the FFT buffer at its delay relative to
+            // the earliest impulse response, so impulse responses with different start frames
+            // can still be added together.
+            const FourierTransform<double>& fft = workspace.transform(n);
+            SpectrumSet set;
+            set.size = n;
+            set.spectrum.resize(entries.size());
+            for (std::size_t k = 0; k < entries.size(); ++k)
+            {
+                const AudioBuffer& g = entries[k].impulse;
+                const int delay = g.startFrame() - minStartFrame;
+                set.spectrum[k].resize(static_cast<std::size_t>(g.channels()));
+                for (int c = 0; c < g.channels(); ++c)
+                {
+                    spectrum_t& spec = set.spectrum[k][c];
+                    spec.assign(n, 0.0);
+                    for (int i = 0; i < g.frames(); ++i)
+                        spec[delay + i] = g.get(c, i);
+                    fft.forward(spec.data());
+                }
+            }
+            spectra.push_back(std::move(set));
+            return spectra.back();
+        }
+
+        void checkGains(const std::vector<double>& gains, int nchannels) const
+        {
+            if (gains.size() != entries.size() && gains.size() != entries.size() * static_cast<std::size_t>(nchannels))
+                throw std::range_error("ImpulseResponseBank needs one gain per impulse response, or one per impulse response per channel.");
+        }
+
+        double gainFor(const std::vector<double>& gains, std::size_t index, int channel, int nchannels) const
+        {
+            // `gains` holds either one gain per impulse response,
+            // or one gain per impulse response per output channel, grouped by impulse response.
+            if (gains.size() == entries.size())
+                return gains[index];
+            return gains[index * static_cast<std::size_t>(nchannels) + static_cast<std::size_t>(channel)];
+        }
+
+    public:
+        // Adds an impulse response to the bank and returns its index, which is its position in the gains vector.
+        // Adding an impulse response invalidates the cached spectra, so add them all at setup time.
+        std::size_t add(const AudioBuffer& impulse)
+        {
+            if (impulse.frames() < 1)
+                throw std::range_error("ImpulseResponseBank cannot add an empty impulse response.");
+
+            Entry e;
+            e.impulse = impulse;
+            for (int c = 0; c < impulse.channels(); ++c)
+                e.norm.push_back(L1Norm(impulse, c));
+            entries.push_back(std::move(e));
+            spectra.clear();
+            updateSpan();
+            return entries.size() - 1;
+        }
+
+        std::size_t size() const
+        {
+            return entries.size();
+        }
+
+        const AudioBuffer& impulseResponse(std::size_t index) const
+        {
+            return entries.at(index).impulse;
+        }
+
+        // The number of channels convolveInto produces for an input with `inputChannels` channels.
+        int outputChannels(int inputChannels) const
+        {
+            int nchannels = inputChannels;
+            for (const Entry& e : entries)
+                nchannels = std::max(nchannels, e.impulse.channels());
+            return nchannels;
+        }
+
+        // The number of frames the output is longer than the input,
+        // and how many frames later it starts.
+        int tailFrames() const
+        {
+            return span;
+        }
+
+        int startOffset() const
+        {
+            return minStartFrame;
+        }
+
+        // An upper bound on the absolute value of every output sample of convolveInto,
+        // given a bound on the input: for each channel, the input bound times
+        // the sum over impulse responses of |gain| times the impulse response's L1 norm.
+        double peakBound(double inputBound, const std::vector<double>& gains, int nchannels) const
+        {
+            checkGains(gains, nchannels);
+            double factor = 0.0;
+            for (int c = 0; c < nchannels; ++c)
+            {
+                double sum = 0.0;
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    const Entry& e = entries[i];
+                    sum += std::abs(gainFor(gains, i, c, nchannels)) * e.norm[(e.impulse.channels() == 1) ? 0 : c];
+                }
+                factor = std::max(factor, sum);
+            }
+            // Leave room for the roundoff error of the FFTs.
+            return inputBound * factor * (1.0 + 1.0e-4);
+        }
+
+        // Stores in `y` the weighted sum of the impulse responses for `nchannels` output channels,
+        // each placed at its delay relative to startOffset(), where `y` starts.
+        // Convolving with `y` is the same as convolveInto with the same gains.
+        // Reuses the memory owned by `y`.
+        void blendInto(AudioBuffer& y, const std::vector<double>& gains, int nchannels) const
+        {
+            if (entries.empty())
+                throw std::logic_error("ImpulseResponseBank is empty.");
+
+            for (const Entry& e : entries)
+                if (e.impulse.channels() != 1 && e.impulse.channels() != nchannels)
+                    throw std::range_error("The impulse responses have incompatible numbers of channels.");
+
+            checkGains(gains, nchannels);
+            y.reset(span, nchannels, minStartFrame);
+            for (int c = 0; c < nchannels; ++c)
+            {
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    const float gain = static_cast<float>(gainFor(gains, i, c, nchannels));
+                    if (gain == 0.0f)
+                        continue;
+
+                    const AudioBuffer& g = entries[i].impulse;
+                    const int gc = (g.channels() == 1) ? 0 : c;
+                    const int delay = g.startFrame() - minStartFrame;
+                    for (int k = 0; k < g.frames(); ++k)
+                        y.at(c, delay + k) += gain * g.get(gc, k);
+                }
+            }
+        }
+
+        // Calculates the spectra now for every FFT size that thunder up to `maxFrames` long can need,
+        // so that later calls for events no longer than that do not allocate memory.
+        // The sizes are powers of two, so all of them together take less than twice the largest.
+        void prepare(int maxFrames)
+        {
+            if (entries.empty())
+                throw std::logic_error("ImpulseResponseBank is empty.");
+
+            const std::size_t largest = FftSize(maxFrames, span);
+            for (std::size_t n = FftSize(1, span); n <= largest; n *= 2)
+            {
+                spectraFor(n);
+                workspace.transform(n);
+            }
+            workspace.fspec.reserve(largest);
+            blend.reserve(largest);
+        }
+
+        // Stores in `y` the convolution of `f` with the sum of the impulse responses, each scaled by its gain.
+        // `gains` must have either size() entries, applied to every channel,
+        // or size() * (output channels) entries, grouped by impulse response, for a separate gain per ear.
+        // The output has as many channels as the widest of `f` and the impulse responses;
+        // each of them must have either that many channels or exactly one.
+        // The FFT size is the smallest power of two that holds the whole output;
+        // the spectra for that size are calculated the first time it is needed, unless prepare did it.
+        void convolveInto(AudioBuffer& y, const AudioBuffer& f, const std::vector<double>& gains)
+        {
+            if (&y == &f)
+                throw std::logic_error("ImpulseResponseBank cannot store its result in its input.");
+
+            if (entries.empty())
+                throw std::logic_error("ImpulseResponseBank is empty.");
+
+            const int nchannels = outputChannels(f.channels());
+            if (f.channels() != 1 && f.channels() != nchannels)
+                throw std::range_error("The thunder has an incompatible number of channels for the impulse responses.");
+
+            for (const Entry& e : entries)
+                if (e.impulse.channels() != 1 && e.impulse.channels() != nchannels)
+                    throw std::range_error("The impulse responses have incompatible numbers of channels.");
+
+            checkGains(gains, nchannels);
+            const std::size_t n = FftSize(f.frames(), span);
+            const SpectrumSet& set = spectraFor(n);
+            const FourierTransform<double>& fft = workspace.transform(n);
+            y.reset(f.frames() + span, nchannels, f.startFrame() + minStartFrame);
+
+            spectrum_t& fspec = workspace.fspec;
+            for (int c = 0; c < nchannels; ++c)
+            {
+                // A mono thunder signal only needs to be transformed once for all channels.
+                const int fc = (f.channels() == 1) ? 0 : c;
+                if (c == 0 || fc != 0)
+                {
+                    fspec.assign(n, 0.0);
+                    for (int i = 0; i < f.frames(); ++i)
+                        fspec[i] = f.get(fc, i);
+                    fft.forward(fspec.data());
+                }
+
+                // The only per-impulse-response work: a scaled spectrum added into the blend.
+                blend.assign(n, 0.0);
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    const double gain = gainFor(gains, i, c, nchannels);
+                    if (gain == 0.0)
+                        continue;
+
+                    const Entry& e = entries[i];
+                    const spectrum_t& h = set.spectrum[i][(e.impulse.channels() == 1) ? 0 : c];
+                    for (std::size_t k = 0; k < n; ++k)
+                        blend[k] += gain * h[k];
+                }
+
+                for (std::size_t k = 0; k < n; ++k)
+                    blend[k] *= fspec[k];
+                fft.inverse(blend.data());
+
+                const int yf = y.frames();
+                for (int i = 0; i < yf; ++i)
+                    y.at(c, i) = static_cast<float>(blend[i].real());
+            }
+        }
+
+        AudioBuffer convolve(const AudioBuffer& f, const std::vector<double>& gains)
+        {
+            AudioBuffer y;
+            convolveInto(y, f, gains);
+            return y;
+        }
+
+        // Renders the thunder and convolves it with the blended impulse responses,
+        // reusing the memory owned by `y` and by this object.
+        template <typename real_t>
+        void renderInto(const BasicThunder<real_t>& thunder, int sampleRateHz, AudioBuffer& y, const std::vector<double>& gains)
+        {
+            thunder.renderAudioInto(sampleRateHz, raw);
+            convolveInto(y, raw, gains);
+        }
+    };
+}
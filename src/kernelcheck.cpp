@@ -0,0 +1,1217 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// kernelcheck.cpp  -  Verifies that every instruction-set variant of the kernels available
+// on this CPU produces results bit-identical to straightforward scalar reference code,
+// and that the renderers built on them keep the promises their comments make:
+// block-by-block, parallel and stationary MovingThunder rendering match whole-event rendering,
+// MovingThunder matches a brute-force reference for a moving listener, peak bounds are bounds,
+// streamed convolution and flashes match rendering the whole event, snapshots
+// restore what was saved and refuse records that do not fit their size,
+// the segment BVH gives the same answers as brute force, atmospheric absorption changes nothing
+// without a cutoff and removes more high frequencies from farther away,
+// and adaptive bolts stay within their tolerance of bolts generated with the whole budget.
+// Exits with a nonzero status if any result differs.
+
+#include <cstdio>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "kernels.hpp"
+#include "lightning.hpp"
+#include "convolution.hpp"
+#include "ir_bank.hpp"
+#include "pipeline.hpp"
+#include "streaming.hpp"
+#include "multi_stroke.hpp"
+#include "segment_bvh.hpp"
+#include "snapshot.hpp"
+#include "moving_thunder.hpp"
+#include "absorption.hpp"
+
+using namespace Sapphire;
+using Kernels::InstructionSet;
+
+static const InstructionSet AllSets[] = { InstructionSet::Baseline, InstructionSet::AVX2, InstructionSet::AVX512 };
+
+
+template <typename T>
+static bool Identical(const char *kernel, const std::vector<T>& expected, const std::vector<T>& actual)
+{
+    if (expected.size() == actual.size() && 0 == std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(T)))
+        return true;
+
+    printf("kernelcheck: %s (%s) does not match the reference.\n", kernel, Kernels::InstructionSetName(Kernels::Selected()));
+    return false;
+}
+
+
+static std::vector<float> RandomSignal(std::default_random_engine& engine, std::size_t n)
+{
+    std::normal_distribution<float> noise;
+    std::vector<float> x(n);
+    for (float& v : x)
+        v = noise(engine);
+    return x;
+}
+
+
+static bool CheckDistances(std::default_random_engine& engine)
+{
+    const std::size_t n = 1003;     // not a multiple of any vector width
+    std::vector<float> px = RandomSignal(engine, n);
+    std::vector<float> py = RandomSignal(engine, n);
+    std::vector<float> pz = RandomSignal(engine, n);
+    std::vector<float> expected(n);
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        const float dx = px[k] - 0.25f;
+        const float dy = py[k] + 0.5f;
+        const float dz = pz[k] - 3.0f;
+        expected[k] = std::sqrt(dx*dx + dy*dy + dz*dz);
+    }
+
+    std::vector<float> actual(n);
+    Kernels::Distances(n, px.data(), py.data(), pz.data(), 0.25f, -0.5f, 3.0f, actual.data());
+    return Identical("Distances", expected, actual);
+}
+
+
+template <typename real_t>
+static bool CheckRenderRamp(int stride)
+{
+    // The reference is the loop Thunder::renderAudio used before the kernels existed.
+    const int frames = 700;
+    std::vector<float> expected(static_cast<std::size_t>(frames) * stride, 0.125f);
+    std::vector<float> actual = expected;
+    const int f1 = 13;
+    const int f2 = 611;
+    const int fstop = 600;
+    const real_t amp1 = static_cast<real_t>(1.0 / 3.0);
+    const real_t amp2 = static_cast<real_t>(1.0 / 7.0);
+    const int c = stride - 1;
+    for (int f = f1; f < fstop; ++f)
+    {
+        real_t x = static_cast<real_t>(f-f1) / static_cast<real_t>(f2-f1);
+        expected[stride*f + c] += (1-x)*amp1 + x*amp2;
+    }
+
+    Kernels::RenderRamp(actual.data() + c, stride, f1, f2, fstop, amp1, amp2);
+    return Identical("RenderRamp", expected, actual);
+}
+
+
+template <typename real_t>
+static bool CheckRenderRampTile(int stride, int tileStart)
+{
+    // A tile must receive exactly the frames RenderRamp writes into the same range.
+    const int frames = 1024;
+    const int tileFrames = 256;
+    const int f1 = 13;
+    const int f2 = 611;
+    const int fstop = std::min(600, tileStart + tileFrames);
+    const real_t amp1 = static_cast<real_t>(1.0 / 3.0);
+    const real_t amp2 = static_cast<real_t>(1.0 / 7.0);
+    std::vector<float> whole(static_cast<std::size_t>(frames) * stride, 0.0f);
+    Kernels::RenderRamp(whole.data(), stride, f1, f2, fstop, amp1, amp2);
+    std::vector<float> expected(whole.begin() + tileStart*stride, whole.begin() + (tileStart + tileFrames)*stride);
+
+    std::vector<float> actual(static_cast<std::size_t>(tileFrames) * stride, 0.0f);
+    Kernels::RenderRampTile(actual.data(), stride, tileStart, f1, f2, fstop, amp1, amp2);
+    return Identical("RenderRampTile", expected, actual);
+}
+
+
+static bool CheckParallelRender()
+{
+    // The parallel renderer must match the serial one exactly, for any tile size and thread count.
+    const std::size_t segments = 3000;
+    BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{900.0, -0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    LightningBolt bolt(segments, 17);
+    bolt.generate();
+    Thunder thunder(ears, segments);
+    thunder.start(bolt);
+
+    AudioBuffer serial = thunder.renderAudio(44100);
+    bool ok = true;
+    for (int tileFrames : {1000, 4096, 65536})
+    {
+        for (int nthreads : {1, 3})
+        {
+            AudioBuffer parallel;
+            thunder.renderAudioParallelInto(44100, parallel, nthreads, tileFrames);
+            ok = Identical("renderAudioParallel", serial.buffer(), parallel.buffer()) && ok;
+            ok = (parallel.startFrame() == serial.startFrame()) && ok;
+        }
+    }
+    return ok;
+}
+
+
+static bool CheckBlockRender()
+{
+    // Rendering one block at a time must produce exactly the frames renderAudio does.
+    const std::size_t segments = 2000;
+    BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    LightningBolt bolt(segments, 23);
+    bolt.generate();
+    Thunder thunder(ears, segments);
+    thunder.start(bolt);
+
+    const AudioBuffer whole = thunder.renderAudio(44100);
+    bool ok = true;
+    for (int blockFrames : {97, 1000, 8192})
+    {
+        std::vector<float> joined;
+        AudioBuffer block;
+        for (int blockStart = 0; blockStart < whole.frames(); blockStart += blockFrames)
+        {
+            thunder.renderBlockInto(44100, blockStart, blockFrames, block);
+            ok = (block.startFrame() == whole.startFrame() + blockStart) && ok;
+            joined.insert(joined.end(), block.buffer().begin(), block.buffer().end());
+        }
+        ok = Identical("renderBlockInto", whole.buffer(), joined) && ok;
+    }
+    return ok;
+}
+
+
+static bool CheckPeakBound()
+{
+    // Thunder::peakBound must never be less than the actual peak.
+    bool ok = true;
+    BoltPointList ears { BoltPoint{1500.0, 0.1, 0.0}, BoltPoint{30.0, -20.0, 0.0} };
+    for (unsigned seed = 1; seed <= 8; ++seed)
+    {
+        const std::size_t segments = 1000 * seed;
+        LightningBolt bolt(segments, seed);
+        bolt.generate();
+        Thunder thunder(ears, segments);
+        thunder.start(bolt);
+        const AudioBuffer audio = thunder.renderAudio(44100);
+        const float peak = PeakAmplitude(audio.samples(), audio.buffer().size());
+        if (!(peak <= thunder.peakBound(44100)))
+        {
+            printf("kernelcheck: peakBound %g is less than the peak %g for seed %u.\n", thunder.peakBound(44100), peak, seed);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+static AudioBuffer MakeImpulse(int frames, int channels, int startFrame, unsigned seed)
+{
+    std::default_random_engine engine(seed);
+    std::normal_distribution<float> noise;
+    AudioBuffer impulse(frames, channels);
+    impulse.setStartFrame(startFrame);
+    for (int i = 0; i < frames; ++i)
+        for (int c = 0; c < channels; ++c)
+            impulse.at(c, i) = noise(engine) * std::exp(-4.0f * i / frames);
+    return impulse;
+}
+
+
+static bool CheckStreamConvolved()
+{
+    // Streaming a convolution must produce the same 16-bit samples, give or take one step of roundoff,
+    // as convolving the whole event and normalizing it by the same bound.
+    const std::size_t segments = 2000;
+    BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    LightningBolt bolt(segments, 29);
+    bolt.generate();
+    Thunder thunder(ears, segments);
+    thunder.start(bolt);
+
+    ImpulseResponseBank bank;
+    bank.add(MakeImpulse(20000, 1, 0, 31));
+    bank.add(MakeImpulse(3000, 2, 700, 37));
+    const std::vector<double> gains { 0.75, -0.25, 0.5, 0.5 };
+    const AudioBuffer whole = bank.convolve(thunder.renderAudio(44100), gains);
+
+    std::vector<int16_t> expected;
+    std::vector<int16_t> actual;
+    VectorStage expectedStage(expected);
+    VectorStage actualStage(actual);
+    NormalizingPipeline full;
+    NormalizingPipeline streamed;
+    full.AddStage(expectedStage);
+    streamed.AddStage(actualStage);
+
+    bool ok = true;
+    for (int blockFrames : {1000, 4096, 8192})
+    {
+        ThunderStreamer streamer(blockFrames);
+        const double bound = streamer.streamConvolved(thunder, 44100, bank, gains, streamed);
+        full.Start(whole.buffer().size(), static_cast<float>(bound), static_cast<std::size_t>(whole.startFrame()) * whole.channels());
+        full.Feed(whole.samples(), whole.buffer().size());
+        full.Finish();
+
+        bool same = (expected.size() == actual.size());
+        for (std::size_t i = 0; same && i < expected.size(); ++i)
+            same = (std::abs(expected[i] - actual[i]) <= 1);
+        if (!same)
+            printf("kernelcheck: streamConvolved with %d-frame blocks does not match the full convolution.\n", blockFrames);
+        ok = same && ok;
+    }
+    return ok;
+}
+
+
+static bool CheckStreamFlash()
+{
+    // A streamed flash must stay within its peak bound and produce exactly the 16-bit samples
+    // of rendering the whole flash and normalizing it by the same bound.
+    const std::size_t segments = 2000;
+    BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    LightningBolt bolt(segments, 41);
+    bolt.generate();
+    Thunder thunder(ears, segments);
+    thunder.start(bolt);
+
+    ReturnStrokeList strokes;
+    RandomReturnStrokes(strokes, 4, 43);
+    MultiStrokeFlash flash;
+    flash.renderStroke(thunder, 44100);
+    const AudioBuffer whole = flash.render(strokes, 44100);
+
+    std::vector<int16_t> expected;
+    std::vector<int16_t> actual;
+    VectorStage expectedStage(expected);
+    VectorStage actualStage(actual);
+    NormalizingPipeline full;
+    NormalizingPipeline streamed;
+    full.AddStage(expectedStage);
+    streamed.AddStage(actualStage);
+
+    bool ok = true;
+    for (int blockFrames : {1000, 8192})
+    {
+        const double bound = flash.streamInto(streamed, strokes, 44100, thunder.peakBound(44100), true, blockFrames);
+        full.Start(whole.buffer().size(), static_cast<float>(bound), static_cast<std::size_t>(whole.startFrame()) * whole.channels());
+        full.Feed(whole.samples(), whole.buffer().size());
+        full.Finish();
+        ok = Identical("MultiStrokeFlash::streamInto", expected, actual) && ok;
+    }
+    return ok;
+}
+
+
+static bool SameBolt(const LightningBolt& expected, const LightningBolt& actual, double tolerance)
+{
+    if (expected.segments().size() != actual.segments().size())
+        return false;
+
+    for (std::size_t k = 0; k < expected.segments().size(); ++k)
+    {
+        const BoltSegment& e = expected.segments()[k];
+        const BoltSegment& a = actual.segments()[k];
+        if (Distance(e.a, a.a) > tolerance || Distance(e.b, a.b) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+
+static std::vector<uint8_t> ReadFileBytes(const char *filename)
+{
+    std::vector<uint8_t> bytes;
+    FILE *infile = fopen(filename, "rb");
+    if (infile != nullptr)
+    {
+        int c;
+        while ((c = fgetc(infile)) != EOF)
+            bytes.push_back(static_cast<uint8_t>(c));
+        fclose(infile);
+    }
+    return bytes;
+}
+
+
+static std::size_t CountRecords(const char *filename, const std::vector<uint8_t>& bytes)
+{
+    FILE *outfile = fopen(filename, "wb");
+    if (outfile == nullptr)
+        return 0;
+    fwrite(bytes.data(), 1, bytes.size(), outfile);
+    fclose(outfile);
+
+    SnapshotReader reader;
+    return reader.Open(filename) ? reader.size() : 0;
+}
+
+
+static bool CheckSnapshot()
+{
+    // Snapshots must restore the bolt to within the quantum and the thunder exactly, but only for the same ears.
+    // The reader must refuse records whose counts do not agree with their size,
+    // and the writer must refuse to append to a file whose header does not match its own.
+    const char *filename = "kernelcheck.snap";
+    const char *corruptFileName = "kernelcheck-corrupt.snap";
+    BoltPointList ears { BoltPoint{2500.0, 0.1, 0.0}, BoltPoint{2500.0, -0.1, 0.0} };
+
+    // A chain of segments, with some of them occluded so the record stores gains.
+    LightningBolt chain(1000, 5);
+    chain.generate();
+    SegmentBvh bvh;
+    bvh.build(chain);
+    OccluderList occluders { Occluder{BoltPoint{2300.0, -100.0, 0.0}, BoltPoint{2350.0, 100.0, 60.0}} };
+    Thunder chainThunder(ears, 1000);
+    chainThunder.start(chain, bvh, occluders, 0.25);
+
+    // Disconnected segments, so the record stores explicit topology.
+    LightningBolt pieces(10);
+    pieces.addSegment(BoltSegment{BoltPoint{0.0, 0.0, 1000.0}, BoltPoint{10.0, 0.0, 900.0}});
+    pieces.addSegment(BoltSegment{BoltPoint{300.0, 20.0, 800.0}, BoltPoint{310.0, 25.0, 700.0}});
+    pieces.addSegment(BoltSegment{BoltPoint{310.0, 25.0, 700.0}, BoltPoint{-50.0, 5.0, 600.0}});
+    Thunder piecesThunder(ears, 10);
+    piecesThunder.start(pieces);
+
+    {
+        SnapshotWriter writer;
+        if (!writer.Open(filename, false))
+        {
+            printf("kernelcheck: cannot create %s\n", filename);
+            return false;
+        }
+        writer.Write(chain, chainThunder);
+        writer.Write(pieces, piecesThunder);
+    }
+
+    bool ok = true;
+    const LightningBolt *bolts[] = { &chain, &pieces };
+    const Thunder *thunders[] = { &chainThunder, &piecesThunder };
+    std::vector<uint8_t> bytes;
+    {
+        SnapshotReader reader;
+        if (!reader.Open(filename) || reader.size() != 2)
+        {
+            printf("kernelcheck: snapshot round trip did not find 2 records.\n");
+            remove(filename);
+            return false;
+        }
+
+        for (std::size_t index = 0; index < 2; ++index)
+        {
+            LightningBolt bolt(reader.segmentCount(index));
+            reader.LoadBolt(index, bolt);
+            if (!SameBolt(*bolts[index], bolt, 1.0e-3))
+            {
+                printf("kernelcheck: snapshot record %lu restored a different bolt.\n", static_cast<unsigned long>(index));
+                ok = false;
+            }
+
+            Thunder thunder(reader.ears(index), reader.segmentCount(index));
+            reader.LoadThunder(index, thunder);
+            ok = Identical("snapshot thunder", thunders[index]->renderAudio(44100).buffer(), thunder.renderAudio(44100).buffer()) && ok;
+
+            // The distance lists must not be restored for ears somewhere else.
+            BoltPointList moved = reader.ears(index);
+            moved[1].y += 1.0;
+            Thunder elsewhere(moved, reader.segmentCount(index));
+            bool refused = false;
+            try
+            {
+                reader.LoadThunder(index, elsewhere);
+            }
+            catch (const std::range_error&)
+            {
+                refused = true;
+            }
+            if (!refused)
+            {
+                printf("kernelcheck: snapshot record %lu restored thunder for ears in different places.\n", static_cast<unsigned long>(index));
+                ok = false;
+            }
+        }
+
+        bytes = ReadFileBytes(filename);
+    }
+
+    // Corrupt one count at a time. Every record from the corrupt one on must be refused.
+    SnapshotRecordHeader first;
+    std::memcpy(&first, bytes.data() + sizeof(SnapshotFileHeader), sizeof(first));
+    if (!(first.flags & SNAPSHOT_FLAG_GAINS))
+    {
+        printf("kernelcheck: the occluded snapshot record has no gains to check.\n");
+        ok = false;
+    }
+
+    const std::size_t record0 = sizeof(SnapshotFileHeader);
+    const std::size_t record1 = record0 + first.recordBytes;
+    struct Corruption
+    {
+        std::size_t offset;
+        uint32_t value;
+        std::size_t expectedRecords;
+    };
+    const Corruption corruptions[] = {
+        { record0 + offsetof(SnapshotRecordHeader, earCount), first.earCount + 1, 0 },
+        { record0 + offsetof(SnapshotRecordHeader, pointCount), first.pointCount - 1, 0 },
+        { record0 + offsetof(SnapshotRecordHeader, segmentCount), first.segmentCount - 1, 0 },
+        { record1 + offsetof(SnapshotRecordHeader, pointCount), 0x10000000u, 1 },
+        { record1 + offsetof(SnapshotRecordHeader, segmentCount), 0xffffffffu, 1 },
+    };
+    for (const Corruption& corruption : corruptions)
+    {
+        std::vector<uint8_t> corrupt = bytes;
+        std::memcpy(corrupt.data() + corruption.offset, &corruption.value, sizeof(uint32_t));
+        const std::size_t n = CountRecords(corruptFileName, corrupt);
+        if (n != corruption.expectedRecords)
+        {
+            printf("kernelcheck: snapshot reader accepted %lu records from a file with only %lu valid.\n",
+                static_cast<unsigned long>(n), static_cast<unsigned long>(corruption.expectedRecords));
+            ok = false;
+        }
+    }
+
+    // Appending must add records to a valid archive, but must leave alone
+    // a file that is not a snapshot of this version and byte order.
+    {
+        SnapshotWriter writer;
+        const bool appended = writer.Open(filename);
+        if (appended)
+            writer.Write(pieces, piecesThunder);
+        writer.Close();
+
+        SnapshotReader reader;
+        if (!appended || !reader.Open(filename) || reader.size() != 3)
+        {
+            printf("kernelcheck: appending to a snapshot did not make 3 records.\n");
+            ok = false;
+        }
+    }
+
+    const std::size_t headerFields[] = {
+        offsetof(SnapshotFileHeader, signature),
+        offsetof(SnapshotFileHeader, version),
+        offsetof(SnapshotFileHeader, endianMarker),
+    };
+    for (std::size_t field : headerFields)
+    {
+        std::vector<uint8_t> corrupt = bytes;
+        corrupt[field] ^= 0xff;
+        CountRecords(corruptFileName, corrupt);
+        SnapshotWriter writer;
+        const bool opened = writer.Open(corruptFileName);
+        if (opened)
+            writer.Write(pieces, piecesThunder);
+        writer.Close();
+
+        if (opened || ReadFileBytes(corruptFileName) != corrupt)
+        {
+            printf("kernelcheck: snapshot writer appended to a file with a bad header at offset %lu.\n", static_cast<unsigned long>(field));
+            ok = false;
+        }
+    }
+
+    remove(filename);
+    remove(corruptFileName);
+    return ok;
+}
+
+
+static bool SegmentHitsBox(const BoltPoint& p, const BoltPoint& q, const Occluder& box)
+{
+    // Slab test for the line segment from p to q.
+    const double origin[3] = { p.x, p.y, p.z };
+    const double delta[3] = { q.x - p.x, q.y - p.y, q.z - p.z };
+    const double low[3] = { box.low.x, box.low.y, box.low.z };
+    const double high[3] = { box.high.x, box.high.y, box.high.z };
+    double t0 = 0.0;
+    double t1 = 1.0;
+    for (int a = 0; a < 3; ++a)
+    {
+        if (delta[a] == 0.0)
+        {
+            if (origin[a] < low[a] || origin[a] > high[a])
+                return false;
+            continue;
+        }
+        double u = (low[a] - origin[a]) / delta[a];
+        double v = (high[a] - origin[a]) / delta[a];
+        if (u > v)
+            std::swap(u, v);
+        t0 = std::max(t0, u);
+        t1 = std::min(t1, v);
+        if (t0 > t1)
+            return false;
+    }
+    return true;
+}
+
+
+static double PointSegmentDistance(const BoltPoint& p, const BoltSegment& s)
+{
+    const BoltPoint e{s.b.x - s.a.x, s.b.y - s.a.y, s.b.z - s.a.z};
+    const BoltPoint w{p.x - s.a.x, p.y - s.a.y, p.z - s.a.z};
+    const double ee = e.x*e.x + e.y*e.y + e.z*e.z;
+    const double u = (ee > 0.0) ? std::min(1.0, std::max(0.0, (w.x*e.x + w.y*e.y + w.z*e.z) / ee)) : 0.0;
+    return Distance(p, BoltPoint{s.a.x + u*e.x, s.a.y + u*e.y, s.a.z + u*e.z});
+}
+
+
+static double PointRayDistance(const BoltPoint& p, const BoltPoint& origin, const BoltPoint& direction)
+{
+    const double dd = direction.x*direction.x + direction.y*direction.y + direction.z*direction.z;
+    const BoltPoint w{p.x - origin.x, p.y - origin.y, p.z - origin.z};
+    const double t = std::max(0.0, (w.x*direction.x + w.y*direction.y + w.z*direction.z) / dd);
+    return Distance(p, BoltPoint{origin.x + t*direction.x, origin.y + t*direction.y, origin.z + t*direction.z});
+}
+
+
+static double RaySegmentDistance(const BoltPoint& origin, const BoltPoint& direction, const BoltSegment& s)
+{
+    // The squared distance is convex in (t, u), so its minimum over t >= 0, 0 <= u <= 1 is either
+    // the unconstrained minimum, when that is inside the region, or the minimum on one of its edges.
+    double best = std::min(PointSegmentDistance(origin, s), std::min(PointRayDistance(s.a, origin, direction), PointRayDistance(s.b, origin, direction)));
+    const BoltPoint e{s.b.x - s.a.x, s.b.y - s.a.y, s.b.z - s.a.z};
+    const BoltPoint w{s.a.x - origin.x, s.a.y - origin.y, s.a.z - origin.z};
+    const double dd = direction.x*direction.x + direction.y*direction.y + direction.z*direction.z;
+    const double de = direction.x*e.x + direction.y*e.y + direction.z*e.z;
+    const double ee = e.x*e.x + e.y*e.y + e.z*e.z;
+    const double dw = direction.x*w.x + direction.y*w.y + direction.z*w.z;
+    const double ew = e.x*w.x + e.y*w.y + e.z*w.z;
+    const double det = dd*ee - de*de;
+    if (det > 1.0e-12 * dd * ee)
+    {
+        const double t = (dw*ee - de*ew) / det;
+        const double u = (dw*de - dd*ew) / det;
+        if (t >= 0.0 && u >= 0.0 && u <= 1.0)
+        {
+            const BoltPoint r{origin.x + t*direction.x, origin.y + t*direction.y, origin.z + t*direction.z};
+            const BoltPoint q{s.a.x + u*e.x, s.a.y + u*e.y, s.a.z + u*e.z};
+            best = std::min(best, Distance(r, q));
+        }
+    }
+    return best;
+}
+
+
+static bool CheckSegmentBvh()
+{
+    // Every query must agree with brute force over all segments,
+    // for random bolts, obstacles, ears, points and rays.
+    bool ok = true;
+    std::default_random_engine engine(777);
+    std::uniform_real_distribution<double> across(-3000.0, 3000.0);
+    std::uniform_real_distribution<double> height(0.0, 3500.0);
+    std::uniform_real_distribution<double> size(10.0, 500.0);
+    SegmentBvh bvh;
+    std::vector<double> gain;
+    for (unsigned seed = 1; seed <= 4; ++seed)
+    {
+        LightningBolt bolt(1500 * seed, seed);
+        bolt.generate();
+        bvh.build(bolt);
+        const BoltSegmentList& segments = bolt.segments();
+
+        std::size_t mismatches = 0;
+        for (int trial = 0; trial < 16; ++trial)
+        {
+            // Put each obstacle somewhere on the line from the ear to a random segment,
+            // so it hides part of the bolt and the edges of its cone matter.
+            BoltPoint ear{across(engine) / 2.0, across(engine) / 2.0, height(engine) / 2.0};
+            OccluderList occluders;
+            for (int k = 0; k < 4; ++k)
+            {
+                const BoltSegment& target = segments[engine() % segments.size()];
+                const double f = std::uniform_real_distribution<double>(0.1, 0.9)(engine);
+                const BoltPoint center{ear.x + f*(target.a.x - ear.x), ear.y + f*(target.a.y - ear.y), ear.z + f*(target.a.z - ear.z)};
+                const BoltPoint half{size(engine)/2, size(engine)/2, size(engine)/2};
+                occluders.push_back(Occluder{
+                    BoltPoint{center.x - half.x, center.y - half.y, center.z - half.z},
+                    BoltPoint{center.x + half.x, center.y + half.y, center.z + half.z}});
+            }
+
+            // Sometimes move the ear right next to an obstacle, where the cone cannot be used.
+            if (trial % 4 == 0)
+            {
+                const Occluder& near = occluders[0];
+                ear = BoltPoint{(near.low.x + near.high.x)/2, near.low.y - 5.0, (near.low.z + near.high.z)/2};
+            }
+
+            bvh.visibility(ear, occluders, 0.25, gain);
+            for (std::size_t i = 0; i < segments.size(); ++i)
+            {
+                const BoltSegment& seg = segments[i];
+                const BoltPoint mid{(seg.a.x + seg.b.x)/2, (seg.a.y + seg.b.y)/2, (seg.a.z + seg.b.z)/2};
+                bool hidden = false;
+                for (const Occluder& box : occluders)
+                    hidden = hidden || SegmentHitsBox(ear, mid, box);
+                if (gain[i] != (hidden ? 0.25 : 1.0))
+                    ++mismatches;
+            }
+        }
+        if (mismatches > 0)
+        {
+            printf("kernelcheck: SegmentBvh::visibility disagrees with brute force for %lu segments of bolt %u.\n", static_cast<unsigned long>(mismatches), seed);
+            ok = false;
+        }
+
+        mismatches = 0;
+        for (int query = 0; query < 100; ++query)
+        {
+            const BoltPoint point{across(engine), across(engine), height(engine)};
+            double distance;
+            const std::size_t index = bvh.nearest(point, distance);
+            double best = PointSegmentDistance(point, segments[0]);
+            for (const BoltSegment& seg : segments)
+                best = std::min(best, PointSegmentDistance(point, seg));
+            if (index >= segments.size() || std::abs(distance - best) > 1.0e-9 * best || std::abs(PointSegmentDistance(point, segments[index]) - best) > 1.0e-9 * best)
+                ++mismatches;
+
+            // Aim half the rays near a segment endpoint, as a mouse click on the bolt would.
+            const double radius = 25.0;
+            const BoltPoint origin{across(engine), across(engine) - 6000.0, height(engine)};
+            const BoltSegment& target = segments[(query * 7919) % segments.size()];
+            const BoltPoint aim = (query % 2 == 0) ? BoltPoint{target.a.x + 10.0, target.a.y, target.a.z} : point;
+            const BoltPoint direction{aim.x - origin.x, aim.y - origin.y, aim.z - origin.z};
+            const std::size_t picked = bvh.pick(origin, direction, radius);
+            double bestRay = radius;
+            std::size_t bestIndex = SegmentBvh::npos;
+            for (std::size_t i = 0; i < segments.size(); ++i)
+            {
+                const double d = RaySegmentDistance(origin, direction, segments[i]);
+                if (d <= bestRay)
+                {
+                    bestRay = d;
+                    bestIndex = i;
+                }
+            }
+            if (bestIndex == SegmentBvh::npos)
+            {
+                // Allow for roundoff when the nearest segment is right at the edge of the radius.
+                if (picked != SegmentBvh::npos && RaySegmentDistance(origin, direction, segments[picked]) > radius * (1.0 + 1.0e-9))
+                    ++mismatches;
+            }
+            else if (picked == SegmentBvh::npos || RaySegmentDistance(origin, direction, segments[picked]) > bestRay + 1.0e-9 * radius)
+            {
+                ++mismatches;
+            }
+        }
+        if (mismatches > 0)
+        {
+            printf("kernelcheck: SegmentBvh::nearest or pick disagrees with brute force %lu times for bolt %u.\n", static_cast<unsigned long>(mismatches), seed);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+static bool CheckMovingThunder()
+{
+    // For a listener who stands still, MovingThunder must render the same thunder as Thunder.
+    // Thunder rounds the ends of every segment's sound to whole frames, while MovingThunder
+    // tests the exact wavefront at each frame, so single samples can differ by one segment's
+    // amplitude, but sums over 64-frame blocks agree to within 2% of the largest block sum,
+    // and the thunder begins and ends in the same places.
+    const std::size_t segments = 2000;
+    const int sampleRate = 44100;
+    const int blockFrames = 64;
+    BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    bool ok = true;
+    for (unsigned seed = 1; seed <= 2; ++seed)
+    {
+        LightningBolt bolt(segments, seed);
+        bolt.generate();
+        Thunder thunder(ears, segments);
+        thunder.start(bolt);
+        const AudioBuffer expected = thunder.renderAudio(sampleRate);
+
+        MovingThunder moving(ears.size(), segments);
+        moving.start(bolt, ears, 0.0);
+        const int startFrame = static_cast<int>(std::round(moving.timeSeconds() * sampleRate));
+        std::vector<float> actual;
+        std::vector<float> block(ears.size() * 512);
+        while (!moving.finished())
+        {
+            moving.renderBlock(block.data(), 512, sampleRate, ears);
+            actual.insert(actual.end(), block.begin(), block.end());
+        }
+        actual.resize(std::max(actual.size(), expected.buffer().size()), 0.0f);
+
+        double largest = 0.0;
+        double worst = 0.0;
+        for (int c = 0; c < expected.channels(); ++c)
+        {
+            for (int first = 0; first < expected.frames(); first += blockFrames)
+            {
+                double sum = 0.0;
+                double diff = 0.0;
+                for (int f = first; f < std::min(expected.frames(), first + blockFrames); ++f)
+                {
+                    sum += expected.get(c, f);
+                    diff += actual[static_cast<std::size_t>(f) * ears.size() + c] - expected.get(c, f);
+                }
+                largest = std::max(largest, std::abs(sum));
+                worst = std::max(worst, std::abs(diff));
+            }
+        }
+
+        // Anything MovingThunder renders past the end of Thunder's audio must be silent.
+        float beyond = 0.0f;
+        for (std::size_t i = expected.buffer().size(); i < actual.size(); ++i)
+            beyond = std::max(beyond, std::abs(actual[i]));
+
+        if (startFrame != expected.startFrame() || worst > 0.02 * largest || beyond > 0.0f)
+        {
+            printf("kernelcheck: MovingThunder differs from Thunder for seed %u: start %d vs %d, block error %g of %g, %g after the end.\n",
+                seed, startFrame, expected.startFrame(), worst, largest, beyond);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool CheckMovingListener()
+{
+    // For a listener who moves, MovingThunder must render what a brute-force reference renders
+    // by placing the ears where they are at every frame and evaluating every segment's ramp there.
+    // MovingThunder interpolates each segment's distances across a block instead of the ear positions,
+    // so single samples can differ where a wavefront lands on a frame boundary, but sums over 64-frame blocks
+    // agree to within 1% of the largest block sum, and nothing is heard after MovingThunder says it has finished.
+    // Irregular block sizes check that the distances carried from one block to the next are right.
+    const std::size_t segments = 500;
+    const int sampleRate = 8000;
+    const int blockFrames = 64;
+    const int extraFrames = 2000;
+    const double maxSpeed = 60.0;
+    const BoltPointList ears { BoltPoint{900.0, 0.1, 0.0}, BoltPoint{-700.0, 400.0, 5.0} };
+    const BoltPointList velocities { BoltPoint{-60.0, 0.0, 0.0}, BoltPoint{40.0, -30.0, 0.0} };
+    const int nchannels = static_cast<int>(ears.size());
+    const int blockSizes[] = { 64, 100, 333 };
+
+    // Where the ears are `seconds` after MovingThunder's first block begins.
+    auto earsAt = [&](double seconds)
+    {
+        BoltPointList list;
+        for (std::size_t i = 0; i < ears.size(); ++i)
+            list.push_back(BoltPoint{
+                ears[i].x + seconds*velocities[i].x,
+                ears[i].y + seconds*velocities[i].y,
+                ears[i].z + seconds*velocities[i].z});
+        return list;
+    };
+
+    bool ok = true;
+    for (unsigned seed = 1; seed <= 2; ++seed)
+    {
+        LightningBolt bolt(segments, seed);
+        bolt.generate();
+
+        MovingThunder moving(ears.size(), segments);
+        moving.start(bolt, ears, maxSpeed);
+        const double startSeconds = moving.timeSeconds();
+        std::vector<float> actual;
+        std::vector<float> block;
+        int frames = 0;
+        for (int b = 0; !moving.finished(); ++b)
+        {
+            const int n = blockSizes[b % 3];
+            block.resize(static_cast<std::size_t>(n) * nchannels);
+            frames += n;
+            moving.renderBlock(block.data(), n, sampleRate, earsAt(static_cast<double>(frames) / sampleRate));
+            actual.insert(actual.end(), block.begin(), block.end());
+        }
+        frames += extraFrames;
+        actual.resize(static_cast<std::size_t>(frames) * nchannels, 0.0f);
+
+        std::vector<float> expected(actual.size(), 0.0f);
+        for (int f = 0; f < frames; ++f)
+        {
+            const double seconds = static_cast<double>(f) / sampleRate;
+            const double radius = SPEED_OF_SOUND_IN_AIR * (startSeconds + seconds);
+            const BoltPointList here = earsAt(seconds);
+            for (int c = 0; c < nchannels; ++c)
+            {
+                for (const BoltSegment& s : bolt.segments())
+                {
+                    const double da = Distance(here[c], s.a);
+                    const double db = Distance(here[c], s.b);
+                    const double d1 = std::min(da, db);
+                    const double d2 = std::max(da, db);
+                    if (d1 <= radius && radius < d2)
+                    {
+                        const double x = (radius - d1) / (d2 - d1);
+                        expected[static_cast<std::size_t>(f) * nchannels + c] += (1-x)/(d1*d1) + x/(d2*d2);
+                    }
+                }
+            }
+        }
+
+        double largest = 0.0;
+        double worst = 0.0;
+        for (int c = 0; c < nchannels; ++c)
+        {
+            for (int first = 0; first < frames; first += blockFrames)
+            {
+                double sum = 0.0;
+                double diff = 0.0;
+                for (int f = first; f < std::min(frames, first + blockFrames); ++f)
+                {
+                    const std::size_t i = static_cast<std::size_t>(f) * nchannels + c;
+                    sum += expected[i];
+                    diff += actual[i] - expected[i];
+                }
+                largest = std::max(largest, std::abs(sum));
+                worst = std::max(worst, std::abs(diff));
+            }
+        }
+
+        // The reference must be silent in the extra frames after MovingThunder finished.
+        float beyond = 0.0f;
+        for (std::size_t i = actual.size() - static_cast<std::size_t>(extraFrames) * nchannels; i < expected.size(); ++i)
+            beyond = std::max(beyond, std::abs(expected[i]));
+
+        if (largest == 0.0 || worst > 0.01 * largest || beyond > 0.0f)
+        {
+            printf("kernelcheck: MovingThunder differs from the moving-listener reference for seed %u: block error %g of %g, %g after it finished.\n",
+                seed, worst, largest, beyond);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+static double HighFrequencyEnergy(const AudioBuffer& audio, int firstFrame, int lastFrame)
+{
+    // The energy of the first difference of channel 0, which weights each frequency by the square of its sine.
+    double sum = 0.0;
+    for (int f = std::max(1, firstFrame); f < std::min(audio.frames(), lastFrame); ++f)
+    {
+        const double d = audio.get(0, f) - audio.get(0, f-1);
+        sum += d*d;
+    }
+    return sum;
+}
+
+
+static bool CheckAbsorption()
+{
+    // With a cutoff far above the Nyquist frequency, AtmosphericAbsorption filters nothing,
+    // so it must render what Thunder::renderAudio renders, apart from float roundoff in mixing the bins.
+    // With the normal cutoff, sound from far away must lose more of its high frequencies
+    // than the same sound from close by.
+    const int sampleRate = 44100;
+    bool ok = true;
+
+    const BoltPointList ears { BoltPoint{1500.0, 0.1, 0.0}, BoltPoint{30.0, -20.0, 0.0} };
+    for (unsigned seed = 1; seed <= 2; ++seed)
+    {
+        LightningBolt bolt(3000, seed);
+        bolt.generate();
+        Thunder thunder(ears, 3000);
+        thunder.start(bolt);
+        const AudioBuffer expected = thunder.renderAudio(sampleRate);
+        AtmosphericAbsorption transparent(32, 1.0e+15);
+        const AudioBuffer actual = transparent.render(thunder, sampleRate);
+        const float peak = PeakAmplitude(expected.samples(), expected.buffer().size());
+        float worst = 0.0f;
+        if (actual.buffer().size() == expected.buffer().size())
+            for (std::size_t i = 0; i < expected.buffer().size(); ++i)
+                worst = std::max(worst, std::abs(actual.buffer()[i] - expected.buffer()[i]));
+        if (actual.frames() != expected.frames() || actual.startFrame() != expected.startFrame() || !(worst <= 1.0e-5f * peak))
+        {
+            printf("kernelcheck: AtmosphericAbsorption with no absorption differs from Thunder by %g of %g for seed %u.\n", worst, peak, seed);
+            ok = false;
+        }
+    }
+
+    // The same short burst of segments, once 1 km away and once 5 km away, in separate bins.
+    // Comparing each burst with itself unfiltered cancels the difference in loudness.
+    const double distances[] = { 1000.0, 5000.0 };
+    Thunder bursts(BoltPointList{ BoltPoint{} }, 100);
+    bursts.beginRestore();
+    for (double distance : distances)
+    {
+        for (int k = 0; k < 40; ++k)
+        {
+            ThunderSegment ts;
+            ts.distance1 = distance + 0.3*k;
+            ts.distance2 = ts.distance1 + 0.5;
+            bursts.restoreSegment(0, ts);
+        }
+    }
+    AtmosphericAbsorption absorption(2);
+    const AudioBuffer absorbed = absorption.render(bursts, sampleRate);
+    AtmosphericAbsorption transparent(2, 1.0e+15);
+    const AudioBuffer unabsorbed = transparent.render(bursts, sampleRate);
+    double kept[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        // Include the filter's tail, which is far shorter than the gap between the bursts.
+        const int first = static_cast<int>(std::round((distances[i] - distances[0]) * sampleRate / SPEED_OF_SOUND_IN_AIR));
+        const int last = first + 4000;
+        kept[i] = HighFrequencyEnergy(absorbed, first, last) / HighFrequencyEnergy(unabsorbed, first, last);
+    }
+    if (!(kept[1] < 0.75 * kept[0] && kept[0] < 1.0))
+    {
+        printf("kernelcheck: AtmosphericAbsorption kept %g of the high-frequency energy at %g meters and %g at %g meters.\n",
+            kept[0], distances[0], kept[1], distances[1]);
+        ok = false;
+    }
+    return ok;
+}
+
+
+
+static bool SamePoint(const BoltPoint& a, const BoltPoint& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+
+static bool CheckAdaptiveBolt()
+{
+    // At a one-frame tolerance, a bolt heard from far away must use far fewer segments than the maximum,
+    // because the air absorbs its finest detail, while a bolt heard from close by still needs them all.
+    // The adaptive bolt must also be part of the bolt generated with the same seed and the whole budget:
+    // every one of its points must be on the full bolt, and the full bolt's detail between two of its points
+    // must arrive at every ear within the tolerance there of the coarse segment's arrival times.
+    // The tolerance includes a heuristic allowance for the random detail, so a few segments may exceed it,
+    // but never by much, and the thunder must begin and end within the tolerance of the full bolt's.
+    const std::size_t segments = 100000;
+    const int sampleRate = 44100;
+    const double tolerance = 1.0;
+    const double metersPerFrame = SPEED_OF_SOUND_IN_AIR / sampleRate;
+    const BoltPointList distantEars { BoltPoint{20000.0, 0.0, 0.0}, BoltPoint{20000.5, 0.3, 0.0} };
+    const BoltPointList nearEars { BoltPoint{500.0, 100.0, 2.0} };
+
+    // The tolerance, in frames, for sound arriving from `distance` meters away.
+    auto toleranceFrames = [&](double distance)
+    {
+        return std::max(tolerance, sampleRate * distance / AIR_ABSORPTION_HZ_METERS);
+    };
+
+    bool ok = true;
+    for (unsigned seed = 1; seed <= 2; ++seed)
+    {
+        LightningBolt nearBolt(segments, seed);
+        nearBolt.setAdaptiveBudget(nearEars, sampleRate, tolerance);
+        nearBolt.generate();
+
+        LightningBolt coarse(segments, seed);
+        coarse.setAdaptiveBudget(distantEars, sampleRate, tolerance);
+        coarse.generate();
+
+        LightningBolt full(segments, seed);
+        full.setAdaptiveBudget(distantEars, sampleRate, 1.0e-9, 0.0);
+        full.generate();
+
+        const BoltSegmentList& cs = coarse.segments();
+        const BoltSegmentList& fs = full.segments();
+        std::size_t k = 0;
+        std::size_t missing = 0;
+        std::size_t exceeded = 0;
+        double worst = 0.0;         // the largest excess, as a fraction of the tolerance there
+        for (const BoltSegment& s : cs)
+        {
+            while (k < fs.size() && !SamePoint(fs[k].a, s.a))
+                ++k;
+            if (k == fs.size())
+            {
+                ++missing;
+                break;
+            }
+            bool outside = false;
+            for (; k < fs.size(); ++k)
+            {
+                for (const BoltPoint& ear : distantEars)
+                {
+                    const double da = Distance(ear, s.a);
+                    const double db = Distance(ear, s.b);
+                    const double d = Distance(ear, fs[k].b);
+                    const double excess = std::max(std::min(da, db) - d, d - std::max(da, db));
+                    const double allowed = toleranceFrames(std::min(da, db)) * metersPerFrame;
+                    worst = std::max(worst, excess / allowed);
+                    outside = outside || (excess > allowed);
+                }
+                if (SamePoint(fs[k].b, s.b))
+                    break;
+            }
+            if (k == fs.size())
+            {
+                ++missing;
+                break;
+            }
+            ++k;
+            if (outside)
+                ++exceeded;
+        }
+
+        Thunder thunder(distantEars, segments);
+        thunder.start(coarse);
+        const AudioBuffer coarseAudio = thunder.renderAudio(sampleRate);
+        thunder.start(full);
+        const AudioBuffer fullAudio = thunder.renderAudio(sampleRate);
+        const int startError = std::abs(coarseAudio.startFrame() - fullAudio.startFrame());
+        const int endError = std::abs(coarseAudio.endFrame() - fullAudio.endFrame());
+
+        if (nearBolt.segments().size() != segments || cs.size() >= segments / 4 || fs.size() != segments ||
+            missing > 0 || exceeded > cs.size() / 200 || worst > 2.0 ||
+            startError > toleranceFrames(thunder.getMinDistance()) || endError > toleranceFrames(thunder.getMaxDistance()))
+        {
+            printf("kernelcheck: adaptive bolt %u with %lu segments (%lu near) differs from the full bolt with %lu: %lu points missing, %lu segments beyond the tolerance, worst %g times it, start %d and end %d frames off.\n",
+                seed, static_cast<unsigned long>(cs.size()), static_cast<unsigned long>(nearBolt.segments().size()),
+                static_cast<unsigned long>(fs.size()), static_cast<unsigned long>(missing), static_cast<unsigned long>(exceeded),
+                worst, startError, endError);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+static bool CheckConvolveChannel(std::default_random_engine& engine, int ystride, int fstride, int gstride)
+{
+    // The reference is the direct dot-product form of convolution.
+    const int fframes = 5000;
+    const int gframes = 301;
+    const int yframes = fframes + gframes;
+    std::vector<float> f = RandomSignal(engine, static_cast<std::size_t>(fframes) * fstride);
+    std::vector<float> g = RandomSignal(engine, static_cast<std::size_t>(gframes) * gstride);
+    std::vector<float> expected(static_cast<std::size_t>(yframes) * ystride, 9.0f);
+    std::vector<float> actual = expected;
+    for (int i = 0; i < yframes; ++i)
+    {
+        const int kmin = std::max(0, i - (fframes-1));
+        const int kmax = std::min(gframes-1, i);
+        float sum = 0.0f;
+        for (int k = kmax; k >= kmin; --k)
+            sum += g[gstride*k] * f[fstride*(i-k)];
+        expected[ystride*i] = sum;
+    }
+
+    Kernels::ConvolveChannel(actual.data(), yframes, ystride, f.data(), fframes, fstride, g.data(), gframes, gstride);
+    return Identical("ConvolveChannel", expected, actual);
+}
+
+
+static bool CheckAccumulate(std::default_random_engine& engine)
+{
+    const std::size_t n = 1001;
+    std::normal_distribution<double> noise;
+    std::vector<double> x(n);
+    std::vector<double> expected(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = noise(engine);
+        expected[i] = noise(engine);
+    }
+    std::vector<double> actual = expected;
+    for (std::size_t i = 0; i < n; ++i)
+        expected[i] += 0.3 * x[i];
+
+    Kernels::Accumulate(actual.data(), x.data(), 0.3, n);
+    return Identical("Accumulate", expected, actual);
+}
+
+
+static bool CheckConvertToInt16(std::default_random_engine& engine)
+{
+    const std::size_t n = 4099;
+    std::vector<float> input = RandomSignal(engine, n);
+    for (float& x : input)
+        x = std::max(-1.0f, std::min(1.0f, x));
+
+    const float gain = 32700.0f;
+    std::vector<int16_t> expected(n);
+    for (std::size_t i = 0; i < n; ++i)
+        expected[i] = static_cast<int16_t>(gain * input[i]);
+
+    std::vector<int16_t> actual(n);
+    Kernels::ConvertToInt16(input.data(), n, gain, actual.data());
+    return Identical("ConvertToInt16", expected, actual);
+}
+
+
+static bool CheckSet(InstructionSet set)
+{
+    Kernels::Select(set);
+    std::default_random_engine engine(12345);
+    bool ok = CheckDistances(engine);
+    for (int stride : {1, 2, 3, 4})
+    {
+        ok = CheckRenderRamp<double>(stride) && ok;
+        ok = CheckRenderRamp<float>(stride) && ok;
+    }
+    for (int stride : {1, 2, 3})
+    {
+        for (int tileStart : {0, 200, 512})
+        {
+            ok = CheckRenderRampTile<double>(stride, tileStart) && ok;
+            ok = CheckRenderRampTile<float>(stride, tileStart) && ok;
+        }
+    }
+    ok = CheckParallelRender() && ok;
+    ok = CheckBlockRender() && ok;
+    ok = CheckPeakBound() && ok;
+    ok = CheckStreamConvolved() && ok;
+    ok = CheckStreamFlash() && ok;
+    ok = CheckSnapshot() && ok;
+    ok = CheckSegmentBvh() && ok;
+    ok = CheckConvolveChannel(engine, 1, 1, 1) && ok;
+    ok = CheckConvolveChannel(engine, 2, 2, 2) && ok;
+    ok = CheckConvolveChannel(engine, 2, 2, 1) && ok;
+    ok = CheckConvolveChannel(engine, 4, 4, 1) && ok;
+    ok = CheckConvolveChannel(engine, 3, 3, 3) && ok;
+    ok = CheckAccumulate(engine) && ok;
+    ok = CheckConvertToInt16(engine) && ok;
+    return ok;
+}
+
+
+int main()
+{
+    bool ok = true;
+    for (InstructionSet set : AllSets)
+    {
+        if (!Kernels::IsAvailable(set))
+        {
+            printf("kernelcheck: %-8s not available\n", Kernels::InstructionSetName(set));
+            continue;
+        }
+
+        bool pass = CheckSet(set);
+        printf("kernelcheck: %-8s %s\n", Kernels::InstructionSetName(set), pass ? "PASS" : "FAIL");
+        ok = ok && pass;
+    }
+
+    // These checks do not use the kernels, so they only need to run once.
+    bool pass = CheckMovingThunder();
+    pass = CheckMovingListener() && pass;
+    pass = CheckAbsorption() && pass;
+    pass = CheckAdaptiveBolt() && pass;
+    printf("kernelcheck: %-8s %s\n", "models", pass ? "PASS" : "FAIL");
+    ok = ok && pass;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// kernels.cpp  -  The baseline variant of every kernel, and the runtime dispatcher
+// that picks the fastest variant the CPU supports.
+
+#define THUNDER_KERNEL_NAMESPACE    Baseline
+#define THUNDER_KERNEL_SET          InstructionSet::Baseline
+#include "kernels_impl.hpp"
+
+#include <atomic>
+#include <stdexcept>
+
+namespace Sapphire
+{
+    namespace Kernels
+    {
+#ifdef THUNDER_KERNELS_AVX2
+        namespace Avx2 { extern const KernelTable Table; }
+#endif
+
+#ifdef THUNDER_KERNELS_AVX512
+        namespace Avx512 { extern const KernelTable Table; }
+#endif
+
+        namespace
+        {
+            // Chosen on first use without any locking, so kernels are safe to call from the audio thread.
+            // If two threads race to make the first choice, they both store the same answer.
+            std::atomic<const KernelTable *> ActiveTable{nullptr};
+
+            const KernelTable *TableFor(InstructionSet set)
+            {
+                switch (set)
+                {
+                case InstructionSet::Baseline:
+                    return &Baseline::Table;
+
+#ifdef THUNDER_KERNELS_AVX2
+                case InstructionSet::AVX2:
+                    __builtin_cpu_init();
+                    return __builtin_cpu_supports("avx2") ? &Avx2::Table : nullptr;
+#endif
+
+#ifdef THUNDER_KERNELS_AVX512
+                case InstructionSet::AVX512:
+                    __builtin_cpu_init();
+                    return (__builtin_cpu_supports("avx512f") &&
+                            __builtin_cpu_supports("avx512bw") &&
+                            __builtin_cpu_supports("avx512dq") &&
+                            __builtin_cpu_supports("avx512vl")) ? &Avx512::Table : nullptr;
+#endif
+
+                default:
+                    return nullptr;
+                }
+            }
+
+            const KernelTable& Active()
+            {
+                const KernelTable *table = ActiveTable.load(std::memory_order_acquire);
+                if (table == nullptr)
+                {
+                    // Prefer the widest vectors the CPU supports.
+                    table = TableFor(InstructionSet::AVX512);
+                    if (table == nullptr)
+                        table = TableFor(InstructionSet::AVX2);
+                    if (table == nullptr)
+                        table = TableFor(InstructionSet::Baseline);
+                    ActiveTable.store(table, std::memory_order_release);
+                }
+                return *table;
+            }
+        }
+
+        const char *InstructionSetName(InstructionSet set)
+        {
+            switch (set)
+            {
+            case InstructionSet::Baseline:  return "baseline";
+            case InstructionSet::AVX2:      return "avx2";
+            case InstructionSet::AVX512:    return "avx512";
+            default:                        return "unknown";
+            }
+        }
+
+        bool IsAvailable(InstructionSet set)
+        {
+            return TableFor(set) != nullptr;
+        }
+
+        InstructionSet Selected()
+        {
+            return Active().instructionSet;
+        }
+
+        void Select(InstructionSet set)
+        {
+            const KernelTable *table = TableFor(set);
+            if (table == nullptr)
+                throw std::range_error("The requested kernel instruction set is not available.");
+            ActiveTable.store(table, std::memory_order_release);
+        }
+
+        void Distances(
+            std::size_t n,
+            const float *px, const float *py, const float *pz,
+            float lx, float ly, float lz,
+            float *distance)
+        {
+            Active().distances(n, px, py, pz, lx, ly, lz, distance);
+        }
+
+        void RenderRamp(float *buffer, int stride, int f1, int f2, int fstop, double amp1, double amp2)
+        {
+            Active().renderRampDouble(buffer, stride, f1, f2, 0, fstop, amp1, amp2);
+        }
+
+        void RenderRamp(float *buffer, int stride, int f1, int f2, int fstop, float amp1, float amp2)
+        {
+            Active().renderRampFloat(buffer, stride, f1, f2, 0, fstop, amp1, amp2);
+        }
+
+        void RenderRampTile(float *tile, int stride, int tileStart, int f1, int f2, int fstop, double amp1, double amp2)
+        {
+            Active().renderRampDouble(tile, stride, f1, f2, tileStart, fstop, amp1, amp2);
+        }
+
+        void RenderRampTile(float *tile, int stride, int tileStart, int f1, int f2, int fstop, float amp1, float amp2)
+        {
+            Active().renderRampFloat(tile, stride, f1, f2, tileStart, fstop, amp1, amp2);
+        }
+
+        void ConvolveChannel(
+            float *y, int yframes, int ystride,
+            const float *f, int fframes, int fstride,
+            const float *g, int gframes, int gstride)
+        {
+            Active().convolveChannel(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+        }
+
+        void Accumulate(double *y, const double *x, double w, std::size_t n)
+        {
+            Active().accumulate(y, x, w, n);
+        }
+
+        void ConvertToInt16(const float *input, std::size_t n, float gain, int16_t *output)
+        {
+            Active().convertToInt16(input, n, gain, output);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// kernels.hpp  -  The innermost loops of the thunder simulation, compiled several times
+// for different instruction sets, with the best one for the running CPU selected at runtime.
+//
+// Each kernel is written once, as plain loops, in kernels_impl.hpp. That file is compiled
+// for the baseline instruction set in kernels.cpp, and again with AVX2 and AVX-512 enabled
+// in kernels_avx2.cpp and kernels_avx512.cpp. All variants are compiled with floating-point
+// contraction disabled and never reorder additions, so they produce bit-identical results;
+// only the speed differs.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Sapphire
+{
+    namespace Kernels
+    {
+        enum class InstructionSet
+        {
+            Baseline,       // whatever the compiler targets by default (SSE2 on x86-64)
+            AVX2,
+            AVX512,
+        };
+
+        // The distance from one listener to each of `n` points:
+        // distance[k] = |(px[k], py[k], pz[k]) - (lx, ly, lz)|
+        void Distances(
+            std::size_t n,
+            const float *px, const float *py, const float *pz,
+            float lx, float ly, float lz,
+            float *distance);
+
+        // Mixes one segment's linear amplitude ramp into one channel of an interleaved buffer:
+        // buffer[stride*f] += (1-x)*amp1 + x*amp2, where x = (f-f1)/(f2-f1), for f1 <= f < fstop.
+        void RenderRamp(float *buffer, int stride, int f1, int f2, int fstop, double amp1, double amp2);
+        void RenderRamp(float *buffer, int stride, int f1, int f2, int fstop, float amp1, float amp2);
+
+        // The same ramp, mixed into one channel of a tile of frames whose first frame is `tileStart`:
+        // tile[stride*(f - tileStart)] += ..., for max(f1, tileStart) <= f < fstop.
+        // Every frame gets exactly the same value as from RenderRamp.
+        void RenderRampTile(float *tile, int stride, int tileStart, int f1, int f2, int fstop, double amp1, double amp2);
+        void RenderRampTile(float *tile, int stride, int tileStart, int f1, int f2, int fstop, float amp1, float amp2);
+
+        // Convolves one channel of `f` with one channel of `g`, overwriting one channel of `y`.
+        // The pointers must already point at the first sample of the desired channel,
+        // and each stride is the number of interleaved channels in its buffer.
+        void ConvolveChannel(
+            float *y, int yframes, int ystride,
+            const float *f, int fframes, int fstride,
+            const float *g, int gframes, int gstride);
+
+        // y[i] += w * x[i] for 0 <= i < n.
+        void Accumulate(double *y, const double *x, double w, std::size_t n);
+
+        // output[i] = (int16_t)(gain * input[i]) for 0 <= i < n.
+        // The caller is responsible for making sure the products fit within the range of int16_t.
+        void ConvertToInt16(const float *input, std::size_t n, float gain, int16_t *output);
+
+        // Pointers to one compiled variant of every kernel.
+        struct KernelTable
+        {
+            InstructionSet instructionSet;
+            void (*distances)(std::size_t, const float *, const float *, const float *, float, float, float, float *);
+            void (*renderRampDouble)(float *, int, int, int, int, int, double, double);
+            void (*renderRampFloat)(float *, int, int, int, int, int, float, float);
+            void (*convolveChannel)(float *, int, int, const float *, int, int, const float *, int, int);
+            void (*accumulate)(double *, const double *, double, std::size_t);
+            void (*convertToInt16)(const float *, std::size_t, float, int16_t *);
+        };
+
+        const char *InstructionSetName(InstructionSet set);
+
+        // Whether this build contains the given variant and the CPU can run it.
+        bool IsAvailable(InstructionSet set);
+
+        // The variant currently used by the kernel functions above.
+        InstructionSet Selected();
+
+        // Overrides the automatic choice of the fastest available variant,
+        // for benchmarking and for comparing variants against each other.
+        // Throws std::range_error if the variant is not available.
+        void Select(InstructionSet set);
+    }
+}
@@ -0,0 +1,7 @@
+// kernels_avx2.cpp  -  The kernels compiled for CPUs with AVX2.
+// The build compiles this file with -mavx2; the dispatcher in kernels.cpp
+// only uses it after checking that the CPU supports AVX2.
+
+#define THUNDER_KERNEL_NAMESPACE    Avx2
+#define THUNDER_KERNEL_SET          InstructionSet::AVX2
+#include "kernels_impl.hpp"
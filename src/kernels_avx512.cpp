@@ -0,0 +1,7 @@
+// kernels_avx512.cpp  -  The kernels compiled for CPUs with AVX-512.
+// The build compiles this file with -mavx512f -mavx512bw -mavx512dq -mavx512vl; the dispatcher
+// in kernels.cpp only uses it after checking that the CPU supports all of those.
+
+#define THUNDER_KERNEL_NAMESPACE    Avx512
+#define THUNDER_KERNEL_SET          InstructionSet::AVX512
+#include "kernels_impl.hpp"
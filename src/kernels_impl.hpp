@@ -0,0 +1,165 @@
+// kernels_impl.hpp  -  Bodies of the kernels declared in kernels.hpp.
+//
+// This file is deliberately included several times, once by each kernels*.cpp file,
+// with THUNDER_KERNEL_NAMESPACE and THUNDER_KERNEL_SET defined differently each time.
+// Every definition lives in that namespace, so the variants never collide.
+// It must not use any inline functions from library headers: the linker keeps only one
+// copy of each inline function, and it might keep one compiled for an instruction set
+// the CPU does not have.
+
+#include <cstddef>
+#include <cstdint>
+#include "kernels.hpp"
+
+#if !defined(THUNDER_KERNEL_NAMESPACE) || !defined(THUNDER_KERNEL_SET)
+    #error Define THUNDER_KERNEL_NAMESPACE and THUNDER_KERNEL_SET before including kernels_impl.hpp.
+#endif
+
+namespace Sapphire
+{
+    namespace Kernels
+    {
+        namespace THUNDER_KERNEL_NAMESPACE
+        {
+            namespace
+            {
+                void Distances(
+                    std::size_t n,
+                    const float * __restrict__ px, const float * __restrict__ py, const float * __restrict__ pz,
+                    float lx, float ly, float lz,
+                    float * __restrict__ distance)
+                {
+                    for (std::size_t k = 0; k < n; ++k)
+                    {
+                        const float dx = px[k] - lx;
+                        const float dy = py[k] - ly;
+                        const float dz = pz[k] - lz;
+                        distance[k] = __builtin_sqrtf(dx*dx + dy*dy + dz*dz);
+                    }
+                }
+
+                template <typename real_t, int S>
+                inline void RampLoop(float * __restrict__ buffer, int stride, int f1, int f2, int fbegin, int fstop, real_t amp1, real_t amp2)
+                {
+                    // S is the stride known at compile time, or 0 to use the runtime value.
+                    // `buffer` holds frame `fbegin` at index 0; frames before `fbegin` are skipped.
+                    // The arithmetic must stay exactly the same as in Thunder::renderAudio.
+                    const int s = (S > 0) ? S : stride;
+                    const real_t span = static_cast<real_t>(f2 - f1);
+                    for (int f = (f1 > fbegin) ? f1 : fbegin; f < fstop; ++f)
+                    {
+                        const real_t x = static_cast<real_t>(f - f1) / span;
+                        buffer[s*(f - fbegin)] += (1-x)*amp1 + x*amp2;
+                    }
+                }
+
+                template <typename real_t>
+                void RenderRamp(float *buffer, int stride, int f1, int f2, int fbegin, int fstop, real_t amp1, real_t amp2)
+                {
+                    switch (stride)
+                    {
+                    case 1:  RampLoop<real_t, 1>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);  break;
+                    case 2:  RampLoop<real_t, 2>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);  break;
+                    case 4:  RampLoop<real_t, 4>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);  break;
+                    default: RampLoop<real_t, 0>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);  break;
+                    }
+                }
+
+                void RenderRampDouble(float *buffer, int stride, int f1, int f2, int fbegin, int fstop, double amp1, double amp2)
+                {
+                    RenderRamp<double>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);
+                }
+
+                void RenderRampFloat(float *buffer, int stride, int f1, int f2, int fbegin, int fstop, float amp1, float amp2)
+                {
+                    RenderRamp<float>(buffer, stride, f1, f2, fbegin, fstop, amp1, amp2);
+                }
+
+                template <int YS, int FS, int GS>
+                inline void ConvolveLoop(
+                    float * __restrict__ y, int yframes, int ystride,
+                    const float * __restrict__ f, int fframes, int fstride,
+                    const float * __restrict__ g, int gframes, int gstride)
+                {
+                    // Each of YS, FS, GS is a stride known at compile time, or 0 to use the runtime value.
+                    //
+                    // Instead of calculating each output sample as a dot product, this adds scaled copies
+                    // of `f` into `y`, one for each sample of `g`, which the compiler can vectorize.
+                    // The copies are added in descending order of `g` index, so every output sample
+                    // receives exactly the same additions in exactly the same order as the dot product
+                    // sum[i] = g[kmax]*f[i-kmax] + ... + g[kmin]*f[i-kmin], and the result is bit-identical.
+                    // The output is processed in tiles small enough to stay in cache across all the copies,
+                    // accumulated in a contiguous local array so the additions vectorize even when `y` is interleaved.
+                    const int ys = (YS > 0) ? YS : ystride;
+                    const int fs = (FS > 0) ? FS : fstride;
+                    const int gs = (GS > 0) ? GS : gstride;
+                    const int tile = 2048;
+                    float sum[tile];    // one tile of the output channel, stored contiguously
+
+                    for (int start = 0; start < yframes; start += tile)
+                    {
+                        const int end = (yframes - start < tile) ? yframes : (start + tile);
+                        for (int i = 0; i < end - start; ++i)
+                            sum[i] = 0.0f;
+
+                        for (int k = gframes-1; k >= 0; --k)
+                        {
+                            const float a = g[gs*k];
+                            const int lo = (start > k) ? start : k;
+                            const int hi = (end < k + fframes) ? end : (k + fframes);
+                            float *s = sum + (lo - start);
+                            const float *fk = f + fs*(lo - k);
+                            for (int j = 0; j < hi - lo; ++j)
+                                s[j] += a * fk[fs*j];
+                        }
+
+                        for (int i = start; i < end; ++i)
+                            y[ys*i] = sum[i - start];
+                    }
+                }
+
+                void ConvolveChannel(
+                    float *y, int yframes, int ystride,
+                    const float *f, int fframes, int fstride,
+                    const float *g, int gframes, int gstride)
+                {
+                    if (ystride == 1 && fstride == 1 && gstride == 1)
+                        ConvolveLoop<1, 1, 1>(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+                    else if (ystride == 2 && fstride == 2 && gstride == 2)
+                        ConvolveLoop<2, 2, 2>(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+                    else if (ystride == 2 && fstride == 2 && gstride == 1)
+                        ConvolveLoop<2, 2, 1>(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+                    else if (ystride == 4 && fstride == 4 && gstride == 1)
+                        ConvolveLoop<4, 4, 1>(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+                    else
+                        ConvolveLoop<0, 0, 0>(y, yframes, ystride, f, fframes, fstride, g, gframes, gstride);
+                }
+
+                void Accumulate(double * __restrict__ y, const double * __restrict__ x, double w, std::size_t n)
+                {
+                    for (std::size_t i = 0; i < n; ++i)
+                        y[i] += w * x[i];
+                }
+
+                void ConvertToInt16(const float * __restrict__ input, std::size_t n, float gain, int16_t * __restrict__ output)
+                {
+                    for (std::size_t i = 0; i < n; ++i)
+                        output[i] = static_cast<int16_t>(gain * input[i]);
+                }
+            }
+
+            extern const KernelTable Table;
+
+            const KernelTable Table =
+            {
+                THUNDER_KERNEL_SET,
+                Distances,
+                RenderRampDouble,
+                RenderRampFloat,
+                ConvolveChannel,
+                Accumulate,
+                ConvertToInt16,
+            };
+        }
+    }
+}
@@ -1,100 +1,278 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <random>
 #include <stdexcept>
+#include <thread>
+#include <utility>
 #include <vector>
 #include "audio_buffer.hpp"
+#include "kernels.hpp"
 
 namespace Sapphire
 {
     const double SPEED_OF_SOUND_IN_AIR = 343.0;     // [meters/second]
 
-    struct BoltPoint
+    // Air absorbs high frequencies more the farther sound travels. This is the product of the
+    // highest frequency that survives and the distance: 10 kHz at 1 km, and 1 kHz at 10 km.
+    const double AIR_ABSORPTION_HZ_METERS = 1.0e+7;
+
+    // All of the geometry and thunder classes are templates on the scalar type `real_t`.
+    // The default `double` is what we normally use. The `float` instantiation
+    // is smaller and faster, and can be validated against `double` for the
+    // distances and timing we care about.
+
+    template <typename real_t = double>
+    struct BasicBoltPoint
     {
-        double x;
-        double y;
-        double z;
-
-        BoltPoint()
-            : x(0.0)
-            , y(0.0)
-            , z(0.0)
+        real_t x;
+        real_t y;
+        real_t z;
+
+        BasicBoltPoint()
+            : x(0)
+            , y(0)
+            , z(0)
             {}
 
-        BoltPoint(double _x, double _y, double _z)
+        BasicBoltPoint(real_t _x, real_t _y, real_t _z)
             : x(_x)
             , y(_y)
             , z(_z)
             {}
+
+        template <typename other_t>
+        explicit BasicBoltPoint(const BasicBoltPoint<other_t>& other)
+            : x(static_cast<real_t>(other.x))
+            , y(static_cast<real_t>(other.y))
+            , z(static_cast<real_t>(other.z))
+            {}
     };
 
 
-    using BoltPointList = std::vector<BoltPoint>;
+    template <typename real_t>
+    using BasicBoltPointList = std::vector<BasicBoltPoint<real_t>>;
+
+    using BoltPoint = BasicBoltPoint<double>;
+    using BoltPointList = BasicBoltPointList<double>;
 
 
-    inline double Distance(const BoltPoint& a, const BoltPoint& b)
+    template <typename real_t, typename other_t>
+    BasicBoltPointList<real_t> ConvertPointList(const BasicBoltPointList<other_t>& list)
     {
-        double dx = b.x - a.x;
-        double dy = b.y - a.y;
-        double dz = b.z - a.z;
+        BasicBoltPointList<real_t> result;
+        result.reserve(list.size());
+        for (const BasicBoltPoint<other_t>& p : list)
+            result.push_back(BasicBoltPoint<real_t>(p));
+        return result;
+    }
+
+
+    template <typename real_t>
+    inline real_t Distance(const BasicBoltPoint<real_t>& a, const BasicBoltPoint<real_t>& b)
+    {
+        real_t dx = b.x - a.x;
+        real_t dy = b.y - a.y;
+        real_t dz = b.z - a.z;
         return std::sqrt(dx*dx + dy*dy + dz*dz);
     }
 
 
-    struct BoltSegment
+    template <typename real_t = double>
+    struct BasicBoltSegment
     {
-        BoltPoint a;
-        BoltPoint b;
+        BasicBoltPoint<real_t> a;
+        BasicBoltPoint<real_t> b;
 
-        BoltSegment()
+        BasicBoltSegment()
             {}
 
-        BoltSegment(const BoltPoint& _a, const BoltPoint& _b)
+        BasicBoltSegment(const BasicBoltPoint<real_t>& _a, const BasicBoltPoint<real_t>& _b)
             : a(_a)
             , b(_b)
             {}
     };
 
 
-    using BoltSegmentList = std::vector<BoltSegment>;
+    template <typename real_t>
+    using BasicBoltSegmentList = std::vector<BasicBoltSegment<real_t>>;
 
+    using BoltSegment = BasicBoltSegment<double>;
+    using BoltSegmentList = BasicBoltSegmentList<double>;
 
-    class LightningBolt
+
+    template <typename real_t = double>
+    class BasicLightningBolt
     {
     private:
-        BoltSegmentList seglist;
+        using point_t = BasicBoltPoint<real_t>;
+        using segment_t = BasicBoltSegment<real_t>;
+
+        BasicBoltSegmentList<real_t> seglist;
         const std::size_t maxSegments;
-        double jag{};
+        real_t jag{};
         std::default_random_engine generator;
+
+        // Adaptive budget: when `adaptiveEars` is not empty, a segment stops being subdivided
+        // once no ear could hear its detail at the given time resolution.
+        BasicBoltPointList<real_t> adaptiveEars;
+        real_t adaptiveFramesPerMeter{};
+        real_t adaptiveToleranceFrames{};
+        real_t adaptiveAbsorptionFramesPerMeter{};      // period of the highest audible frequency, per meter of distance
+
+        struct AdaptiveNode
+        {
+            point_t first;
+            point_t second;
+            std::uint64_t id;       // 1 for the whole bolt; the halves of node k are 2k and 2k+1
+            int depth;              // number of subdivisions from the whole bolt
+            real_t error;           // largest ratio of the spread of arrival times to the tolerance, at any ear
+        };
+
+        friend bool operator < (const AdaptiveNode& a, const AdaptiveNode& b)     // for the heap
+        {
+            return a.error < b.error;
+        }
+
+        // Node ids must fit in 64 bits, even after shifting them to this depth for sorting.
+        static const int MaxAdaptiveDepth = 62;
+
+        std::vector<AdaptiveNode> adaptiveOpen;      // unresolved segments, a heap with the largest error on top
+        std::vector<AdaptiveNode> adaptiveLeaves;    // segments that will not be subdivided any further
+
+        // The random numbers are always generated in double precision,
+        // so that bolts with different scalar types have the same shape for the same seed.
         std::normal_distribution<double> distribution{0.0, 1.0};
 
-        BoltPoint randomHorizontal(double z, double radiusStandardDev)
+        real_t random()
+        {
+            return static_cast<real_t>(distribution(generator));
+        }
+
+        point_t randomHorizontal(real_t z, real_t radiusStandardDev)
         {
             // Pick a random vector parallel to the x-y plane, with zero z-displacement.
-            double r = radiusStandardDev / M_SQRT2;
-            double x = r * distribution(generator);
-            double y = r * distribution(generator);
-            return BoltPoint{x, y, z};
+            real_t r = radiusStandardDev / static_cast<real_t>(M_SQRT2);
+            real_t x = r * random();
+            real_t y = r * random();
+            return point_t{x, y, z};
         }
 
-        void crinkle(BoltPoint first, BoltPoint second, std::size_t budget)
+        real_t adaptiveError(const point_t& first, const point_t& second) const
+        {
+            // The largest ratio, over all ears, of the spread of the arrival times of the sound
+            // from the segment to the tolerance at that ear. The segment is resolved when it is at most 1.
+            // The spread includes an allowance for the random displacements that further subdivision would add.
+            // The displacements are normally distributed, so no allowance can bound them for certain.
+            // This one is a heuristic: the displacements at all deeper levels typically add up
+            // to about twice the first one, which is `jag` times the segment's length.
+            // The tolerance grows with the distance to the segment's nearer end, because the air
+            // absorbs the frequencies that would carry any detail finer than one period
+            // of the highest frequency that survives the trip.
+            const real_t wobble = 2 * jag * Distance(first, second);
+            real_t error = 0;
+            for (const point_t& ear : adaptiveEars)
+            {
+                const real_t da = Distance(ear, first);
+                const real_t db = Distance(ear, second);
+                const real_t spreadFrames = (std::abs(da - db) + wobble) * adaptiveFramesPerMeter;
+                const real_t toleranceFrames = std::max(adaptiveToleranceFrames, adaptiveAbsorptionFramesPerMeter * std::min(da, db));
+                error = std::max(error, spreadFrames / toleranceFrames);
+            }
+            return error;
+        }
+
+        static std::uint64_t NodeHash(std::uint64_t boltSeed, std::uint64_t id)
+        {
+            // SplitMix64, so that neighboring nodes get unrelated random numbers.
+            std::uint64_t z = boltSeed + id * 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        point_t displacedMidpoint(const point_t& first, const point_t& second, std::uint64_t boltSeed, std::uint64_t id) const
+        {
+            // The displacement of each node's midpoint depends only on the bolt's seed and the node,
+            // not on the order in which nodes are subdivided. So the same bolt subdivided
+            // with a coarser tolerance is made of some of the same points, and no others.
+            std::default_random_engine engine(static_cast<unsigned>(NodeHash(boltSeed, id)));
+            std::normal_distribution<double> normal{0.0, 1.0};
+            point_t midpoint{(first.x + second.x)/2, (first.y + second.y)/2, (first.z + second.z)/2};
+            real_t disp = jag * Distance(first, second);
+            midpoint.x += disp * static_cast<real_t>(normal(engine));
+            midpoint.y += disp * static_cast<real_t>(normal(engine));
+            midpoint.z += disp * static_cast<real_t>(normal(engine));
+            return midpoint;
+        }
+
+        void addAdaptiveNode(const point_t& first, const point_t& second, std::uint64_t id, int depth)
+        {
+            AdaptiveNode node{first, second, id, depth, adaptiveError(first, second)};
+            if (node.error <= 1 || depth >= MaxAdaptiveDepth)
+            {
+                adaptiveLeaves.push_back(node);
+            }
+            else
+            {
+                adaptiveOpen.push_back(node);
+                std::push_heap(adaptiveOpen.begin(), adaptiveOpen.end());
+            }
+        }
+
+        void crinkleAdaptive(const point_t& top, const point_t& bottom)
+        {
+            // Always subdivide the segment with the largest error relative to its tolerance anywhere in the bolt,
+            // until every segment is within the tolerance or the maximum number of segments is used.
+            // Then the budget goes wherever the listener can hear the most detail,
+            // however the detail is distributed along the bolt.
+            const std::uint64_t boltSeed = generator();
+            adaptiveOpen.clear();
+            adaptiveLeaves.clear();
+            addAdaptiveNode(top, bottom, 1, 0);
+            std::size_t count = 1;
+            while (!adaptiveOpen.empty() && count < maxSegments)
+            {
+                std::pop_heap(adaptiveOpen.begin(), adaptiveOpen.end());
+                const AdaptiveNode node = adaptiveOpen.back();
+                adaptiveOpen.pop_back();
+                const point_t midpoint = displacedMidpoint(node.first, node.second, boltSeed, node.id);
+                addAdaptiveNode(node.first, midpoint, 2*node.id, node.depth + 1);
+                addAdaptiveNode(midpoint, node.second, 2*node.id + 1, node.depth + 1);
+                ++count;
+            }
+            adaptiveLeaves.insert(adaptiveLeaves.end(), adaptiveOpen.begin(), adaptiveOpen.end());
+
+            // Put the segments in order from top to bottom, as crinkle does, by comparing
+            // the node ids shifted so that they all have the same number of bits.
+            std::sort(adaptiveLeaves.begin(), adaptiveLeaves.end(), [](const AdaptiveNode& a, const AdaptiveNode& b)
+            {
+                return (a.id << (MaxAdaptiveDepth - a.depth)) < (b.id << (MaxAdaptiveDepth - b.depth));
+            });
+
+            for (const AdaptiveNode& node : adaptiveLeaves)
+                seglist.push_back(segment_t{node.first, node.second});
+        }
+
+        void crinkle(point_t first, point_t second, std::size_t budget)
         {
             if (budget == 0)
                 throw std::logic_error("Cannot complete lightning fractal!");
 
             if (budget == 1)
             {
-                seglist.push_back(BoltSegment{first, second});
+                seglist.push_back(segment_t{first, second});
             }
             else
             {
-                BoltPoint midpoint{(first.x + second.x)/2, (first.y + second.y)/2, (first.z + second.z)/2};
-                double disp = jag * Distance(first, second);
-                midpoint.x += disp * distribution(generator);
-                midpoint.y += disp * distribution(generator);
-                midpoint.z += disp * distribution(generator);
-
+                point_t midpoint{(first.x + second.x)/2, (first.y + second.y)/2, (first.z + second.z)/2};
+                real_t disp = jag * Distance(first, second);
+                midpoint.x += disp * random();
+                midpoint.y += disp * random();
+                midpoint.z += disp * random();
                 // Split the budget as equally as possible between the two halves of the fractal.
                 // When the budget is an odd number, flip a coin to see who gets the extra coin.
                 std::size_t firstBudget = budget / 2;
@@ -116,7 +294,7 @@ namespace Sapphire
         }
 
     public:
-        LightningBolt(std::size_t _maxSegments, unsigned _randomSeed = 0)
+        BasicLightningBolt(std::size_t _maxSegments, unsigned _randomSeed = 0)
             : maxSegments(_maxSegments)
             , generator(_randomSeed)
         {
@@ -134,12 +312,80 @@ namespace Sapphire
             return maxSegments;
         }
 
-        const BoltSegmentList& segments() const
+        const BasicBoltSegmentList<real_t>& segments() const
         {
             return seglist;
         }
 
-        void generate(double heightMeters = 3000.0, double radiusMeters = 1000.0, double jaggedness = 1.0)
+        void setSeed(unsigned randomSeed)
+        {
+            // Restart the random sequence, so the next bolt is the same as
+            // the first bolt generated by a new LightningBolt with this seed.
+            generator.seed(randomSeed);
+            distribution.reset();
+        }
+
+        void clear()
+        {
+            seglist.clear();
+        }
+
+        // Lets `generate` stop subdividing a segment once the spread of its arrival times,
+        // at every one of `ears`, is within `toleranceFrames` audio frames, or within one period
+        // of the highest frequency that survives the air between the segment and the ear,
+        // whichever is longer. That frequency is `cutoffHzMeters` divided by the distance,
+        // as in AtmosphericAbsorption; pass 0 to hold every segment to `toleranceFrames`.
+        // At sample-level tolerances the fractal has audible detail down to centimeters,
+        // so it is the absorption that lets distant bolts use fewer segments than the maximum,
+        // while the segments that are used go where the listener can hear the difference.
+        // The maximum is still never exceeded; when it is reached, the segments with
+        // the largest spread relative to their tolerance are the ones left unresolved.
+        // The spread includes a heuristic allowance for detail not yet generated, so a few
+        // segments of the same bolt generated with the maximum budget can fall a little outside it.
+        // Adaptive bolts are subdivided in a different order, so they differ from
+        // bolts generated with the same seed without the adaptive budget.
+        // Call this at setup time, because it copies the ear positions and allocates memory.
+        void setAdaptiveBudget(
+            const BasicBoltPointList<real_t>& ears,
+            int sampleRateHz,
+            real_t toleranceFrames = 1,
+            double cutoffHzMeters = AIR_ABSORPTION_HZ_METERS)
+        {
+            if (ears.empty())
+                throw std::range_error("The adaptive segment budget needs at least one ear.");
+
+            if (sampleRateHz <= 0 || !(toleranceFrames > 0) || !(cutoffHzMeters >= 0))
+                throw std::range_error("Invalid sample rate, tolerance, or cutoff for the adaptive segment budget.");
+
+            adaptiveEars = ears;
+            adaptiveFramesPerMeter = static_cast<real_t>(sampleRateHz / SPEED_OF_SOUND_IN_AIR);
+            adaptiveToleranceFrames = toleranceFrames;
+            adaptiveAbsorptionFramesPerMeter = static_cast<real_t>((cutoffHzMeters > 0) ? (sampleRateHz / cutoffHzMeters) : 0.0);
+            adaptiveOpen.reserve(maxSegments);
+            adaptiveLeaves.reserve(maxSegments);
+        }
+
+        // Go back to always generating exactly the maximum number of segments.
+        void clearAdaptiveBudget()
+        {
+            adaptiveEars.clear();
+        }
+
+        bool isAdaptiveBudget() const
+        {
+            return !adaptiveEars.empty();
+        }
+
+        void addSegment(const segment_t& segment)
+        {
+            // Allows a bolt to be reconstructed from saved data instead of generated randomly.
+            if (seglist.size() >= maxSegments)
+                throw std::range_error("LightningBolt cannot hold any more segments.");
+
+            seglist.push_back(segment);
+        }
+
+        void generate(real_t heightMeters = 3000, real_t radiusMeters = 1000, real_t jaggedness = 1)
         {
             seglist.clear();
 
@@ -148,56 +394,96 @@ namespace Sapphire
                 // Start with a single line segment representing the entire length of the lightning bolt.
                 // The parameters `heightMeters` and `radiusMeters` define a cylindrical frame of reference
                 // within which we maintain a loose confinement based on standard deviations of a normal distribution.
-                BoltPoint top = randomHorizontal(heightMeters, radiusMeters);
-                BoltPoint bottom = randomHorizontal(0.0, radiusMeters);
+                point_t top = randomHorizontal(heightMeters, radiusMeters);
+                point_t bottom = randomHorizontal(0, radiusMeters);
 
                 // Recursively split the line segment into many crinkly line segments.
-                jag = 0.15 * jaggedness;     // experimentally derived factor to create pleasing results for jaggedness = 1.0
-                crinkle(top, bottom, maxSegments);
+                jag = static_cast<real_t>(0.15) * jaggedness;     // experimentally derived factor to create pleasing results for jaggedness = 1.0
+                if (isAdaptiveBudget())
+                    crinkleAdaptive(top, bottom);
+                else
+                    crinkle(top, bottom, maxSegments);
             }
         }
     };
 
 
-    struct ThunderSegment
+    using LightningBolt = BasicLightningBolt<double>;
+
+
+    template <typename real_t = double>
+    struct BasicThunderSegment
     {
-        double distance1{};
-        double distance2{};
+        real_t distance1{};
+        real_t distance2{};
+        real_t gain{1};         // scales the segment's amplitude; less than 1 when an obstacle hides it from the ear
     };
 
 
-    inline bool operator < (const ThunderSegment& a, const ThunderSegment& b)       // for sorting
+    template <typename real_t>
+    inline bool operator < (const BasicThunderSegment<real_t>& a, const BasicThunderSegment<real_t>& b)       // for sorting
     {
         return a.distance1 < b.distance1;
     }
 
 
-    using ThunderSegmentList = std::vector<ThunderSegment>;
+    template <typename real_t>
+    using BasicThunderSegmentList = std::vector<BasicThunderSegment<real_t>>;
+
+    using ThunderSegment = BasicThunderSegment<double>;
+    using ThunderSegmentList = BasicThunderSegmentList<double>;
+
 
+    // Defined in segment_bvh.hpp, which must be included to start thunder with occlusion.
+    template <typename real_t> struct BasicOccluder;
+    template <typename real_t> class BasicSegmentBvh;
 
-    class Thunder
+
+    template <typename real_t = double>
+    class BasicThunder
     {
     private:
-        BoltPointList ears;
+        using point_t = BasicBoltPoint<real_t>;
+        using segment_t = BasicThunderSegment<real_t>;
+        using seglist_t = BasicThunderSegmentList<real_t>;
+
+        BasicBoltPointList<real_t> ears;
         const std::size_t maxSegments;
-        std::vector<ThunderSegmentList> seglistForEar;
-        double minDistance{};
-        double maxDistance{};
+        std::vector<seglist_t> seglistForEar;
+        std::vector<real_t> maxSpanForEar;     // the longest segment heard by each ear, in meters
+        real_t minDistance{};
+        real_t maxDistance{};
 
-        void startEar(const LightningBolt& bolt, const BoltPoint& ear, ThunderSegmentList& seglist)
+        // Scratch memory for peakBound: the frame where each segment stops sounding, and its loudest amplitude.
+        mutable std::vector<std::pair<int, double>> segmentEnds;
+
+        // Scratch memory for starting with occlusion: the gain of each bolt segment at one ear.
+        std::vector<real_t> visibility;
+
+        void startEar(const BasicLightningBolt<real_t>& bolt, const point_t& ear, seglist_t& seglist, real_t& maxSpan, const real_t *gains)
         {
+            // `gains` has one gain per bolt segment, or is null when every segment is heard at full strength.
+            // A segment with zero gain is left out entirely.
             seglist.clear();
-            for (const BoltSegment& bs : bolt.segments())
+            maxSpan = 0;
+            const BasicBoltSegmentList<real_t>& boltSegments = bolt.segments();
+            for (std::size_t k = 0; k < boltSegments.size(); ++k)
             {
+                const BasicBoltSegment<real_t>& bs = boltSegments[k];
+                if (gains != nullptr && gains[k] == 0)
+                    continue;
+
                 // Calculate the distance of each of the bolt segment's endpoints to this ear.
-                ThunderSegment ts;
+                segment_t ts;
+                if (gains != nullptr)
+                    ts.gain = gains[k];
                 ts.distance1 = Distance(ear, bs.a);
                 ts.distance2 = Distance(ear, bs.b);
 
                 // Make sure the first distance is equal or closer than the second.
                 if (ts.distance1 > ts.distance2)
                 {
-                    double swap = ts.distance1;
+                    real_t swap = ts.distance1;
                     ts.distance1 = ts.distance2;
                     ts.distance2 = swap;
                 }
@@ -213,6 +499,7 @@ namespace Sapphire
                     maxDistance = std::max(maxDistance, ts.distance2);
                 }
 
+                maxSpan = std::max(maxSpan, ts.distance2 - ts.distance1);
                 seglist.push_back(ts);
             }
 
@@ -220,14 +507,84 @@ namespace Sapphire
             std::sort(seglist.begin(), seglist.end());
         }
 
+        int frameOf(real_t distance, int sampleRateHz) const
+        {
+            // Snap to nearest frame at endpoints, but round down at the end.
+            // That is because another segment will usually snap to the endpoint as its beginning.
+            real_t t = (distance - minDistance) / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            return static_cast<int>(std::round(t * sampleRateHz));
+        }
+
+        template <int N>
+        void renderFrames(float *buffer, int nchannels, int frames, int sampleRateHz) const
+        {
+            // Mix every ThunderSegment's contribution into the interleaved `buffer`, which must be zeroed.
+            // N is the number of channels known at compile time, or 0 to use the runtime value `nchannels`.
+            const int stride = (N > 0) ? N : nchannels;
+
+            // Iterate through every ThunderSegment and mix in its contribution to the impulse response.
+            // Each must be applied to the correct ear/channel.
+            for (int c = 0; c < stride; ++c)
+            {
+                for (const segment_t& s : seglistForEar[c])
+                {
+                    // Do a linear interpolation using the inverse square law at the range of distances.
+                    real_t amp1 = s.gain / (s.distance1 * s.distance1);
+                    real_t amp2 = s.gain / (s.distance2 * s.distance2);
+                    int f1 = frameOf(s.distance1, sampleRateHz);
+                    int f2 = frameOf(s.distance2, sampleRateHz);
+                    int fstop = std::min(f2, frames);
+                    Kernels::RenderRamp(buffer + c, stride, f1, f2, fstop, amp1, amp2);
+                }
+            }
+        }
+
+        int maxSegmentFrames(int c, int sampleRateHz) const
+        {
+            // A bound on the length of channel `c`'s longest segment, in frames, which bounds how far back a tile must look.
+            // It comes from the span in meters kept up to date by start and restoreSegment, so it costs nothing per block.
+            // Rounding both ends to the nearest frame can lengthen a segment by at most one frame.
+            real_t seconds = maxSpanForEar[c] / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            return static_cast<int>(std::ceil(seconds * sampleRateHz)) + 1;
+        }
+
+        void renderTile(float *tile, int stride, int c, int tileStart, int tileEnd, int maxSpan, int frames, int sampleRateHz) const
+        {
+            // Mix the segments of channel `c` into `tile`, which holds frames [tileStart, tileEnd)
+            // `stride` samples apart, and must be zeroed.
+            // Segments are sorted by `distance1`, so their starting frames never decrease, and the segments
+            // that can reach this tile form one contiguous range: those starting before the tile ends,
+            // but not so early that even the longest segment would finish before the tile begins.
+            // Within the range they are mixed in list order, so every frame receives exactly the same
+            // additions in the same order as in renderFrames, and the result is bit-identical.
+            const seglist_t& seglist = seglistForEar[c];
+            auto first = std::partition_point(seglist.begin(), seglist.end(),
+                [&](const segment_t& s) { return frameOf(s.distance1, sampleRateHz) + maxSpan <= tileStart; });
+            auto last = std::partition_point(first, seglist.end(),
+                [&](const segment_t& s) { return frameOf(s.distance1, sampleRateHz) < tileEnd; });
+
+            for (auto s = first; s != last; ++s)
+            {
+                real_t amp1 = s->gain / (s->distance1 * s->distance1);
+                real_t amp2 = s->gain / (s->distance2 * s->distance2);
+                int f1 = frameOf(s->distance1, sampleRateHz);
+                int f2 = frameOf(s->distance2, sampleRateHz);
+                int fstop = std::min(std::min(f2, frames), tileEnd);
+                Kernels::RenderRampTile(tile, stride, tileStart, f1, f2, fstop, amp1, amp2);
+            }
+        }
+
     public:
-        Thunder(const BoltPointList& _ears, std::size_t _maxSegments)
+        BasicThunder(const BasicBoltPointList<real_t>& _ears, std::size_t _maxSegments)
             : ears(_ears)       // make a copy of the vector
             , maxSegments(_maxSegments)
             , seglistForEar(_ears.size())
+            , maxSpanForEar(_ears.size())
         {
-            for (ThunderSegmentList& slist : seglistForEar)
+            for (seglist_t& slist : seglistForEar)
                 slist.reserve(_maxSegments);
+            segmentEnds.reserve(_maxSegments);
+            visibility.reserve(_maxSegments);
         }
 
         std::size_t numEars() const
@@ -235,73 +592,303 @@ namespace Sapphire
             return ears.size();
         }
 
+        const point_t& ear(std::size_t earIndex) const
+        {
+            return ears.at(earIndex);
+        }
+
         std::size_t getMaxSegments() const
         {
             return maxSegments;
         }
 
-        const ThunderSegmentList& segments(std::size_t earIndex) const
+        const seglist_t& segments(std::size_t earIndex) const
         {
             return seglistForEar.at(earIndex);
         }
 
-        void start(const LightningBolt& bolt)
+        real_t getMinDistance() const
+        {
+            return minDistance;
+        }
+
+        real_t getMaxDistance() const
+        {
+            return maxDistance;
+        }
+
+        void beginRestore()
+        {
+            // Prepare to reconstruct the thunder from saved segment lists instead of from a bolt.
+            // Call `restoreSegment` for each saved segment after this.
+            minDistance = maxDistance = -1;
+            for (seglist_t& slist : seglistForEar)
+                slist.clear();
+            std::fill(maxSpanForEar.begin(), maxSpanForEar.end(), 0);
+        }
+
+        void restoreSegment(std::size_t earIndex, const segment_t& ts)
+        {
+            seglist_t& seglist = seglistForEar.at(earIndex);
+
+            if (seglist.size() >= maxSegments)
+                throw std::range_error("Too many segments restored to this Thunder object.");
+
+            if (!(ts.gain >= 0 && ts.gain <= 1))
+                throw std::range_error("Restored thunder segment gains must be between 0 and 1.");
+
+            if (ts.distance1 > ts.distance2 || (!seglist.empty() && ts < seglist.back()))
+                throw std::logic_error("Restored thunder segments must be ordered the same way Thunder::start orders them.");
+
+            if (minDistance < 0)
+            {
+                minDistance = ts.distance1;
+                maxDistance = ts.distance2;
+            }
+            else
+            {
+                minDistance = std::min(minDistance, ts.distance1);
+                maxDistance = std::max(maxDistance, ts.distance2);
+            }
+
+            maxSpanForEar[earIndex] = std::max(maxSpanForEar[earIndex], ts.distance2 - ts.distance1);
+            seglist.push_back(ts);
+        }
+
+        void start(const BasicLightningBolt<real_t>& bolt)
+        {
+            if (bolt.getMaxSegments() > maxSegments)
+                throw std::range_error("LightningBolt has too many segments for this Thunder object.");
+
+            minDistance = maxDistance = -1;     // special flag for first time init
+            const std::size_t n = ears.size();
+            for (std::size_t i = 0; i < n; ++i)
+                startEar(bolt, ears.at(i), seglistForEar.at(i), maxSpanForEar.at(i), nullptr);
+        }
+
+        // Like start(bolt), except that each ear hears a segment at full strength only when
+        // it can see the segment's midpoint past every one of the `occluders`. A hidden segment's
+        // amplitude is scaled by `occludedGain`, or the segment is dropped when that is 0.
+        // `bvh` must have been built from this bolt. Nothing is allocated, so this is as safe
+        // to call from a rendering thread as start(bolt).
+        void start(
+            const BasicLightningBolt<real_t>& bolt,
+            const BasicSegmentBvh<real_t>& bvh,
+            const std::vector<BasicOccluder<real_t>>& occluders,
+            real_t occludedGain = 0)
         {
             if (bolt.getMaxSegments() > maxSegments)
                 throw std::range_error("LightningBolt has too many segments for this Thunder object.");
 
-            minDistance = maxDistance = -1.0;   // special flag for first time init
+            if (bvh.size() != bolt.segments().size())
+                throw std::logic_error("The segment BVH was not built from this LightningBolt.");
+
+            if (!(occludedGain >= 0 && occludedGain <= 1))
+                throw std::range_error("Occluded gain must be between 0 and 1.");
+
+            minDistance = maxDistance = -1;
             const std::size_t n = ears.size();
             for (std::size_t i = 0; i < n; ++i)
-                startEar(bolt, ears.at(i), seglistForEar.at(i));
+            {
+                bvh.visibility(ears.at(i), occluders, occludedGain, visibility);
+                startEar(bolt, ears.at(i), seglistForEar.at(i), maxSpanForEar.at(i), visibility.data());
+            }
+        }
+
+        int startFrame(int sampleRateHz) const
+        {
+            // The number of frames of silence between the lightning and the first sound reaching any ear.
+            // Rendered audio does not store this silence; it records it as the buffer's start frame instead.
+            if (!(minDistance < maxDistance))
+                return 0;
+
+            real_t delaySeconds = minDistance / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            return static_cast<int>(std::round(sampleRateHz * delaySeconds));
+        }
+
+        int durationFrames(int sampleRateHz) const
+        {
+            // Calculate the total buffer duration in frames, from the first arrival to the last.
+            if (!(minDistance < maxDistance))
+                return 0;
+
+            real_t durationSeconds = (maxDistance - minDistance) / static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            return static_cast<int>(std::ceil(sampleRateHz * durationSeconds));
         }
 
         AudioBuffer renderAudio(int sampleRateHz) const
         {
-            std::vector<float> buffer;
+            AudioBuffer audio;
+            renderAudioInto(sampleRateHz, audio);
+            return audio;
+        }
 
-            int nchannels = numEars();
+        void renderAudioInto(int sampleRateHz, AudioBuffer& audio) const
+        {
+            // Same as renderAudio, but reuses the memory already owned by `audio`.
+            const int nchannels = static_cast<int>(numEars());
+            audio.reset(durationFrames(sampleRateHz), nchannels, startFrame(sampleRateHz));
 
-            if (minDistance < maxDistance)
+            // Use unrolled kernels for the most common channel counts.
+            switch (nchannels)
             {
-                // For now, skip initial silence by starting at minDistance.
-                // Later we can return minDistance and allow the caller to delay the inital onset for realism.
-                // Calculate the total buffer duration in frames.
+            case 1:
+                renderFrames<1>(audio.samples(), nchannels, audio.frames(), sampleRateHz);
+                break;
 
-                double durationSeconds = (maxDistance - minDistance) / SPEED_OF_SOUND_IN_AIR;
-                int durationFrames = static_cast<int>(std::ceil(sampleRateHz * durationSeconds));
-                int nsamples = nchannels * durationFrames;
+            case 2:
+                renderFrames<2>(audio.samples(), nchannels, audio.frames(), sampleRateHz);
+                break;
 
-                buffer.clear();
-                buffer.resize(nsamples);
+            case 4:
+                renderFrames<4>(audio.samples(), nchannels, audio.frames(), sampleRateHz);
+                break;
 
-                // Iterate through every ThunderSegment and mix in its contribution to the impulse response.
-                // Each must be applied to the correct ear/channel.
+            default:
+                renderFrames<0>(audio.samples(), nchannels, audio.frames(), sampleRateHz);
+                break;
+            }
+        }
 
-                for (int c = 0; c < nchannels; ++c)
+        // Returns an upper bound on the absolute value of every sample renderAudio would produce,
+        // calculated from the segment list without rendering anything.
+        // Each segment's ramp never exceeds its louder end, amp1 = gain/distance1^2,
+        // so no frame can exceed the sum of amp1 over the segments sounding at that frame.
+        // Sweeping through the segments in order of their start frames, while removing
+        // those that have ended, finds the largest such sum. The bound is typically
+        // within a few percent of the actual peak, because neighboring segments of the bolt
+        // join end to start. It uses scratch memory owned by this object, so it must not be
+        // called from more than one thread at a time.
+        double peakBound(int sampleRateHz) const
+        {
+            double bound = 0.0;
+            for (const seglist_t& seglist : seglistForEar)
+            {
+                segmentEnds.clear();
+                for (const segment_t& s : seglist)
                 {
-                    for (const ThunderSegment& s : seglistForEar.at(c))
-                    {
-                        // Do a linear interpolation using the inverse square law at the range of distances.
-                        double amp1 = 1 / (s.distance1 * s.distance1);
-                        double amp2 = 1 / (s.distance2 * s.distance2);
-
-                        // Snap to nearest frame at endpoints, but round down at the end.
-                        // That is because another segment will usually snap to the endpoint as its beginning.
-                        double t1 = (s.distance1 - minDistance) / SPEED_OF_SOUND_IN_AIR;
-                        double t2 = (s.distance2 - minDistance) / SPEED_OF_SOUND_IN_AIR;
-                        int f1 = static_cast<int>(std::round(t1 * sampleRateHz));
-                        int f2 = static_cast<int>(std::round(t2 * sampleRateHz));
-                        for (int f = f1; f < f2; ++f)
-                        {
-                            double x = static_cast<double>(f-f1) / static_cast<double>(f2-f1);
-                            buffer.at(nchannels*f + c) += (1-x)*amp1 + x*amp2;
-                        }
-                    }
+                    int f1 = frameOf(s.distance1, sampleRateHz);
+                    int f2 = frameOf(s.distance2, sampleRateHz);
+                    if (f2 > f1)
+                        segmentEnds.push_back(std::make_pair(f2, static_cast<double>(s.gain) / (static_cast<double>(s.distance1) * s.distance1)));
+                }
+                std::sort(segmentEnds.begin(), segmentEnds.end());
+
+                double sum = 0.0;
+                std::size_t ended = 0;
+                for (const segment_t& s : seglist)
+                {
+                    int f1 = frameOf(s.distance1, sampleRateHz);
+                    int f2 = frameOf(s.distance2, sampleRateHz);
+                    if (f2 <= f1)
+                        continue;
+
+                    while (ended < segmentEnds.size() && segmentEnds[ended].first <= f1)
+                        sum -= segmentEnds[ended++].second;
+
+                    sum += static_cast<double>(s.gain) / (static_cast<double>(s.distance1) * s.distance1);
+                    bound = std::max(bound, sum);
                 }
             }
 
-            return AudioBuffer(buffer, nchannels);
+            // Leave room for roundoff error in the running sum and in the rendered samples.
+            return bound * (1.0 + 1.0e-6);
+        }
+
+        // Produces exactly the same audio as renderAudioInto, using `nthreads` threads
+        // (0 means all available cores). The work is divided into tiles of `tileFrames` frames
+        // of a single channel; each worker renders a tile into its own scratch memory
+        // and then copies it into place, so no two threads ever write the same memory.
+        // This allocates memory and creates threads, so it is not meant for the audio thread.
+        void renderAudioParallelInto(int sampleRateHz, AudioBuffer& audio, int nthreads = 0, int tileFrames = 16384) const
+        {
+            if (tileFrames < 1)
+                throw std::range_error("Tile size must be a positive number of frames.");
+
+            const int nchannels = static_cast<int>(numEars());
+            const int frames = durationFrames(sampleRateHz);
+            audio.reset(frames, nchannels, startFrame(sampleRateHz));
+            if (frames == 0)
+                return;
+
+            std::vector<int> maxSpan(static_cast<std::size_t>(nchannels));
+            for (int c = 0; c < nchannels; ++c)
+                maxSpan[c] = maxSegmentFrames(c, sampleRateHz);
+
+            const int tilesPerChannel = (frames + tileFrames - 1) / tileFrames;
+            const int ntasks = nchannels * tilesPerChannel;
+            if (nthreads <= 0)
+                nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            nthreads = std::min(nthreads, ntasks);
+            std::atomic<int> nextTask{0};
+            float *output = audio.samples();
+
+            auto worker = [&]()
+            {
+                std::vector<float> tile(static_cast<std::size_t>(tileFrames));
+                for (;;)
+                {
+                    const int task = nextTask++;
+                    if (task >= ntasks)
+                        break;
+
+                    const int c = task % nchannels;
+                    const int tileStart = (task / nchannels) * tileFrames;
+                    const int tileEnd = std::min(frames, tileStart + tileFrames);
+                    std::fill(tile.begin(), tile.end(), 0.0f);
+                    renderTile(tile.data(), 1, c, tileStart, tileEnd, maxSpan[c], frames, sampleRateHz);
+                    for (int f = tileStart; f < tileEnd; ++f)
+                        output[static_cast<std::size_t>(f)*nchannels + c] = tile[f - tileStart];
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (int t = 1; t < nthreads; ++t)
+                workers.push_back(std::thread(worker));
+            worker();
+            for (std::thread& t : workers)
+                t.join();
+        }
+
+        AudioBuffer renderAudioParallel(int sampleRateHz, int nthreads = 0) const
+        {
+            AudioBuffer audio;
+            renderAudioParallelInto(sampleRateHz, audio, nthreads);
+            return audio;
+        }
+
+        // Renders only frames [blockStart, blockStart + blockFrames) of what renderAudio produces,
+        // clipped to the end of the thunder, so audio can be produced and consumed one block at a time.
+        // Every frame is bit-identical to the same frame of renderAudio.
+        void renderBlockInto(int sampleRateHz, int blockStart, int blockFrames, AudioBuffer& block) const
+        {
+            const int nchannels = static_cast<int>(numEars());
+            const int frames = durationFrames(sampleRateHz);
+            if (blockStart < 0 || blockFrames < 0)
+                throw std::range_error("Invalid block passed to Thunder::renderBlockInto.");
+
+            const int blockEnd = std::min(frames, blockStart + blockFrames);
+            block.reset(std::max(0, blockEnd - blockStart), nchannels, startFrame(sampleRateHz) + blockStart);
+            if (blockEnd <= blockStart)
+                return;
+
+            for (int c = 0; c < nchannels; ++c)
+                renderTile(block.samples() + c, nchannels, c, blockStart, blockEnd, maxSegmentFrames(c, sampleRateHz), frames, sampleRateHz);
+        }
+
+        template <int N>
+        FixedAudioBuffer<N> renderFixedAudio(int sampleRateHz) const
+        {
+            if (numEars() != static_cast<std::size_t>(N))
+                throw std::range_error("Thunder has the wrong number of ears for FixedAudioBuffer.");
+
+            FixedAudioBuffer<N> audio(durationFrames(sampleRateHz));
+            audio.setStartFrame(startFrame(sampleRateHz));
+            renderFrames<N>(audio.samples(), N, audio.frames(), sampleRateHz);
+            return audio;
         }
     };
+
+
+    using Thunder = BasicThunder<double>;
 }
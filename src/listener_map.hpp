@@ -0,0 +1,322 @@
+#pragma once
+
+// listener_map.hpp  -  Evaluates how one lightning bolt sounds at every point of a grid of listeners,
+// without creating a Thunder object or rendering any audio for each point.
+//
+// For each listener, we calculate:
+//
+//     - the time of first arrival: the distance to the closest point of the bolt, divided by the speed of sound
+//     - the duration: the time between the first and last sound reaching the listener
+//     - the envelope peak: the loudest average amplitude the listener hears over any envelope window
+//
+// Thunder::renderAudio produces a sum of linear amplitude ramps, one per bolt segment.
+// The average of that sum over a window of time is the sum of each ramp's integral over the window,
+// divided by the window length, so we can calculate the envelope directly from the segment distances.
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "lightning.hpp"
+#include "kernels.hpp"
+
+namespace Sapphire
+{
+    // A regular 2D or 3D grid of listener positions.
+    // Point (ix, iy, iz) is at origin + (ix*spacingX, iy*spacingY, iz*spacingZ).
+    // For a 2D map, set nz = 1.
+    struct ListenerGrid
+    {
+        BoltPoint origin;
+        double spacingX = 1.0;
+        double spacingY = 1.0;
+        double spacingZ = 1.0;
+        int nx = 1;
+        int ny = 1;
+        int nz = 1;
+
+        std::size_t size() const
+        {
+            return static_cast<std::size_t>(nx) * ny * nz;
+        }
+
+        std::size_t index(int ix, int iy, int iz) const
+        {
+            // Grid data is stored with x varying fastest, then y, then z.
+            return (static_cast<std::size_t>(iz)*ny + iy)*nx + ix;
+        }
+
+        BoltPoint point(int ix, int iy, int iz) const
+        {
+            return BoltPoint{origin.x + ix*spacingX, origin.y + iy*spacingY, origin.z + iz*spacingZ};
+        }
+    };
+
+
+    struct ListenerPointMetrics
+    {
+        float firstArrivalSeconds = 0;
+        float durationSeconds = 0;
+        float envelopePeak = 0;
+    };
+
+
+    // Each thread needs its own scratch memory, which is reused from one listener to the next.
+    template <typename real_t>
+    struct ListenerScratch
+    {
+        std::vector<real_t> distanceA;
+        std::vector<real_t> distanceB;
+        std::vector<double> envelope;
+    };
+
+
+    template <typename real_t = float>
+    class BasicListenerMapper
+    {
+    private:
+        const double envelopeWindowSeconds;
+
+        // Bolt segment endpoints, stored as separate coordinate arrays
+        // so the distance kernel can process many segments at once.
+        std::vector<real_t> ax, ay, az;
+        std::vector<real_t> bx, by, bz;
+
+        static void Distances(
+            std::size_t n,
+            const float *px, const float *py, const float *pz,
+            float lx, float ly, float lz,
+            float *distance)
+        {
+            Kernels::Distances(n, px, py, pz, lx, ly, lz, distance);
+        }
+
+        static void Distances(
+            std::size_t n,
+            const double *px, const double *py, const double *pz,
+            double lx, double ly, double lz,
+            double *distance)
+        {
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const double dx = px[k] - lx;
+                const double dy = py[k] - ly;
+                const double dz = pz[k] - lz;
+                distance[k] = std::sqrt(dx*dx + dy*dy + dz*dz);
+            }
+        }
+
+    public:
+        explicit BasicListenerMapper(double _envelopeWindowSeconds = 0.005)
+            : envelopeWindowSeconds(_envelopeWindowSeconds)
+        {
+            if (!(envelopeWindowSeconds > 0.0))
+                throw std::range_error("Envelope window must be a positive number of seconds.");
+        }
+
+        double windowSeconds() const
+        {
+            return envelopeWindowSeconds;
+        }
+
+        std::size_t numSegments() const
+        {
+            return ax.size();
+        }
+
+        template <typename bolt_real_t>
+        void load(const BasicLightningBolt<bolt_real_t>& bolt)
+        {
+            // Copy the bolt's segment data once; it is shared by every listener.
+            const std::size_t n = bolt.segments().size();
+            for (std::vector<real_t>* v : { &ax, &ay, &az, &bx, &by, &bz })
+                v->resize(n);
+
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const BasicBoltSegment<bolt_real_t>& s = bolt.segments()[k];
+                ax[k] = static_cast<real_t>(s.a.x);
+                ay[k] = static_cast<real_t>(s.a.y);
+                az[k] = static_cast<real_t>(s.a.z);
+                bx[k] = static_cast<real_t>(s.b.x);
+                by[k] = static_cast<real_t>(s.b.y);
+                bz[k] = static_cast<real_t>(s.b.z);
+            }
+        }
+
+        void evaluate(const BoltPoint& listener, ListenerPointMetrics& metrics, ListenerScratch<real_t>& scratch) const
+        {
+            const std::size_t n = ax.size();
+            metrics = ListenerPointMetrics();
+            if (n == 0)
+                return;
+
+            scratch.distanceA.resize(n);
+            scratch.distanceB.resize(n);
+            real_t *da = scratch.distanceA.data();
+            real_t *db = scratch.distanceB.data();
+            const real_t lx = static_cast<real_t>(listener.x);
+            const real_t ly = static_cast<real_t>(listener.y);
+            const real_t lz = static_cast<real_t>(listener.z);
+            Distances(n, ax.data(), ay.data(), az.data(), lx, ly, lz, da);
+            Distances(n, bx.data(), by.data(), bz.data(), lx, ly, lz, db);
+
+            // Put the closer distance in `da` and the farther in `db`, like ThunderSegment.
+            real_t minDistance = da[0];
+            real_t maxDistance = da[0];
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const real_t d1 = std::min(da[k], db[k]);
+                const real_t d2 = std::max(da[k], db[k]);
+                da[k] = d1;
+                db[k] = d2;
+                minDistance = std::min(minDistance, d1);
+                maxDistance = std::max(maxDistance, d2);
+            }
+
+            const double speed = SPEED_OF_SOUND_IN_AIR;
+            const double duration = (maxDistance - minDistance) / speed;
+            metrics.firstArrivalSeconds = static_cast<float>(minDistance / speed);
+            metrics.durationSeconds = static_cast<float>(duration);
+
+            // Integrate each segment's amplitude ramp into the envelope windows it overlaps.
+            // Times are measured from the first arrival, as in Thunder::renderAudio.
+            const double w = envelopeWindowSeconds;
+            const std::size_t nwindows = static_cast<std::size_t>(duration / w) + 1;
+            scratch.envelope.assign(nwindows, 0.0);
+            double *envelope = scratch.envelope.data();
+
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                const double d1 = da[k];
+                const double d2 = db[k];
+                const double t1 = (d1 - minDistance) / speed;
+                const double t2 = (d2 - minDistance) / speed;
+                if (!(t2 > t1))
+                    continue;
+
+                const double a1 = 1.0 / (d1*d1);
+                const double a2 = 1.0 / (d2*d2);
+                const double slope = (a2 - a1) / (t2 - t1);
+
+                const std::size_t first = std::min(nwindows - 1, static_cast<std::size_t>(t1 / w));
+                const std::size_t last = std::min(nwindows - 1, static_cast<std::size_t>(t2 / w));
+                for (std::size_t i = first; i <= last; ++i)
+                {
+                    const double u = std::max(t1, i * w);
+                    const double v = std::min(t2, (i + 1) * w);
+                    if (v > u)
+                        envelope[i] += (v - u) * (a1 + slope*(0.5*(u + v) - t1));
+                }
+            }
+
+            double peak = 0.0;
+            for (std::size_t i = 0; i < nwindows; ++i)
+                peak = std::max(peak, envelope[i]);
+            metrics.envelopePeak = static_cast<float>(peak / w);
+        }
+
+        void evaluateGrid(const ListenerGrid& grid, std::vector<ListenerPointMetrics>& results, int nthreads = 0) const
+        {
+            // Evaluate every grid point, with rows of the grid divided among `nthreads` threads.
+            // Passing 0 uses all available cores.
+            if (grid.nx < 1 || grid.ny < 1 || grid.nz < 1)
+                throw std::range_error("Listener grid dimensions must be positive.");
+
+            if (nthreads <= 0)
+                nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+            results.resize(grid.size());
+            const int nrows = grid.ny * grid.nz;
+            nthreads = std::min(nthreads, nrows);
+            std::atomic<int> nextRow{0};
+
+            auto worker = [&]()
+            {
+                ListenerScratch<real_t> scratch;
+                for (;;)
+                {
+                    const int row = nextRow++;
+                    if (row >= nrows)
+                        break;
+
+                    const int iy = row % grid.ny;
+                    const int iz = row / grid.ny;
+                    for (int ix = 0; ix < grid.nx; ++ix)
+                        evaluate(grid.point(ix, iy, iz), results[grid.index(ix, iy, iz)], scratch);
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (int t = 1; t < nthreads; ++t)
+                workers.push_back(std::thread(worker));
+            worker();
+            for (std::thread& t : workers)
+                t.join();
+        }
+    };
+
+    // Single precision is plenty for a map, and lets the distance kernel process twice as many points at once.
+    using ListenerMapper = BasicListenerMapper<float>;
+
+
+    // The binary grid file starts with this header, followed by grid.size()
+    // ListenerPointMetrics records in the order given by ListenerGrid::index.
+    struct ListenerGridFileHeader
+    {
+        char magic[8];              // "THNDGRID"
+        int32_t version;
+        int32_t nx;
+        int32_t ny;
+        int32_t nz;
+        double originX;
+        double originY;
+        double originZ;
+        double spacingX;
+        double spacingY;
+        double spacingZ;
+        double envelopeWindowSeconds;
+    };
+
+    const int32_t LISTENER_GRID_VERSION = 1;
+
+
+    inline bool WriteListenerGrid(
+        const char *filename,
+        const ListenerGrid& grid,
+        double envelopeWindowSeconds,
+        const std::vector<ListenerPointMetrics>& results)
+    {
+        if (results.size() != grid.size())
+            throw std::range_error("Listener grid results do not match the grid size.");
+
+        FILE *outfile = fopen(filename, "wb");
+        if (outfile == nullptr)
+            return false;
+
+        ListenerGridFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "THNDGRID", 8);
+        header.version = LISTENER_GRID_VERSION;
+        header.nx = grid.nx;
+        header.ny = grid.ny;
+        header.nz = grid.nz;
+        header.originX = grid.origin.x;
+        header.originY = grid.origin.y;
+        header.originZ = grid.origin.z;
+        header.spacingX = grid.spacingX;
+        header.spacingY = grid.spacingY;
+        header.spacingZ = grid.spacingZ;
+        header.envelopeWindowSeconds = envelopeWindowSeconds;
+
+        bool ok = (1 == fwrite(&header, sizeof(header), 1, outfile));
+        ok = ok && (results.size() == fwrite(results.data(), sizeof(ListenerPointMetrics), results.size(), outfile));
+        ok = (0 == fclose(outfile)) && ok;
+        return ok;
+    }
+}
@@ -0,0 +1,259 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// map.cpp  -  Maps how one lightning bolt sounds across a square area of ground.
+// Evaluates first arrival time, duration, and envelope peak at every point of a listener grid,
+// then writes the results as a binary grid file and as a grayscale PGM image of one quantity.
+// Optionally renders the full audio heard at one grid point.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "lightning.hpp"
+#include "listener_map.hpp"
+#include "pipeline.hpp"
+
+const int SAMPLE_RATE = 44100;
+
+
+struct MapOptions
+{
+    unsigned seed = 1;          // std::default_random_engine treats seeds 0 and 1 the same, so start at 1
+    std::size_t segments = 2000;
+    double heightMeters = 3000.0;
+    double radiusMeters = 1000.0;
+    double jaggedness = 1.0;
+    int cells = 256;
+    double extentMeters = 5000.0;
+    double listenerHeightMeters = 0.0;
+    int threads = 0;            // 0 = use all cores
+    double windowMillis = 5.0;
+    std::string quantity = "peak";
+    std::string outputPrefix = "output/map";
+    int audioX = -1;
+    int audioY = -1;
+};
+
+
+static int PrintUsage()
+{
+    printf(
+        "USAGE: map [options]\n"
+        "\n"
+        "    -s seed         random seed of the bolt (default 1)\n"
+        "    -m segments     number of segments in the bolt (default 2000)\n"
+        "    -h meters       bolt height (default 3000)\n"
+        "    -r meters       bolt radius (default 1000)\n"
+        "    -j factor       bolt jaggedness (default 1)\n"
+        "    -n cells        number of grid points along each side (default 256)\n"
+        "    -e meters       the grid covers -e..+e in both x and y (default 5000)\n"
+        "    -z meters       height of the listeners above the ground (default 0)\n"
+        "    -t threads      number of worker threads (default: all cores)\n"
+        "    -w millis       envelope window length (default 5)\n"
+        "    -q quantity     quantity shown in the image: peak, arrival, or duration (default peak)\n"
+        "    -o prefix       output file prefix; writes prefix.grid and prefix.pgm (default output/map)\n"
+        "    -p ix,iy        also render the audio heard at grid point (ix, iy) to prefix.wav\n"
+    );
+    return 1;
+}
+
+
+static bool ParseOptions(int argc, const char *argv[], MapOptions& options)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i+1 >= argc)
+            return false;
+
+        const char *flag = argv[i];
+        const char *value = argv[i+1];
+        if (!strcmp(flag, "-s"))
+            options.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else if (!strcmp(flag, "-m"))
+            options.segments = static_cast<std::size_t>(atol(value));
+        else if (!strcmp(flag, "-h"))
+            options.heightMeters = atof(value);
+        else if (!strcmp(flag, "-r"))
+            options.radiusMeters = atof(value);
+        else if (!strcmp(flag, "-j"))
+            options.jaggedness = atof(value);
+        else if (!strcmp(flag, "-n"))
+            options.cells = atoi(value);
+        else if (!strcmp(flag, "-e"))
+            options.extentMeters = atof(value);
+        else if (!strcmp(flag, "-z"))
+            options.listenerHeightMeters = atof(value);
+        else if (!strcmp(flag, "-t"))
+            options.threads = atoi(value);
+        else if (!strcmp(flag, "-w"))
+            options.windowMillis = atof(value);
+        else if (!strcmp(flag, "-q"))
+            options.quantity = value;
+        else if (!strcmp(flag, "-o"))
+            options.outputPrefix = value;
+        else if (!strcmp(flag, "-p"))
+        {
+            if (2 != sscanf(value, "%d,%d", &options.audioX, &options.audioY))
+                return false;
+        }
+        else
+            return false;
+    }
+
+    if (options.quantity != "peak" && options.quantity != "arrival" && options.quantity != "duration")
+        return false;
+
+    if (options.audioX >= options.cells || options.audioY >= options.cells)
+        return false;
+
+    return options.segments > 0 && options.cells > 1 && options.extentMeters > 0.0 && options.threads >= 0 && options.windowMillis > 0.0;
+}
+
+
+static double Quantity(const MapOptions& options, const Sapphire::ListenerPointMetrics& m)
+{
+    if (options.quantity == "arrival")
+        return m.firstArrivalSeconds;
+
+    if (options.quantity == "duration")
+        return m.durationSeconds;
+
+    // Loudness is easier to see on a logarithmic scale.
+    return 20.0 * std::log10(std::max(1.0e-30, static_cast<double>(m.envelopePeak)));
+}
+
+
+static bool WriteImage(const std::string& filename, const MapOptions& options, const Sapphire::ListenerGrid& grid, const std::vector<Sapphire::ListenerPointMetrics>& results)
+{
+    // Scale the quantity linearly from black (lowest) to white (highest).
+    // For peak level, show only the loudest 60 dB, so a few very quiet points don't wash out the rest.
+    double lo = Quantity(options, results[0]);
+    double hi = lo;
+    for (const Sapphire::ListenerPointMetrics& m : results)
+    {
+        double q = Quantity(options, m);
+        lo = std::min(lo, q);
+        hi = std::max(hi, q);
+    }
+    if (options.quantity == "peak")
+        lo = std::max(lo, hi - 60.0);
+
+    FILE *outfile = fopen(filename.c_str(), "wb");
+    if (outfile == nullptr)
+        return false;
+
+    fprintf(outfile, "P5\n%d %d\n255\n", grid.nx, grid.ny);
+    std::vector<unsigned char> row(static_cast<std::size_t>(grid.nx));
+    for (int iy = grid.ny - 1; iy >= 0; --iy)       // the top of the image is the largest y
+    {
+        for (int ix = 0; ix < grid.nx; ++ix)
+        {
+            double q = Quantity(options, results[grid.index(ix, iy, 0)]);
+            double fraction = (hi > lo) ? (q - lo) / (hi - lo) : 0.0;
+            row[ix] = static_cast<unsigned char>(std::round(255.0 * std::max(0.0, std::min(1.0, fraction))));
+        }
+        fwrite(row.data(), 1, row.size(), outfile);
+    }
+
+    return 0 == fclose(outfile);
+}
+
+
+static bool WriteAudio(const std::string& filename, const Sapphire::LightningBolt& bolt, const Sapphire::BoltPoint& listener)
+{
+    using namespace Sapphire;
+
+    // Full audio is only rendered when asked for, and only for a single point.
+    Thunder thunder{BoltPointList{listener}, bolt.getMaxSegments()};
+    thunder.start(bolt);
+    AudioBuffer audio = thunder.renderAudio(SAMPLE_RATE);
+
+    WaveFileWriter wave;
+    if (!wave.Open(filename.c_str(), SAMPLE_RATE, 1))
+        return false;
+
+    WaveFileStage stage(wave);
+    NormalizingPipeline pipeline;
+    pipeline.AddStage(stage);
+    pipeline.Run(audio);     // includes the silence before the first sound arrives
+    return true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    using namespace Sapphire;
+
+    MapOptions options;
+    if (!ParseOptions(argc, argv, options))
+        return PrintUsage();
+
+    LightningBolt bolt(options.segments);
+    bolt.setSeed(options.seed);
+    bolt.generate(options.heightMeters, options.radiusMeters, options.jaggedness);
+
+    ListenerGrid grid;
+    grid.origin = BoltPoint{-options.extentMeters, -options.extentMeters, options.listenerHeightMeters};
+    grid.spacingX = grid.spacingY = 2.0 * options.extentMeters / (options.cells - 1);
+    grid.nx = grid.ny = options.cells;
+    grid.nz = 1;
+
+    auto startTime = std::chrono::steady_clock::now();
+    ListenerMapper mapper(options.windowMillis / 1000.0);
+    mapper.load(bolt);
+    std::vector<ListenerPointMetrics> results;
+    mapper.evaluateGrid(grid, results, options.threads);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    const std::string gridFileName = options.outputPrefix + ".grid";
+    if (!WriteListenerGrid(gridFileName.c_str(), grid, mapper.windowSeconds(), results))
+    {
+        printf("map: cannot write file: %s\n", gridFileName.c_str());
+        return 1;
+    }
+
+    const std::string imageFileName = options.outputPrefix + ".pgm";
+    if (!WriteImage(imageFileName, options, grid, results))
+    {
+        printf("map: cannot write file: %s\n", imageFileName.c_str());
+        return 1;
+    }
+
+    if (options.audioX >= 0)
+    {
+        const std::string audioFileName = options.outputPrefix + ".wav";
+        if (!WriteAudio(audioFileName, bolt, grid.point(options.audioX, options.audioY, 0)))
+        {
+            printf("map: cannot write file: %s\n", audioFileName.c_str());
+            return 1;
+        }
+    }
+
+    printf("map: evaluated %lu listeners in %0.3lf seconds.\n", static_cast<unsigned long>(grid.size()), elapsed);
+    return 0;
+}
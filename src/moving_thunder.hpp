@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "lightning.hpp"
+
+namespace Sapphire
+{
+    // MovingThunder renders the thunder from a LightningBolt one audio block at a time,
+    // for a listener whose ears are allowed to move while the thunder is heard.
+    // Unlike Thunder, which calculates every distance once from fixed ears,
+    // MovingThunder keeps only the segments whose sound is arriving during the current block,
+    // and updates their distances incrementally as the ears move.
+    // Because each segment's delay changes continuously with the listener's motion,
+    // the rendered audio includes the correct Doppler shift.
+    template <typename real_t = double>
+    class BasicMovingThunder
+    {
+    private:
+        using point_t = BasicBoltPoint<real_t>;
+        using segment_t = BasicBoltSegment<real_t>;
+
+        struct PendingSegment
+        {
+            real_t onsetSeconds;        // earliest possible time this segment can be heard
+            std::size_t index;          // index into `boltSegments`
+        };
+
+        friend bool operator < (const PendingSegment& a, const PendingSegment& b)
+        {
+            return a.onsetSeconds < b.onsetSeconds;
+        }
+
+        struct ActiveSegment
+        {
+            std::size_t index;          // index into `boltSegments`
+            real_t distanceA;           // distance from ear to segment endpoint `a` at the start of the block
+            real_t distanceB;           // distance from ear to segment endpoint `b` at the start of the block
+        };
+
+        const std::size_t nEars;
+        const std::size_t maxSegments;
+        BasicBoltSegmentList<real_t> boltSegments;
+        BasicBoltPointList<real_t> earsBegin;
+        std::vector<std::vector<PendingSegment>> pendingForEar;
+        std::vector<std::vector<ActiveSegment>> activeForEar;
+        std::vector<std::size_t> cursorForEar;
+        real_t maxEarSpeed{};
+        double currentSeconds{};     // kept in double precision so long renders do not drift
+
+    public:
+        BasicMovingThunder(std::size_t _numEars, std::size_t _maxSegments)
+            : nEars(_numEars)
+            , maxSegments(_maxSegments)
+            , earsBegin(_numEars)
+            , pendingForEar(_numEars)
+            , activeForEar(_numEars)
+            , cursorForEar(_numEars)
+        {
+            // Like LightningBolt and Thunder, pre-allocate all the memory we will need,
+            // so that rendering audio blocks never allocates or frees memory.
+            boltSegments.reserve(_maxSegments);
+            for (std::size_t i = 0; i < _numEars; ++i)
+            {
+                pendingForEar[i].reserve(_maxSegments);
+                activeForEar[i].reserve(_maxSegments);
+            }
+        }
+
+        std::size_t numEars() const
+        {
+            return nEars;
+        }
+
+        std::size_t getMaxSegments() const
+        {
+            return maxSegments;
+        }
+
+        double timeSeconds() const
+        {
+            // The time since the lightning flash, at the beginning of the next block to be rendered.
+            return currentSeconds;
+        }
+
+        std::size_t activeSegments(std::size_t earIndex) const
+        {
+            return activeForEar.at(earIndex).size();
+        }
+
+        bool finished() const
+        {
+            for (std::size_t i = 0; i < nEars; ++i)
+                if (cursorForEar[i] < pendingForEar[i].size() || !activeForEar[i].empty())
+                    return false;
+            return true;
+        }
+
+        void start(const BasicLightningBolt<real_t>& bolt, const BasicBoltPointList<real_t>& ears, real_t maxEarSpeedMetersPerSecond)
+        {
+            if (bolt.getMaxSegments() > maxSegments)
+                throw std::range_error("LightningBolt has too many segments for this MovingThunder object.");
+
+            if (ears.size() != nEars)
+                throw std::range_error("Incorrect number of ears passed to MovingThunder::start.");
+
+            // The thunder must outrun the listener. Otherwise a segment that has already
+            // been heard could be heard again, and we could never retire segments.
+            const real_t speed = static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            if (maxEarSpeedMetersPerSecond < 0 || maxEarSpeedMetersPerSecond >= speed)
+                throw std::range_error("Listener speed must be non-negative and less than the speed of sound.");
+
+            maxEarSpeed = maxEarSpeedMetersPerSecond;
+            boltSegments = bolt.segments();     // never allocates, because we reserved enough capacity
+            real_t firstOnset = -1;
+
+            for (std::size_t i = 0; i < nEars; ++i)
+            {
+                earsBegin[i] = ears[i];
+                cursorForEar[i] = 0;
+                activeForEar[i].clear();
+
+                // Sort the segments by the earliest time the listener could possibly hear them,
+                // assuming the listener moves straight toward them at the maximum speed.
+                std::vector<PendingSegment>& pending = pendingForEar[i];
+                pending.clear();
+                const std::size_t n = boltSegments.size();
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    const segment_t& bs = boltSegments[k];
+                    real_t closest = std::min(Distance(ears[i], bs.a), Distance(ears[i], bs.b));
+                    PendingSegment ps;
+                    ps.onsetSeconds = closest / (speed + maxEarSpeed);
+                    ps.index = k;
+                    pending.push_back(ps);
+                }
+                std::sort(pending.begin(), pending.end());
+
+                if (!pending.empty() && (firstOnset < 0 || pending[0].onsetSeconds < firstOnset))
+                    firstOnset = pending[0].onsetSeconds;
+            }
+
+            // Skip the initial silence, which Thunder::renderAudio does not store either.
+            currentSeconds = std::max(0.0, static_cast<double>(firstOnset));
+        }
+
+        void renderBlock(float *buffer, int frames, int sampleRateHz, const BasicBoltPointList<real_t>& earsAtEnd)
+        {
+            // Render `frames` interleaved frames of audio into `buffer`, with one channel per ear.
+            // The ears move in a straight line from where they were at the end of the previous block
+            // (or where they were at `start`) to the positions in `earsAtEnd`.
+
+            if (earsAtEnd.size() != nEars)
+                throw std::range_error("Incorrect number of ears passed to MovingThunder::renderBlock.");
+
+            if (frames < 0 || sampleRateHz <= 0)
+                throw std::range_error("Invalid block size or sample rate passed to MovingThunder::renderBlock.");
+
+            const int nchannels = static_cast<int>(nEars);
+            std::fill(buffer, buffer + (nchannels * frames), 0.0f);
+
+            const double blockSeconds = static_cast<double>(frames) / sampleRateHz;
+            const double endSeconds = currentSeconds + blockSeconds;
+            const real_t endRadius = static_cast<real_t>(SPEED_OF_SOUND_IN_AIR * endSeconds);
+
+            for (int c = 0; c < nchannels; ++c)
+            {
+                const point_t& ear1 = earsBegin[c];
+                const point_t& ear2 = earsAtEnd[c];
+
+                // Allow a little slop for roundoff error in the caller's motion calculations.
+                if (Distance(ear1, ear2) > 1.0e-6 + 1.000001 * maxEarSpeed * blockSeconds)
+                    throw std::range_error("Listener moved faster than the maximum speed passed to MovingThunder::start.");
+
+                // Activate any pending segments that could start being heard during this block.
+                std::vector<ActiveSegment>& active = activeForEar[c];
+                const std::vector<PendingSegment>& pending = pendingForEar[c];
+                std::size_t& cursor = cursorForEar[c];
+                while (cursor < pending.size() && pending[cursor].onsetSeconds < endSeconds)
+                {
+                    const segment_t& bs = boltSegments[pending[cursor].index];
+                    ActiveSegment as;
+                    as.index = pending[cursor].index;
+                    as.distanceA = Distance(ear1, bs.a);
+                    as.distanceB = Distance(ear1, bs.b);
+                    active.push_back(as);
+                    ++cursor;
+                }
+
+                std::size_t k = 0;
+                while (k < active.size())
+                {
+                    ActiveSegment& as = active[k];
+                    const segment_t& bs = boltSegments[as.index];
+
+                    // The distances at the start of this block are left over from the end of the previous block.
+                    // Only the distances at the end of this block need to be calculated.
+                    const real_t endA = Distance(ear2, bs.a);
+                    const real_t endB = Distance(ear2, bs.b);
+
+                    for (int f = 0; f < frames; ++f)
+                    {
+                        // Find where the expanding spherical wavefront is at this moment,
+                        // and where the segment's endpoints are relative to the moving ear.
+                        real_t u = static_cast<real_t>(f) / frames;
+                        real_t radius = static_cast<real_t>(SPEED_OF_SOUND_IN_AIR * (currentSeconds + f / static_cast<double>(sampleRateHz)));
+                        real_t da = (1-u)*as.distanceA + u*endA;
+                        real_t db = (1-u)*as.distanceB + u*endB;
+                        real_t d1 = std::min(da, db);
+                        real_t d2 = std::max(da, db);
+                        if (d1 <= radius && radius < d2)
+                        {
+                            // Do a linear interpolation using the inverse square law at the range of distances.
+                            real_t x = (radius - d1) / (d2 - d1);
+                            buffer[nchannels*f + c] += (1-x)/(d1*d1) + x/(d2*d2);
+                        }
+                    }
+
+                    as.distanceA = endA;
+                    as.distanceB = endB;
+
+                    if (std::max(endA, endB) < endRadius)
+                    {
+                        // The wavefront has passed the entire segment, and because the listener
+                        // is slower than sound, it can never catch up again. Retire the segment.
+                        as = active.back();
+                        active.pop_back();
+                    }
+                    else
+                    {
+                        ++k;
+                    }
+                }
+            }
+
+            for (std::size_t i = 0; i < nEars; ++i)
+                earsBegin[i] = earsAtEnd[i];
+
+            currentSeconds = endSeconds;
+        }
+    };
+
+
+    using MovingThunder = BasicMovingThunder<double>;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+// multi_stroke.hpp  -  A lightning flash made of several return strokes down the same channel.
+//
+// Most flashes have 3 to 5 return strokes, typically 40 to 100 milliseconds apart,
+// and every later stroke follows the channel the first one ionized. The channel geometry
+// is the same for every stroke, so the distances from its segments to each ear are too,
+// and each stroke produces the same thunder, only later and usually weaker.
+//
+// Rendering is linear and does not depend on absolute time, so a whole flash is just
+// the render of one stroke mixed in once per stroke, at that stroke's delay and gain.
+// The bolt is generated once, Thunder::start sorts its segments once, and the thunder is
+// rendered (or convolved) once; each extra stroke costs one multiply-add per sample.
+// The flash can also be streamed block by block, normalized by an upper bound on its peak,
+// so it never has to exist as a whole floating-point buffer.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "audio_buffer.hpp"
+#include "lightning.hpp"
+#include "pipeline.hpp"
+
+namespace Sapphire
+{
+    struct ReturnStroke
+    {
+        double delaySeconds = 0.0;      // time after the first stroke
+        float gain = 1.0f;              // amplitude relative to the first stroke
+    };
+
+    using ReturnStrokeList = std::vector<ReturnStroke>;
+
+
+    // Fills `strokes` with `count` return strokes with typical timing and strength:
+    // the first at full strength, each later one a log-normally distributed interval
+    // (median 60 ms) after the previous, at between 30% and 70% of the first stroke's amplitude.
+    // Reuses the capacity of `strokes`.
+    inline void RandomReturnStrokes(ReturnStrokeList& strokes, std::size_t count, unsigned randomSeed)
+    {
+        std::default_random_engine generator(randomSeed);
+        std::lognormal_distribution<double> interval(std::log(0.060), 0.5);
+        std::uniform_real_distribution<double> strength(0.3, 0.7);
+
+        strokes.resize(count);
+        double delay = 0.0;
+        for (std::size_t k = 0; k < count; ++k)
+        {
+            if (k > 0)
+            {
+                delay += interval(generator);
+                strokes[k].gain = static_cast<float>(strength(generator));
+            }
+            else
+            {
+                strokes[k].gain = 1.0f;
+            }
+            strokes[k].delaySeconds = delay;
+        }
+    }
+
+
+    class MultiStrokeFlash
+    {
+    private:
+        AudioBuffer single;         // the audio of one stroke, reused for every stroke
+        AudioBuffer block;          // one block of a streamed flash
+
+        static int DelayFrames(const ReturnStroke& stroke, int sampleRateHz)
+        {
+            if (!(stroke.delaySeconds >= 0.0) || !std::isfinite(stroke.delaySeconds))
+                throw std::range_error("Return stroke delays must be finite and not negative.");
+            return static_cast<int>(std::round(stroke.delaySeconds * sampleRateHz));
+        }
+
+        // Finds the earliest and latest stroke delays, in frames.
+        static void DelayRange(const ReturnStrokeList& strokes, int sampleRateHz, int& firstDelay, int& lastDelay)
+        {
+            if (strokes.empty())
+                throw std::range_error("A flash needs at least one return stroke.");
+
+            firstDelay = lastDelay = DelayFrames(strokes[0], sampleRateHz);
+            for (const ReturnStroke& s : strokes)
+            {
+                const int delay = DelayFrames(s, sampleRateHz);
+                firstDelay = std::min(firstDelay, delay);
+                lastDelay = std::max(lastDelay, delay);
+            }
+        }
+
+    public:
+        // The cached audio of a single stroke. renderStroke fills it with raw thunder,
+        // but any renderer that writes an AudioBuffer can fill it instead, for example
+        // `convolver.renderInto(thunder, sampleRateHz, flash.stroke())`.
+        AudioBuffer& stroke()
+        {
+            return single;
+        }
+
+        const AudioBuffer& stroke() const
+        {
+            return single;
+        }
+
+        template <typename real_t>
+        void renderStroke(const BasicThunder<real_t>& thunder, int sampleRateHz)
+        {
+            thunder.renderAudioInto(sampleRateHz, single);
+        }
+
+        // Stores the whole flash in `audio`: the cached stroke mixed in once per return stroke.
+        // The buffer's start frame is the first stroke's, so the leading silence is preserved.
+        // Reuses the memory owned by `audio`.
+        void renderInto(AudioBuffer& audio, const ReturnStrokeList& strokes, int sampleRateHz) const
+        {
+            if (&audio == &single || &audio == &block)
+                throw std::logic_error("MultiStrokeFlash cannot store the flash in its own buffers.");
+
+            int firstDelay, lastDelay;
+            DelayRange(strokes, sampleRateHz, firstDelay, lastDelay);
+            audio.reset(single.frames() + (lastDelay - firstDelay), single.channels(), single.startFrame() + firstDelay);
+            for (const ReturnStroke& s : strokes)
+                MixInto(audio, single, s.gain, DelayFrames(s, sampleRateHz));
+        }
+
+        AudioBuffer render(const ReturnStrokeList& strokes, int sampleRateHz) const
+        {
+            AudioBuffer audio;
+            renderInto(audio, strokes, sampleRateHz);
+            return audio;
+        }
+
+        // An upper bound on the flash's peak, given a bound on a single stroke's peak,
+        // such as Thunder::peakBound: the strokes may overlap anywhere, so their gains add.
+        static double PeakBound(double strokeBound, const ReturnStrokeList& strokes)
+        {
+            double sum = 0.0;
+            for (const ReturnStroke& s : strokes)
+                sum += std::abs(static_cast<double>(s.gain));
+            // Leave room for the roundoff error of mixing in single precision.
+            return strokeBound * sum * (1.0 + 1.0e-6);
+        }
+
+        // Streams the same audio as render() through `pipeline`, one block at a time,
+        // normalized by PeakBound(strokeBound, strokes) instead of the actual peak.
+        // `strokeBound` must bound the cached stroke's peak; for raw thunder use thunder.peakBound().
+        // Only the cached stroke and one block are held in memory.
+        // Returns the peak bound that was used to normalize the audio.
+        double streamInto(
+            NormalizingPipeline& pipeline,
+            const ReturnStrokeList& strokes,
+            int sampleRateHz,
+            double strokeBound,
+            bool leadingSilence = true,
+            int blockFrames = 8192)
+        {
+            if (blockFrames < 1)
+                throw std::range_error("MultiStrokeFlash block size must be a positive number of frames.");
+
+            int firstDelay, lastDelay;
+            DelayRange(strokes, sampleRateHz, firstDelay, lastDelay);
+
+            const int nchannels = single.channels();
+            const int frames = single.frames() + (lastDelay - firstDelay);
+            const int startFrame = single.startFrame() + firstDelay;
+            const double bound = PeakBound(strokeBound, strokes);
+            const std::size_t silence = leadingSilence ? static_cast<std::size_t>(startFrame) * nchannels : 0;
+
+            pipeline.Start(static_cast<std::size_t>(frames) * nchannels, static_cast<float>(bound), silence);
+            for (int blockStart = 0; blockStart < frames; blockStart += blockFrames)
+            {
+                block.reset(std::min(blockFrames, frames - blockStart), nchannels, startFrame + blockStart);
+                for (const ReturnStroke& s : strokes)
+                    MixInto(block, single, s.gain, DelayFrames(s, sampleRateHz));
+                pipeline.Feed(block.samples(), block.buffer().size());
+            }
+            pipeline.Finish();
+            return bound;
+        }
+    };
+}
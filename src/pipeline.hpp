@@ -0,0 +1,227 @@
+#pragma once
+
+// pipeline.hpp  -  Converts rendered floating-point audio to 16-bit integer samples
+// and fans them out to any number of consumers (playback, WAV files, ...),
+// scanning the floating-point audio only twice and never copying it.
+// Leading silence recorded as an AudioBuffer start frame is passed to the stages
+// as a count of silent samples, so it never has to exist as floating-point data.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "audio_buffer.hpp"
+#include "kernels.hpp"
+#include "wavefile.hpp"
+
+namespace Sapphire
+{
+    class SampleStage
+    {
+    public:
+        virtual ~SampleStage() {}
+
+        // Called once before any samples are written, with the total number of samples to expect.
+        virtual void Begin(std::size_t totalSamples) {}
+
+        // Called repeatedly with consecutive chunks of interleaved samples.
+        virtual void Write(const int16_t *data, std::size_t nsamples) = 0;
+
+        // Called instead of Write for a run of `nsamples` zero samples.
+        // The default writes them one chunk at a time from a static block of zeros.
+        virtual void WriteSilence(std::size_t nsamples)
+        {
+            static const int16_t zeros[1024] = {};
+            const std::size_t block = sizeof(zeros) / sizeof(zeros[0]);
+            for (std::size_t offset = 0; offset < nsamples; offset += block)
+                Write(zeros, std::min(block, nsamples - offset));
+        }
+
+        // Called once after all samples are written.
+        virtual void End() {}
+    };
+
+
+    // Fills a caller-owned vector with the samples, reusing its capacity when possible.
+    // The caller can then swap the vector into the audio playback buffer.
+    class VectorStage : public SampleStage
+    {
+    private:
+        std::vector<int16_t>& target;
+        std::size_t position = 0;
+
+    public:
+        explicit VectorStage(std::vector<int16_t>& _target)
+            : target(_target)
+            {}
+
+        void Begin(std::size_t totalSamples) override
+        {
+            target.resize(totalSamples);
+            position = 0;
+        }
+
+        void Write(const int16_t *data, std::size_t nsamples) override
+        {
+            if (position + nsamples > target.size())
+                throw std::logic_error("VectorStage received more samples than announced.");
+
+            std::memcpy(target.data() + position, data, nsamples * sizeof(int16_t));
+            position += nsamples;
+        }
+
+        void WriteSilence(std::size_t nsamples) override
+        {
+            if (position + nsamples > target.size())
+                throw std::logic_error("VectorStage received more samples than announced.");
+
+            std::fill(target.begin() + position, target.begin() + (position + nsamples), 0);
+            position += nsamples;
+        }
+    };
+
+
+    // Writes the samples to an already opened WAV file.
+    class WaveFileStage : public SampleStage
+    {
+    private:
+        WaveFileWriter& wave;
+
+    public:
+        explicit WaveFileStage(WaveFileWriter& _wave)
+            : wave(_wave)
+            {}
+
+        void Write(const int16_t *data, std::size_t nsamples) override
+        {
+            wave.WriteSamples(data, static_cast<int>(nsamples));
+        }
+
+        void WriteSilence(std::size_t nsamples) override
+        {
+            wave.WriteSilence(static_cast<int>(nsamples));
+        }
+
+        void End() override
+        {
+            wave.Close();
+        }
+    };
+
+
+    inline float PeakAmplitude(const float *data, std::size_t nsamples)
+    {
+        // Find the largest absolute sample value, and validate the audio at the same time.
+        float peak = 0.0f;
+        for (std::size_t i = 0; i < nsamples; ++i)
+        {
+            if (!std::isfinite(data[i]))
+                throw std::range_error("Non-finite audio data not allowed.");
+            peak = std::max(peak, std::abs(data[i]));
+        }
+        return peak;
+    }
+
+
+    // Normalizes audio to full scale and sends it to every stage in small chunks.
+    //
+    // Run() takes a complete buffer: it scans it once for the peak, then converts it.
+    // When a bound on the peak is known before the audio exists (see Thunder::peakBound),
+    // the audio can instead be streamed in a single pass: call Start() with the bound,
+    // Feed() consecutive blocks as they are produced, then Finish(). Only one block
+    // needs to exist at a time, and each block is converted while it is still in cache.
+    class NormalizingPipeline
+    {
+    private:
+        static const std::size_t ChunkSamples = 4096;
+        std::vector<SampleStage *> stages;
+        int16_t chunk[ChunkSamples];
+        float gain = 1.0f;
+        float peakLimit = 0.0f;
+        std::size_t remaining = 0;
+
+        void convert(const float *data, std::size_t nsamples)
+        {
+            // Convert to integers one small chunk at a time,
+            // and hand each chunk to every stage while it is still in cache.
+            if (nsamples > remaining)
+                throw std::logic_error("NormalizingPipeline received more samples than announced.");
+
+            for (std::size_t offset = 0; offset < nsamples; offset += ChunkSamples)
+            {
+                const std::size_t n = std::min(static_cast<std::size_t>(ChunkSamples), nsamples - offset);
+                Kernels::ConvertToInt16(data + offset, n, gain, chunk);
+                for (SampleStage *stage : stages)
+                    stage->Write(chunk, n);
+            }
+            remaining -= nsamples;
+        }
+
+    public:
+        void AddStage(SampleStage& stage)
+        {
+            stages.push_back(&stage);
+        }
+
+        // Sends the audio to every stage with its absolute timing:
+        // the buffer's leading silence first, then its stored frames.
+        float Run(const AudioBuffer& audio)
+        {
+            const std::size_t silence = static_cast<std::size_t>(audio.startFrame()) * audio.channels();
+            return Run(audio.samples(), audio.buffer().size(), silence);
+        }
+
+        // Sends `nsamples` of floating-point audio to every stage,
+        // preceded by `leadingSilence` zero samples that do not need to be stored anywhere.
+        float Run(const float *data, std::size_t nsamples, std::size_t leadingSilence = 0)
+        {
+            // Pass 1: find the peak, so we can normalize the audio to full scale.
+            // Pass 2: convert and send.
+            float peak = PeakAmplitude(data, nsamples);
+            Start(nsamples, peak, leadingSilence);
+            convert(data, nsamples);
+            Finish();
+            return peakLimit;
+        }
+
+        // Begins streaming `nsamples` samples of audio whose absolute values never exceed `peakBound`,
+        // after `leadingSilence` zero samples. The audio is scaled so `peakBound` would be full scale.
+        void Start(std::size_t nsamples, float peakBound, std::size_t leadingSilence = 0)
+        {
+            if (!std::isfinite(peakBound) || peakBound < 0.0f)
+                throw std::range_error("Invalid peak bound for NormalizingPipeline.");
+
+            peakLimit = (peakBound == 0.0f) ? 1.0f : peakBound;     // avoid division by zero
+            gain = IntSampleScale / peakLimit;
+            remaining = nsamples;
+
+            for (SampleStage *stage : stages)
+                stage->Begin(leadingSilence + nsamples);
+
+            if (leadingSilence > 0)
+                for (SampleStage *stage : stages)
+                    stage->WriteSilence(leadingSilence);
+        }
+
+        // Sends the next block of a stream begun by Start.
+        // Throws an exception if any sample exceeds the promised bound, instead of letting it wrap around.
+        void Feed(const float *data, std::size_t nsamples)
+        {
+            if (PeakAmplitude(data, nsamples) > peakLimit)
+                throw std::range_error("Streamed audio exceeded its peak bound.");
+            convert(data, nsamples);
+        }
+
+        // Ends a stream; every announced sample must have been fed.
+        void Finish()
+        {
+            if (remaining != 0)
+                throw std::logic_error("NormalizingPipeline received fewer samples than announced.");
+
+            for (SampleStage *stage : stages)
+                stage->End();
+        }
+    };
+}
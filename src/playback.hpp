@@ -0,0 +1,69 @@
+#pragma once
+
+// playback.hpp  -  Hands rendered 16-bit audio from the thread that renders it
+// to the audio thread that plays it, without locks and without copying.
+
+#include <atomic>
+#include <cinttypes>
+#include <vector>
+#include "audio_buffer.hpp"
+#include "rtaudit.hpp"
+
+namespace Sapphire
+{
+    // A triple buffer of interleaved int16 samples with N channels.
+    // One producer thread fills a free slot and publishes it; the audio thread picks up
+    // the most recently published slot the next time it asks for samples.
+    // Each of the three slots always belongs to exactly one role: the producer's back slot,
+    // the audio thread's front slot, or the middle slot between them. The index of the middle slot
+    // and a flag saying whether it holds unplayed samples share one atomic word, so publishing
+    // and picking up are each a single atomic exchange, and neither side ever waits for the other
+    // or touches a slot the other one owns.
+    template <int N>
+    class PlaybackQueue
+    {
+    private:
+        static const unsigned SlotMask = 3;
+        static const unsigned Fresh = 4;        // the middle slot was published and not yet picked up
+
+        std::vector<int16_t> slots[3];
+        std::atomic<unsigned> middle{1};        // index of the middle slot, plus Fresh
+        unsigned back = 0;                      // producer only
+        unsigned front = 2;                     // audio thread only
+        std::size_t playIndex = 0;              // audio thread only
+
+    public:
+        // Producer: returns the slot to fill with new samples, which the audio thread cannot be reading.
+        // The slot keeps its capacity from earlier use, so refilling it rarely allocates.
+        std::vector<int16_t>& acquire()
+        {
+            return slots[back];
+        }
+
+        // Producer: makes the slot returned by acquire() available for playback.
+        // Any slot published earlier and not yet picked up is discarded, and becomes the next one to fill.
+        // The published slot is not handed out by acquire() again until another slot has been published,
+        // so the producer may keep reading it until then.
+        void publish()
+        {
+            back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & SlotMask;
+        }
+
+        // Audio thread: writes the next `frames` frames to `output`, padding with silence
+        // when nothing is left to play. Never allocates memory or blocks.
+        void fill(int16_t *output, unsigned frames)
+        {
+            RealTimeAudit::AuditTag tag("PlaybackQueue::fill");
+
+            // Only the producer sets the Fresh flag, and only this thread clears it,
+            // so when it is seen here the exchange is sure to pick up a published slot.
+            if (middle.load(std::memory_order_relaxed) & Fresh)
+            {
+                front = middle.exchange(front, std::memory_order_acq_rel) & SlotMask;
+                playIndex = 0;
+            }
+
+            CopyFramesWithSilence<N>(output, frames, slots[front], playIndex);
+        }
+    };
+}
@@ -0,0 +1,193 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// precision.cpp  -  Benchmarks single-precision lightning/thunder calculations
+// and validates them against double precision for the same random seeds.
+// Exits with a nonzero status if the float distances are off by more than a quarter frame,
+// or if any 64-frame block sum of the float audio is off by more than 2% of the largest block sum.
+// Single samples are not held to a threshold: when a segment's end lands on the other side
+// of a frame boundary, that one sample changes by the segment's whole amplitude,
+// which can be a large fraction of the peak while the sound over a block is unchanged.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "lightning.hpp"
+
+const int SAMPLE_RATE = 44100;
+const std::size_t BLOCK_FRAMES = 64;
+const double MAX_DISTANCE_ERROR_FRAMES = 0.25;
+const double MAX_BLOCK_ERROR = 0.02;
+
+static const Sapphire::BoltPointList Listener
+{
+    Sapphire::BoltPoint{2500.0, +0.1, 0.0},
+    Sapphire::BoltPoint{2500.0, -0.1, 0.0}
+};
+
+
+template <typename real_t>
+struct PrecisionTrial
+{
+    Sapphire::BasicLightningBolt<real_t> bolt;
+    Sapphire::BasicThunder<real_t> thunder;
+    Sapphire::AudioBuffer audio;
+    double elapsedSeconds = 0.0;
+
+    PrecisionTrial(std::size_t maxSegments, unsigned seed)
+        : bolt(maxSegments, seed)
+        , thunder(Sapphire::ConvertPointList<real_t>(Listener), maxSegments)
+        {}
+
+    void run()
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        bolt.generate();
+        thunder.start(bolt);
+        audio = thunder.renderAudio(SAMPLE_RATE);
+        auto stopTime = std::chrono::steady_clock::now();
+        elapsedSeconds = std::chrono::duration<double>(stopTime - startTime).count();
+    }
+
+    std::vector<double> sortedDistances(std::size_t ear, bool second) const
+    {
+        std::vector<double> list;
+        for (const Sapphire::BasicThunderSegment<real_t>& s : thunder.segments(ear))
+            list.push_back(second ? s.distance2 : s.distance1);
+        std::sort(list.begin(), list.end());
+        return list;
+    }
+};
+
+
+static double MaxDifference(const std::vector<double>& a, const std::vector<double>& b)
+{
+    if (a.size() != b.size())
+        return INFINITY;
+
+    double diff = 0.0;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    const int ntrials = (argc > 1) ? atoi(argv[1]) : 20;
+    const std::size_t maxSegments = (argc > 2) ? static_cast<std::size_t>(atol(argv[2])) : 2000;
+
+    if (ntrials < 1 || maxSegments < 1)
+    {
+        printf("USAGE: precision [trials [segments]]\n");
+        return 1;
+    }
+
+    double worstDistanceError = 0.0;
+    double worstAudioError = 0.0;
+    double worstBlockError = 0.0;
+    double doubleSeconds = 0.0;
+    double floatSeconds = 0.0;
+
+    for (int trial = 0; trial < ntrials; ++trial)
+    {
+        const unsigned seed = static_cast<unsigned>(trial);
+
+        PrecisionTrial<double> reference(maxSegments, seed);
+        reference.run();
+        doubleSeconds += reference.elapsedSeconds;
+
+        PrecisionTrial<float> single(maxSegments, seed);
+        single.run();
+        floatSeconds += single.elapsedSeconds;
+
+        for (std::size_t ear = 0; ear < Listener.size(); ++ear)
+        {
+            for (int k = 0; k < 2; ++k)
+            {
+                double diff = MaxDifference(reference.sortedDistances(ear, k), single.sortedDistances(ear, k));
+                worstDistanceError = std::max(worstDistanceError, diff);
+            }
+        }
+
+        // Compare the rendered audio relative to the peak of the double-precision render.
+        const std::vector<float>& a = reference.audio.buffer();
+        const std::vector<float>& b = single.audio.buffer();
+        float peak = 0.0f;
+        for (float x : a)
+            peak = std::max(peak, std::abs(x));
+
+        double audioError = 0.0;
+        const std::size_t n = std::max(a.size(), b.size());
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            float x = (i < a.size()) ? a[i] : 0.0f;
+            float y = (i < b.size()) ? b[i] : 0.0f;
+            audioError = std::max(audioError, static_cast<double>(std::abs(x - y)));
+        }
+        if (peak > 0.0f)
+            audioError /= peak;
+        worstAudioError = std::max(worstAudioError, audioError);
+
+        // Compare sums over blocks of frames, relative to the largest block sum of the double-precision render.
+        const std::size_t nchannels = Listener.size();
+        double largest = 0.0;
+        double blockError = 0.0;
+        for (std::size_t c = 0; c < nchannels; ++c)
+        {
+            for (std::size_t first = c; first < n; first += nchannels * BLOCK_FRAMES)
+            {
+                double sum = 0.0;
+                double diff = 0.0;
+                for (std::size_t i = first; i < std::min(n, first + nchannels * BLOCK_FRAMES); i += nchannels)
+                {
+                    float x = (i < a.size()) ? a[i] : 0.0f;
+                    float y = (i < b.size()) ? b[i] : 0.0f;
+                    sum += x;
+                    diff += y - x;
+                }
+                largest = std::max(largest, std::abs(sum));
+                blockError = std::max(blockError, std::abs(diff));
+            }
+        }
+        if (largest > 0.0)
+            blockError /= largest;
+        worstBlockError = std::max(worstBlockError, blockError);
+    }
+
+    const double framesPerMeter = SAMPLE_RATE / Sapphire::SPEED_OF_SOUND_IN_AIR;
+    printf("trials = %d, segments = %lu\n", ntrials, static_cast<unsigned long>(maxSegments));
+    printf("worst distance error = %lg meters = %lg frames\n", worstDistanceError, worstDistanceError * framesPerMeter);
+    printf("worst audio error relative to peak = %lg\n", worstAudioError);
+    printf("worst %lu-frame block error relative to largest block = %lg\n", static_cast<unsigned long>(BLOCK_FRAMES), worstBlockError);
+    printf("double: %lg ms/event, float: %lg ms/event\n", 1000.0 * doubleSeconds / ntrials, 1000.0 * floatSeconds / ntrials);
+
+    const bool pass = (worstDistanceError * framesPerMeter <= MAX_DISTANCE_ERROR_FRAMES) && (worstBlockError <= MAX_BLOCK_ERROR);
+    printf("precision: %s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,738 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// regress.cpp  -  End-to-end regression harness.
+//
+// Runs a fixed list of scenarios, each a complete path from LightningBolt::generate
+// to finished audio with fixed seeds and listeners, and compares a summary of each
+// result with the golden summary stored in a text file (input/regress.txt).
+// The summary of an event is its length and start frame, and for each channel its peak,
+// its RMS, the RMS of each sixteenth of its length, the centroid of its energy in time,
+// and 64 of its samples, evenly spaced. The samples keep their signs, and the centroid
+// moves by exactly one frame when the audio does, so any change in level, timing,
+// polarity, or shape is caught without storing all the audio.
+//
+// Each scenario runs in its own child process, so its wall time and peak resident memory
+// can be measured separately. Every scenario runs several times, and with -b the median time
+// and the largest memory use are also checked against the budgets stored in the golden file,
+// which allow twice the median time and a quarter more memory than when they were recorded.
+// The budgets only mean something on the machine that recorded them, with nothing else running,
+// so they are not checked by default.
+// Exits with a nonzero status if any output drifts beyond the tolerance,
+// or, with -b, any scenario exceeds its time or memory budget.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lightning.hpp"
+#include "convolution.hpp"
+#include "sparse_convolution.hpp"
+#include "ir_bank.hpp"
+#include "absorption.hpp"
+#include "segment_bvh.hpp"
+#include "multi_stroke.hpp"
+#include "pipeline.hpp"
+#include "streaming.hpp"
+#include "wavefile.hpp"
+
+using namespace Sapphire;
+
+const int SAMPLE_RATE = 44100;
+const std::size_t MAX_SEGMENTS = 2000;
+const int ENVELOPE_BLOCKS = 16;
+const int DECIMATED_SAMPLES = 64;
+const int CHECK_RUNS = 3;           // runs of each scenario when checking
+const int UPDATE_RUNS = 5;          // runs of each scenario when recording the budgets
+
+// Every summary value must be within this fraction of the scenario's peak of its golden value,
+// except for counts, which must match exactly, and centroids, which are measured in frames.
+const double TOLERANCE = 1.0e-4;
+const double FRAME_TOLERANCE = 0.01;
+
+static const BoltPointList FarListener
+{
+    BoltPoint{2500.0, +0.1, 0.0},
+    BoltPoint{2500.0, -0.1, 0.0}
+};
+
+static const BoltPointList NearListener
+{
+    BoltPoint{300.0, +0.1, 0.0},
+    BoltPoint{300.0, -0.1, 0.0}
+};
+
+// Far enough that the air absorbs the bolt's finest detail, so the adaptive budget is not used up.
+static const BoltPointList DistantListener
+{
+    BoltPoint{20000.0, +0.1, 0.0},
+    BoltPoint{20000.0, -0.1, 0.0}
+};
+
+static std::string InputDirectory;
+
+
+// The summary of one scenario: a list of named rows of numbers.
+using Summary = std::map<std::string, std::vector<double>>;
+
+
+static void Summarize(const AudioBuffer& audio, Summary& summary)
+{
+    const int nchannels = audio.channels();
+    const int frames = audio.frames();
+    summary["frames"] = { static_cast<double>(frames) };
+    summary["start"] = { static_cast<double>(audio.startFrame()) };
+    summary["channels"] = { static_cast<double>(nchannels) };
+
+    std::vector<double>& peak = summary["peak"];
+    std::vector<double>& rms = summary["rms"];
+    std::vector<double>& centroid = summary["centroid"];
+    for (int c = 0; c < nchannels; ++c)
+    {
+        double maxAbs = 0.0;
+        double sum = 0.0;
+        double moment = 0.0;
+        std::vector<double>& envelope = summary["envelope" + std::to_string(c)];
+        for (int b = 0; b < ENVELOPE_BLOCKS; ++b)
+        {
+            const int first = static_cast<int>(static_cast<long long>(frames) * b / ENVELOPE_BLOCKS);
+            const int last = static_cast<int>(static_cast<long long>(frames) * (b+1) / ENVELOPE_BLOCKS);
+            double blockSum = 0.0;
+            for (int f = first; f < last; ++f)
+            {
+                const double x = audio.get(c, f);
+                maxAbs = std::max(maxAbs, std::abs(x));
+                blockSum += x*x;
+                moment += static_cast<double>(f) * x*x;
+            }
+            sum += blockSum;
+            envelope.push_back((last > first) ? std::sqrt(blockSum / (last - first)) : 0.0);
+        }
+        peak.push_back(maxAbs);
+        rms.push_back((frames > 0) ? std::sqrt(sum / frames) : 0.0);
+        centroid.push_back((sum > 0.0) ? moment / sum : 0.0);
+
+        // A decimated copy of the audio, taken from the middle of each 64th of its length.
+        std::vector<double>& samples = summary["samples" + std::to_string(c)];
+        for (int k = 0; k < DECIMATED_SAMPLES; ++k)
+            samples.push_back(audio.get(c, static_cast<int>(static_cast<long long>(frames) * (2*k + 1) / (2 * DECIMATED_SAMPLES))));
+    }
+}
+
+
+static AudioBuffer LoadImpulse(const char *name, int maxFrames = 0)
+{
+    const std::string filename = InputDirectory + "/" + name;
+    WaveFileReader reader;
+    if (!reader.Open(filename.c_str()))
+        throw std::runtime_error("Cannot open input file: " + filename);
+
+    std::vector<float> samples = reader.Read(reader.TotalSamples());
+    AudioBuffer impulse(samples, reader.Channels());
+    if (maxFrames <= 0 || maxFrames >= impulse.frames())
+        return impulse;
+
+    AudioBuffer truncated(maxFrames, impulse.channels());
+    for (int c = 0; c < impulse.channels(); ++c)
+        for (int f = 0; f < maxFrames; ++f)
+            truncated.at(c, f) = impulse.get(c, f);
+    return truncated;
+}
+
+
+static void StartThunder(Thunder& thunder, LightningBolt& bolt, unsigned seed)
+{
+    bolt.setSeed(seed);
+    bolt.generate();
+    thunder.start(bolt);
+}
+
+
+static void RawFar(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 1);
+    Summarize(thunder.renderAudio(SAMPLE_RATE), summary);
+}
+
+
+static void RawNear(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(NearListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 2);
+    Summarize(thunder.renderAudio(SAMPLE_RATE), summary);
+}
+
+
+static void Parallel(Summary& summary)
+{
+    // The parallel renderer must match the serial one bit for bit, not just within the tolerance.
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 1);
+    const AudioBuffer parallel = thunder.renderAudioParallel(SAMPLE_RATE, 2);
+    const AudioBuffer serial = thunder.renderAudio(SAMPLE_RATE);
+    std::size_t mismatches = std::max(parallel.buffer().size(), serial.buffer().size()) - std::min(parallel.buffer().size(), serial.buffer().size());
+    for (std::size_t i = 0; i < std::min(parallel.buffer().size(), serial.buffer().size()); ++i)
+        if (0 != std::memcmp(&parallel.buffer()[i], &serial.buffer()[i], sizeof(float)))
+            ++mismatches;
+    Summarize(parallel, summary);
+    summary["mismatches"] = { static_cast<double>(mismatches) };
+}
+
+
+static void Adaptive(Summary& summary)
+{
+    const std::size_t maxSegments = 50000;
+    LightningBolt bolt(maxSegments);
+    bolt.setAdaptiveBudget(DistantListener, SAMPLE_RATE, 1.0);
+    Thunder thunder(DistantListener, maxSegments);
+    StartThunder(thunder, bolt, 3);
+    Summarize(thunder.renderAudio(SAMPLE_RATE), summary);
+    summary["segments"] = { static_cast<double>(bolt.segments().size()) };
+}
+
+
+static void DirectConvolution(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 4);
+    Summarize(Convolution(thunder.renderAudio(SAMPLE_RATE), LoadImpulse("knock.wav", 256)), summary);
+}
+
+
+static void SparseConvolution(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 5);
+    ThunderConvolver convolver(LoadImpulse("knock.wav"));
+    Summarize(convolver.render(thunder, SAMPLE_RATE, ConvolutionMethod::Sparse), summary);
+}
+
+
+static void DenseConvolution(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 5);
+    ThunderConvolver convolver(LoadImpulse("knock.wav"));
+    Summarize(convolver.render(thunder, SAMPLE_RATE, ConvolutionMethod::Dense), summary);
+}
+
+
+static void Bank(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 6);
+    ImpulseResponseBank bank;
+    bank.add(LoadImpulse("crash.wav"));
+    bank.add(LoadImpulse("knock.wav"));
+    AudioBuffer audio;
+    bank.renderInto(thunder, SAMPLE_RATE, audio, { 0.7, 0.3 });
+    Summarize(audio, summary);
+}
+
+
+static void Absorption(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 7);
+    AtmosphericAbsorption absorption;
+    AudioBuffer audio;
+    absorption.renderInto(thunder, SAMPLE_RATE, audio);
+    Summarize(audio, summary);
+}
+
+
+static void Occluded(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    bolt.setSeed(8);
+    bolt.generate();
+    SegmentBvh bvh;
+    bvh.build(bolt);
+    const OccluderList occluders { Occluder{BoltPoint{2300.0, -100.0, 0.0}, BoltPoint{2350.0, 100.0, 60.0}} };
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    thunder.start(bolt, bvh, occluders, 0.25);
+    Summarize(thunder.renderAudio(SAMPLE_RATE), summary);
+}
+
+
+static void MultiStroke(Summary& summary)
+{
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 9);
+    ReturnStrokeList strokes;
+    RandomReturnStrokes(strokes, 4, 9);
+    MultiStrokeFlash flash;
+    flash.renderStroke(thunder, SAMPLE_RATE);
+    Summarize(flash.render(strokes, SAMPLE_RATE), summary);
+}
+
+
+static AudioBuffer ReadBack(const char *filename)
+{
+    WaveFileReader reader;
+    if (!reader.Open(filename))
+        throw std::runtime_error(std::string("Cannot read back WAV file: ") + filename);
+    std::vector<float> samples = reader.Read(reader.TotalSamples());
+    return AudioBuffer(samples, reader.Channels());
+}
+
+
+static std::string TempWaveFile()
+{
+    char filename[] = "/tmp/regress-XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0)
+        throw std::runtime_error("Cannot create a temporary file.");
+    close(fd);
+    return filename;
+}
+
+
+static void ConvolvedWave(Summary& summary)
+{
+    // The whole chain: bolt, thunder, dense convolution, normalized 16-bit WAV file, read back.
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(FarListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 10);
+    ThunderConvolver convolver(LoadImpulse("crash.wav"));
+    AudioBuffer audio = convolver.render(thunder, SAMPLE_RATE, ConvolutionMethod::Dense);
+
+    const std::string filename = TempWaveFile();
+    {
+        WaveFileWriter wave;
+        if (!wave.Open(filename.c_str(), SAMPLE_RATE, audio.channels()))
+            throw std::runtime_error("Cannot write WAV file: " + filename);
+        WaveFileStage stage(wave);
+        NormalizingPipeline pipeline;
+        pipeline.AddStage(stage);
+        pipeline.Run(audio);
+    }
+    AudioBuffer wav = ReadBack(filename.c_str());
+    remove(filename.c_str());
+    Summarize(wav, summary);
+}
+
+
+static void StreamedWave(Summary& summary)
+{
+    // Raw thunder streamed block by block into a WAV file, leading silence included.
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder(NearListener, MAX_SEGMENTS);
+    StartThunder(thunder, bolt, 11);
+
+    const std::string filename = TempWaveFile();
+    {
+        WaveFileWriter wave;
+        if (!wave.Open(filename.c_str(), SAMPLE_RATE, static_cast<int>(thunder.numEars())))
+            throw std::runtime_error("Cannot write WAV file: " + filename);
+        WaveFileStage stage(wave);
+        NormalizingPipeline pipeline;
+        pipeline.AddStage(stage);
+        ThunderStreamer streamer;
+        streamer.streamRaw(thunder, SAMPLE_RATE, pipeline);
+    }
+    AudioBuffer wav = ReadBack(filename.c_str());
+    remove(filename.c_str());
+    Summarize(wav, summary);
+}
+
+
+struct Scenario
+{
+    const char *name;
+    void (*run)(Summary& summary);
+};
+
+static const Scenario Scenarios[] =
+{
+    { "raw-far",            RawFar              },
+    { "raw-near",           RawNear             },
+    { "parallel",           Parallel            },
+    { "adaptive",           Adaptive            },
+    { "direct-knock256",    DirectConvolution   },
+    { "sparse-knock",       SparseConvolution   },
+    { "dense-knock",        DenseConvolution    },
+    { "bank",               Bank                },
+    { "absorption",         Absorption          },
+    { "occluded",           Occluded            },
+    { "multi-stroke",       MultiStroke         },
+    { "convolved-wav",      ConvolvedWave       },
+    { "streamed-wav",       StreamedWave        },
+};
+
+
+struct Measurement
+{
+    bool ok = false;
+    Summary summary;
+    double milliseconds = 0.0;
+    double kilobytes = 0.0;
+};
+
+
+static Measurement Measure(const Scenario& scenario)
+{
+    // Run the scenario in a child process, which sends its summary back through a pipe.
+    // Waiting for the child with wait4 reports the child's own peak resident memory.
+    Measurement m;
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("Cannot create pipe.");
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Cannot fork.");
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        FILE *out = fdopen(fds[1], "w");
+        int status = 0;
+        try
+        {
+            // Time only the scenario itself, not starting and stopping the process.
+            Summary summary;
+            auto start = std::chrono::steady_clock::now();
+            scenario.run(summary);
+            const double milliseconds = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            fprintf(out, "elapsed_ms %.9g\n", milliseconds);
+            for (const auto& row : summary)
+            {
+                fprintf(out, "%s", row.first.c_str());
+                for (double x : row.second)
+                    fprintf(out, " %.9g", x);
+                fprintf(out, "\n");
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            fprintf(stderr, "regress: %s: EXCEPTION: %s\n", scenario.name, ex.what());
+            status = 2;
+        }
+        fclose(out);
+        _exit(status);
+    }
+
+    close(fds[1]);
+    FILE *in = fdopen(fds[0], "r");
+    char line[4096];
+    while (fgets(line, sizeof(line), in))
+    {
+        char *token = strtok(line, " \n");
+        if (token == nullptr)
+            continue;
+        std::vector<double>& row = m.summary[token];
+        while ((token = strtok(nullptr, " \n")) != nullptr)
+            row.push_back(atof(token));
+    }
+    fclose(in);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        throw std::runtime_error("Cannot wait for child process.");
+
+    auto elapsed = m.summary.find("elapsed_ms");
+    const bool timed = (elapsed != m.summary.end() && elapsed->second.size() == 1);
+    if (timed)
+    {
+        m.milliseconds = elapsed->second[0];
+        m.summary.erase(elapsed);
+    }
+    m.kilobytes = static_cast<double>(usage.ru_maxrss);     // Linux reports kilobytes
+    m.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && timed;
+    return m;
+}
+
+
+static Measurement MeasureRuns(const Scenario& scenario, int runs)
+{
+    // Run the scenario several times. Keep the first summary, the median time,
+    // and the largest memory use. Every run must produce the same summary.
+    Measurement result = Measure(scenario);
+    std::vector<double> times { result.milliseconds };
+    for (int r = 1; r < runs && result.ok; ++r)
+    {
+        Measurement m = Measure(scenario);
+        if (!m.ok || m.summary != result.summary)
+        {
+            printf("regress: %s produced different output on run %d.\n", scenario.name, r + 1);
+            result.ok = false;
+        }
+        times.push_back(m.milliseconds);
+        result.kilobytes = std::max(result.kilobytes, m.kilobytes);
+    }
+    std::sort(times.begin(), times.end());
+    result.milliseconds = times[times.size() / 2];
+    return result;
+}
+
+
+// The golden file has one row per line: scenario name, key, then the values.
+// Lines starting with '#' are comments.
+using Golden = std::map<std::string, Summary>;
+
+static bool LoadGolden(const char *filename, Golden& golden)
+{
+    FILE *infile = fopen(filename, "rt");
+    if (infile == nullptr)
+        return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), infile))
+    {
+        if (line[0] == '#')
+            continue;
+        char *name = strtok(line, " \n");
+        char *key = name ? strtok(nullptr, " \n") : nullptr;
+        if (key == nullptr)
+            continue;
+        std::vector<double>& row = golden[name][key];
+        char *token;
+        while ((token = strtok(nullptr, " \n")) != nullptr)
+            row.push_back(atof(token));
+    }
+    fclose(infile);
+    return true;
+}
+
+
+static bool SaveGolden(const char *filename, const Golden& golden)
+{
+    FILE *outfile = fopen(filename, "wt");
+    if (outfile == nullptr)
+        return false;
+
+    fprintf(outfile, "# Golden output and budgets for the regress program.\n");
+    fprintf(outfile, "# Regenerate with `regress -u input/regress.txt` only after verifying that a change in output is intended.\n");
+    for (const Scenario& scenario : Scenarios)
+    {
+        auto s = golden.find(scenario.name);
+        if (s == golden.end())
+            continue;
+        for (const auto& row : s->second)
+        {
+            fprintf(outfile, "%s %s", scenario.name, row.first.c_str());
+            for (double x : row.second)
+                fprintf(outfile, " %.9g", x);
+            fprintf(outfile, "\n");
+        }
+    }
+    return 0 == fclose(outfile);
+}
+
+
+static bool IsExactKey(const std::string& key)
+{
+    return key == "frames" || key == "start" || key == "channels" || key == "segments" || key == "mismatches";
+}
+
+
+static bool Compare(const char *name, const Summary& actual, const Summary& expected)
+{
+    auto peak = expected.find("peak");
+    if (peak == expected.end())
+    {
+        printf("regress: %s has no golden peak.\n", name);
+        return false;
+    }
+
+    double scale = 0.0;
+    for (double x : peak->second)
+        scale = std::max(scale, std::abs(x));
+    const double tolerance = TOLERANCE * scale;
+
+    bool ok = true;
+    for (const auto& row : actual)
+    {
+        auto e = expected.find(row.first);
+        if (e == expected.end() || e->second.size() != row.second.size())
+        {
+            printf("regress: %s %s does not match the shape of the golden data.\n", name, row.first.c_str());
+            ok = false;
+            continue;
+        }
+
+        for (std::size_t i = 0; i < row.second.size(); ++i)
+        {
+            const double a = row.second[i];
+            const double b = e->second[i];
+            const bool match =
+                IsExactKey(row.first) ? (a == b) :
+                (row.first == "centroid") ? (std::abs(a - b) <= FRAME_TOLERANCE) :
+                (std::abs(a - b) <= tolerance);
+            if (!match)
+            {
+                printf("regress: %s %s[%lu] = %.9g, golden = %.9g\n", name, row.first.c_str(), static_cast<unsigned long>(i), a, b);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+
+static double Budget(const Summary& expected, const char *key)
+{
+    auto b = expected.find(key);
+    return (b == expected.end() || b->second.empty()) ? 0.0 : b->second[0];
+}
+
+
+static int PrintUsage()
+{
+    printf(
+        "USAGE: regress [-u | -b] golden.txt\n"
+        "\n"
+        "    Runs every scenario several times and compares its output with golden.txt.\n"
+        "    Input audio is read from the directory containing golden.txt.\n"
+        "\n"
+        "    -b      Also fail any scenario whose median time or largest memory use\n"
+        "            is over the budget in golden.txt. The budgets are only valid\n"
+        "            on the machine that recorded them, when it is otherwise idle.\n"
+        "\n"
+        "    -u      Run every scenario and rewrite golden.txt with the new output,\n"
+        "            a time budget of twice the median time, and a memory budget\n"
+        "            of a quarter more than the largest memory use.\n"
+        "            Use a Release build, on an idle machine.\n"
+    );
+    return 1;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    bool update = false;
+    bool budgets = false;
+    const char *filename = nullptr;
+    if (argc == 2)
+        filename = argv[1];
+    else if (argc == 3 && !strcmp(argv[1], "-u"))
+    {
+        update = true;
+        filename = argv[2];
+    }
+    else if (argc == 3 && !strcmp(argv[1], "-b"))
+    {
+        budgets = true;
+        filename = argv[2];
+    }
+    else
+        return PrintUsage();
+
+    const char *slash = strrchr(filename, '/');
+    InputDirectory = slash ? std::string(filename, slash) : std::string(".");
+
+    Golden golden;
+    if (!update && !LoadGolden(filename, golden))
+    {
+        printf("regress: cannot open golden file: %s\n", filename);
+        return 1;
+    }
+
+    bool ok = true;
+    for (const Scenario& scenario : Scenarios)
+    {
+        Measurement m = MeasureRuns(scenario, update ? UPDATE_RUNS : CHECK_RUNS);
+        if (!m.ok)
+        {
+            printf("regress: %-18s FAIL (the scenario did not finish)\n", scenario.name);
+            ok = false;
+            continue;
+        }
+
+        if (update)
+        {
+            // Only relative margins, so a scenario that doubles its time or grows its memory
+            // by a quarter fails, however small it is.
+            Summary& s = golden[scenario.name];
+            s = m.summary;
+            s["budget_ms"] = { std::ceil(2.0 * m.milliseconds) };
+            s["budget_kb"] = { std::ceil(1.25 * m.kilobytes) };
+            printf("regress: %-18s %9.1lf ms %9.0lf KB\n", scenario.name, m.milliseconds, m.kilobytes);
+            continue;
+        }
+
+        auto g = golden.find(scenario.name);
+        if (g == golden.end())
+        {
+            printf("regress: %-18s FAIL (no golden data; run regress -u)\n", scenario.name);
+            ok = false;
+            continue;
+        }
+
+        bool pass = Compare(scenario.name, m.summary, g->second);
+        const double budgetMs = Budget(g->second, "budget_ms");
+        const double budgetKb = Budget(g->second, "budget_kb");
+        if (budgets && m.milliseconds > budgetMs)
+        {
+            printf("regress: %s took %0.1lf ms, over its budget of %0.0lf ms.\n", scenario.name, m.milliseconds, budgetMs);
+            pass = false;
+        }
+        if (budgets && m.kilobytes > budgetKb)
+        {
+            printf("regress: %s used %0.0lf KB, over its budget of %0.0lf KB.\n", scenario.name, m.kilobytes, budgetKb);
+            pass = false;
+        }
+
+        printf("regress: %-18s %s %9.1lf ms %9.0lf KB\n", scenario.name, pass ? "PASS" : "FAIL", m.milliseconds, m.kilobytes);
+        ok = ok && pass;
+    }
+
+    if (update)
+    {
+        if (!ok || !SaveGolden(filename, golden))
+        {
+            printf("regress: did not update %s\n", filename);
+            return 1;
+        }
+        printf("regress: updated %s\n", filename);
+        return 0;
+    }
+
+    printf("regress: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// replay.cpp  -  Lists the bolts stored in a snapshot archive,
+// or re-renders the thunder from one of them without regenerating the bolt.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "wavefile.hpp"
+#include "lightning.hpp"
+#include "snapshot.hpp"
+#include "pipeline.hpp"
+#include "streaming.hpp"
+#include "multi_stroke.hpp"
+
+const int SAMPLE_RATE = 44100;
+
+static int PrintUsage()
+{
+    printf(
+        "USAGE:\n"
+        "    replay snapfile\n"
+        "        List the records in a snapshot archive.\n"
+        "\n"
+        "    replay snapfile index outfile.wav [strokes]\n"
+        "        Render the thunder for the given record to a WAV file.\n"
+        "        With `strokes` greater than 1, render a flash of that many return strokes\n"
+        "        down the same channel, with random timing and strength.\n"
+    );
+    return 1;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    using namespace Sapphire;
+
+    if (argc != 2 && argc != 4 && argc != 5)
+        return PrintUsage();
+
+    SnapshotReader reader;
+    if (!reader.Open(argv[1]))
+    {
+        printf("replay: cannot open snapshot file: %s\n", argv[1]);
+        return 1;
+    }
+
+    if (argc == 2)
+    {
+        const std::size_t n = reader.size();
+        for (std::size_t i = 0; i < n; ++i)
+            printf("%6lu: segments = %lu, ears = %lu\n", static_cast<unsigned long>(i), static_cast<unsigned long>(reader.segmentCount(i)), static_cast<unsigned long>(reader.earCount(i)));
+        return 0;
+    }
+
+    const std::size_t index = static_cast<std::size_t>(atol(argv[2]));
+    if (index >= reader.size())
+    {
+        printf("replay: record index %lu is out of range; the file has %lu records.\n", static_cast<unsigned long>(index), static_cast<unsigned long>(reader.size()));
+        return 1;
+    }
+
+    if (reader.earCount(index) == 0)
+    {
+        printf("replay: record %lu has no thunder data.\n", static_cast<unsigned long>(index));
+        return 1;
+    }
+
+    const int strokes = (argc == 5) ? atoi(argv[4]) : 1;
+    if (strokes < 1)
+        return PrintUsage();
+
+    // A damaged record can still be out of order or out of range, which LoadThunder reports by throwing.
+    Thunder thunder{reader.ears(index), reader.segmentCount(index)};
+    try
+    {
+        reader.LoadThunder(index, thunder);
+    }
+    catch (const std::exception& ex)
+    {
+        printf("replay: cannot load the thunder from record %lu: %s\n", static_cast<unsigned long>(index), ex.what());
+        return 1;
+    }
+
+    WaveFileWriter wave;
+    if (!wave.Open(argv[3], SAMPLE_RATE, static_cast<int>(thunder.numEars())))
+    {
+        printf("replay: cannot open output file: %s\n", argv[3]);
+        return 1;
+    }
+
+    // Stream the thunder straight into the WAV file, normalized by its analytic peak bound,
+    // so neither the whole event nor a temporary file is ever needed.
+    // The file starts at the moment of the lightning, so the thunder arrives when it would be heard.
+    WaveFileStage stage(wave);
+    NormalizingPipeline pipeline;
+    pipeline.AddStage(stage);
+    if (strokes == 1)
+    {
+        ThunderStreamer streamer;
+        streamer.streamRaw(thunder, SAMPLE_RATE, pipeline);
+    }
+    else
+    {
+        // Render the thunder once, then stream it mixed in once per return stroke,
+        // normalized by the flash's peak bound.
+        ReturnStrokeList list;
+        RandomReturnStrokes(list, static_cast<std::size_t>(strokes), static_cast<unsigned>(index + 1));
+        MultiStrokeFlash flash;
+        flash.renderStroke(thunder, SAMPLE_RATE);
+        flash.streamInto(pipeline, list, SAMPLE_RATE, thunder.peakBound(SAMPLE_RATE));
+    }
+    return 0;
+}
@@ -0,0 +1,439 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// rtaudit.cpp  -  Checks that the audio-thread code paths never allocate memory or lock a mutex,
+// and that producing thunder events stops allocating memory once its buffers are warmed up.
+// Must be compiled with -DTHUNDER_RT_AUDIT. Exits with a nonzero status if any violation is found,
+// so it can be run automatically after every change.
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "lightning.hpp"
+#include "moving_thunder.hpp"
+#include "audio_buffer_pool.hpp"
+#include "convolution.hpp"
+#include "sparse_convolution.hpp"
+#include "ir_bank.hpp"
+#include "streaming.hpp"
+#include "absorption.hpp"
+#include "segment_bvh.hpp"
+#include "multi_stroke.hpp"
+#include "pipeline.hpp"
+#include "playback.hpp"
+
+#include "rtaudit_impl.hpp"
+
+#ifndef THUNDER_RT_AUDIT
+    #error rtaudit.cpp must be compiled with -DTHUNDER_RT_AUDIT
+#endif
+
+using namespace Sapphire;
+
+const int SAMPLE_RATE = 44100;
+const int NUM_CHANNELS = 2;
+const unsigned CALLBACK_FRAMES = 512;
+const std::size_t MAX_SEGMENTS = 2000;
+
+static const BoltPointList Listener
+{
+    BoltPoint{2500.0, +0.1, 0.0},
+    BoltPoint{2500.0, -0.1, 0.0}
+};
+
+
+static bool SelfTest()
+{
+    // Make sure the interceptors are really active; otherwise every other check would pass vacuously.
+    RealTimeAudit::Reset();
+    {
+        RealTimeAudit::AudioThreadScope scope("SelfTest");
+        std::vector<int> v(100);
+        std::mutex m;
+        std::lock_guard<std::mutex> guard(m);
+    }
+
+    bool ok = (RealTimeAudit::Count(RealTimeAudit::Violation::Allocate) > 0) &&
+              (RealTimeAudit::Count(RealTimeAudit::Violation::Free) > 0) &&
+              (RealTimeAudit::Count(RealTimeAudit::Violation::Lock) > 0);
+
+    // Every aligned allocation function must be counted once, and so must freeing what it returned.
+    // The pointers go through a volatile variable so the compiler cannot remove the pairs.
+    RealTimeAudit::Reset();
+    long aligned = 0;
+    {
+        static void *volatile sink;
+        RealTimeAudit::AudioThreadScope scope("SelfTest");
+        void *p = nullptr;
+        ok = (posix_memalign(&p, 64, 256) == 0) && ok;
+        sink = p;
+        free(sink);
+        ++aligned;
+        sink = aligned_alloc(64, 256);
+        free(sink);
+        ++aligned;
+#ifdef __cpp_aligned_new
+        sink = ::operator new(256, std::align_val_t(64));
+        ::operator delete(sink, std::align_val_t(64));
+        ++aligned;
+#endif
+    }
+    ok = ok &&
+         (RealTimeAudit::Count(RealTimeAudit::Violation::Allocate) == aligned) &&
+         (RealTimeAudit::Count(RealTimeAudit::Violation::Free) == aligned);
+
+    RealTimeAudit::Reset();
+    printf("SelfTest: %s\n", ok ? "PASS" : "FAIL - interceptors are not active");
+    return ok;
+}
+
+
+static bool PlaybackTest()
+{
+    // Drive the playback callback on a tagged audio thread while the main thread
+    // renders and publishes a series of thunder events, just like the animate program.
+    PlaybackQueue<NUM_CHANNELS> playback;
+    std::atomic<bool> producerFinished{false};
+    std::atomic<long> audibleFrames{0};
+
+    std::thread audioThread([&]()
+    {
+        RealTimeAudit::AudioThreadScope scope("AudioInputCallback");
+        int16_t buffer[CALLBACK_FRAMES * NUM_CHANNELS];
+        long audible = 0;
+        int extraCallbacks = 0;
+        while (extraCallbacks < 200)
+        {
+            playback.fill(buffer, CALLBACK_FRAMES);
+            for (unsigned i = 0; i < CALLBACK_FRAMES * NUM_CHANNELS; ++i)
+                if (buffer[i] != 0)
+                    ++audible;
+
+            if (producerFinished.load())
+                ++extraCallbacks;
+            else
+                std::this_thread::yield();
+        }
+        audibleFrames = audible;
+    });
+
+    LightningBolt bolt(MAX_SEGMENTS);
+    Thunder thunder{Listener, MAX_SEGMENTS};
+    for (unsigned event = 1; event <= 8; ++event)
+    {
+        bolt.setSeed(event);
+        bolt.generate();
+        thunder.start(bolt);
+        AudioBuffer audio = thunder.renderAudio(SAMPLE_RATE);
+        NormalizingPipeline pipeline;
+        VectorStage stage(playback.acquire());
+        pipeline.AddStage(stage);
+        pipeline.Run(audio.buffer().data(), audio.buffer().size());
+        playback.publish();
+    }
+    producerFinished = true;
+    audioThread.join();
+
+    long violations = RealTimeAudit::TotalCount();
+    bool ok = (violations == 0) && (audibleFrames > 0);
+    printf("PlaybackTest: %s (%ld violations, %ld nonzero samples played)\n", ok ? "PASS" : "FAIL", violations, audibleFrames.load());
+    if (violations != 0)
+        RealTimeAudit::PrintReport(stdout);
+    RealTimeAudit::Reset();
+    return ok;
+}
+
+
+static bool PlaybackStressTest()
+{
+    // A producer thread publishes slots as fast as it can while the audio thread plays them.
+    // Every sample holds its slot's sequence number and its own position in the slot.
+    // The producer first fills each slot with negative samples and lets the audio thread run,
+    // so if the slot being filled were also being played, the audio thread would hear them,
+    // or hear the position jump to somewhere other than the start of a slot.
+    const unsigned SlotFrames = 256;
+    const unsigned CallbackFrames = 32;
+    const int Slots = 20000;
+    PlaybackQueue<1> playback;
+    std::atomic<bool> producerFinished{false};
+
+    std::thread producer([&]()
+    {
+        for (int seq = 0; seq < Slots; ++seq)
+        {
+            std::vector<int16_t>& samples = playback.acquire();
+            samples.assign(SlotFrames, -1);
+            std::this_thread::yield();
+            for (unsigned i = 0; i < SlotFrames; ++i)
+                samples[i] = static_cast<int16_t>((1 + seq % 127) * SlotFrames + i);
+            playback.publish();
+            std::this_thread::yield();
+        }
+        producerFinished = true;
+    });
+
+    long errors = 0;
+    long pickups = 0;
+    int previous = -1;      // the last sample played, or -1 before anything is played
+    int16_t buffer[CallbackFrames];
+    int extraCallbacks = 0;
+    while (extraCallbacks < 10)
+    {
+        playback.fill(buffer, CallbackFrames);
+        for (unsigned j = 0; j < CallbackFrames; ++j)
+        {
+            const int x = buffer[j];
+            const bool slotEnded = (previous <= 0) || (previous % SlotFrames == SlotFrames - 1);
+            if (x == 0 ? slotEnded : (!slotEnded && x == previous + 1))
+            {
+                // Silence after the end of a slot, or the next sample of the same slot.
+            }
+            else if (j == 0 && x % SlotFrames == 0)
+            {
+                // A newly published slot is picked up at the start of a callback.
+                ++pickups;
+            }
+            else
+            {
+                ++errors;
+            }
+            previous = x;
+        }
+        if (producerFinished.load())
+            ++extraCallbacks;
+        else
+            std::this_thread::yield();
+    }
+    producer.join();
+
+    bool ok = (errors == 0) && (pickups > 100);
+    printf("PlaybackStressTest: %s (%ld samples changed while playing, %ld slots picked up)\n", ok ? "PASS" : "FAIL", errors, pickups);
+    return ok;
+}
+
+
+static bool MovingThunderTest()
+{
+    // MovingThunder::renderBlock is meant to be called from an audio callback,
+    // so everything it needs must have been allocated by its constructor and start().
+    LightningBolt bolt(MAX_SEGMENTS);
+    bolt.setSeed(7);
+    bolt.generate();
+
+    MovingThunder thunder{Listener.size(), MAX_SEGMENTS};
+    const double earSpeed = 20.0;
+    thunder.start(bolt, Listener, earSpeed);
+
+    BoltPointList ears = Listener;
+    std::vector<float> block(CALLBACK_FRAMES * Listener.size());
+    const double blockSeconds = static_cast<double>(CALLBACK_FRAMES) / SAMPLE_RATE;
+
+    RealTimeAudit::Reset();
+    {
+        RealTimeAudit::AudioThreadScope scope("MovingThunder::renderBlock");
+        int count = 0;
+        while (!thunder.finished() && count < 100000)
+        {
+            for (BoltPoint& e : ears)
+                e.x -= earSpeed * blockSeconds;
+            thunder.renderBlock(block.data(), static_cast<int>(CALLBACK_FRAMES), SAMPLE_RATE, ears);
+            ++count;
+        }
+    }
+
+    long violations = RealTimeAudit::TotalCount();
+    bool ok = (violations == 0) && thunder.finished();
+    printf("MovingThunderTest: %s (%ld violations)\n", ok ? "PASS" : "FAIL", violations);
+    if (violations != 0)
+        RealTimeAudit::PrintReport(stdout);
+    RealTimeAudit::Reset();
+    return ok;
+}
+
+
+static bool SegmentBvhReserveTest()
+{
+    // After reserve(n), building the tree for a bolt of n segments, or fewer, must not allocate,
+    // even the first time, with no earlier build to grow the buffers.
+    long violations = 0;
+    for (std::size_t maxSegments : {1, 4, 5, 2000, 1000000})
+    {
+        std::vector<LightningBolt> bolts;
+        for (std::size_t n : {maxSegments, maxSegments - maxSegments/3, std::size_t{1}})
+        {
+            bolts.emplace_back(n, 3);
+            bolts.back().generate();
+        }
+
+        SegmentBvh bvh;
+        bvh.reserve(maxSegments);
+        RealTimeAudit::Reset();
+        {
+            RealTimeAudit::AudioThreadScope scope("SegmentBvh::build");
+            for (const LightningBolt& bolt : bolts)
+                bvh.build(bolt);
+        }
+        violations += RealTimeAudit::TotalCount();
+        if (RealTimeAudit::TotalCount() != 0)
+            RealTimeAudit::PrintReport(stdout);
+    }
+
+    bool ok = (violations == 0);
+    printf("SegmentBvhReserveTest: %s (%ld violations)\n", ok ? "PASS" : "FAIL", violations);
+    RealTimeAudit::Reset();
+    return ok;
+}
+
+
+class EventProducer
+{
+private:
+    LightningBolt bolt{MAX_SEGMENTS};
+    Thunder thunder{Listener, MAX_SEGMENTS};
+    SegmentBvh bvh;
+    const OccluderList occluders { Occluder{BoltPoint{2300.0, -100.0, 0.0}, BoltPoint{2350.0, 100.0, 60.0}} };
+    AudioBufferPool pool;
+    AudioBuffer impulse;
+    AudioBuffer shortImpulse;
+    ThunderConvolver convolver;
+    ImpulseResponseBank bank;
+    std::vector<double> bankGains { 0.75, 0.25 };
+    ThunderStreamer streamer;
+    MultiStrokeFlash flash;
+    ReturnStrokeList strokes;
+    AudioBuffer flashAudio;
+    AtmosphericAbsorption absorption;
+    std::vector<int16_t> samples;
+    VectorStage stage{samples};
+    NormalizingPipeline pipeline;
+
+    static AudioBuffer MakeImpulse(int frames)
+    {
+        // A decaying, alternating impulse response; its exact shape does not matter here.
+        AudioBuffer ir(frames, 1);
+        for (int f = 0; f < frames; ++f)
+            ir.at(0, f) = ((f % 2) ? -1.0f : 1.0f) * std::exp(-5.0f * f / frames);
+        return ir;
+    }
+
+public:
+    EventProducer()
+        : impulse(MakeImpulse(4000))
+        , shortImpulse(MakeImpulse(32))
+        , convolver(impulse)
+    {
+        bank.add(impulse);
+        bank.add(shortImpulse);
+        bvh.reserve(MAX_SEGMENTS);
+        RandomReturnStrokes(strokes, 4, 1);
+        pipeline.AddStage(stage);
+    }
+
+    void produce(unsigned seed)
+    {
+        // Every stage of producing an event, each writing into recycled memory.
+        bolt.setSeed(seed);
+        bolt.generate();
+        bvh.build(bolt);
+        thunder.start(bolt, bvh, occluders, 0.5);
+
+        const int frames = thunder.durationFrames(SAMPLE_RATE);
+        AudioBuffer raw = pool.acquire(frames, NUM_CHANNELS);
+        AudioBuffer processed = pool.acquire(frames + impulse.frames(), NUM_CHANNELS);
+
+        thunder.renderAudioInto(SAMPLE_RATE, raw);
+        pipeline.Run(raw.samples(), raw.buffer().size());
+
+        ConvolveInto(processed, raw, shortImpulse);
+        pipeline.Run(processed.samples(), processed.buffer().size());
+
+        convolver.renderInto(thunder, SAMPLE_RATE, processed, ConvolutionMethod::Sparse);
+        pipeline.Run(processed.samples(), processed.buffer().size());
+
+        convolver.renderInto(thunder, SAMPLE_RATE, processed, ConvolutionMethod::Dense);
+        pipeline.Run(processed.samples(), processed.buffer().size());
+
+        bank.renderInto(thunder, SAMPLE_RATE, processed, bankGains);
+        pipeline.Run(processed.samples(), processed.buffer().size());
+
+        streamer.streamRaw(thunder, SAMPLE_RATE, pipeline);
+        streamer.streamConvolved(thunder, SAMPLE_RATE, bank, bankGains, pipeline);
+
+        absorption.renderInto(thunder, SAMPLE_RATE, processed);
+        pipeline.Run(processed.samples(), processed.buffer().size());
+
+        flash.renderStroke(thunder, SAMPLE_RATE);
+        flash.renderInto(flashAudio, strokes, SAMPLE_RATE);
+        pipeline.Run(flashAudio);
+        flash.streamInto(pipeline, strokes, SAMPLE_RATE, thunder.peakBound(SAMPLE_RATE));
+
+        pool.release(std::move(processed));
+        pool.release(std::move(raw));
+    }
+};
+
+
+static bool EventProductionTest()
+{
+    // The first pass over a set of events grows every buffer to its full size.
+    // Producing the same events again must not allocate any memory at all.
+    const unsigned NUM_EVENTS = 4;
+    EventProducer producer;
+    for (unsigned seed = 1; seed <= NUM_EVENTS; ++seed)
+        producer.produce(seed);
+
+    RealTimeAudit::Reset();
+    {
+        // Not an audio thread, but audited the same way to count every allocation.
+        RealTimeAudit::AudioThreadScope scope("EventProduction");
+        for (unsigned seed = 1; seed <= NUM_EVENTS; ++seed)
+            producer.produce(seed);
+    }
+
+    long violations = RealTimeAudit::TotalCount();
+    bool ok = (violations == 0);
+    printf("EventProductionTest: %s (%ld violations)\n", ok ? "PASS" : "FAIL", violations);
+    if (violations != 0)
+        RealTimeAudit::PrintReport(stdout);
+    RealTimeAudit::Reset();
+    return ok;
+}
+
+
+int main()
+{
+    bool ok = SelfTest();
+    ok = PlaybackTest() && ok;
+    ok = PlaybackStressTest() && ok;
+    ok = MovingThunderTest() && ok;
+    ok = SegmentBvhReserveTest() && ok;
+    ok = EventProductionTest() && ok;
+    printf("rtaudit: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
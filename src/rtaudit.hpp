@@ -0,0 +1,109 @@
+#pragma once
+
+// rtaudit.hpp  -  Real-time safety audit for the audio thread.
+//
+// Code running on the audio thread must never allocate or free memory, or wait on a mutex,
+// because any of those can block for an unpredictable amount of time and cause audio dropouts.
+//
+// When compiled with -DTHUNDER_RT_AUDIT, the audit intercepts operator new/delete and their
+// aligned forms, malloc/calloc/realloc/free, memalign/aligned_alloc/posix_memalign,
+// and pthread mutex locking. Any of those that happen while the current thread is inside
+// an AudioThreadScope are counted, grouped by the innermost AuditTag, along with the call stack
+// of the first occurrence.
+//
+// Exactly one translation unit of the program must also include rtaudit_impl.hpp,
+// which provides the interceptors.
+//
+// Without THUNDER_RT_AUDIT, the scopes compile to nothing, so they can be left in production code.
+
+#include <cstddef>
+#include <cstdio>
+
+namespace Sapphire
+{
+    namespace RealTimeAudit
+    {
+        enum class Violation
+        {
+            Allocate,
+            Free,
+            Lock,
+        };
+
+        const int ViolationKinds = 3;
+
+        inline const char *ViolationName(Violation v)
+        {
+            switch (v)
+            {
+            case Violation::Allocate:   return "allocate";
+            case Violation::Free:       return "free";
+            case Violation::Lock:       return "lock";
+            default:                    return "unknown";
+            }
+        }
+
+#ifdef THUNDER_RT_AUDIT
+        // Implemented in rtaudit_impl.hpp.
+        void EnterAudioThread(const char *tag);
+        void LeaveAudioThread();
+        void PushTag(const char *tag);
+        void PopTag();
+        long Count(Violation v);
+        long TotalCount();
+        void Reset();
+        void PrintReport(FILE *outfile);
+
+        class AudioThreadScope
+        {
+        public:
+            explicit AudioThreadScope(const char *tag)
+            {
+                EnterAudioThread(tag);
+            }
+
+            ~AudioThreadScope()
+            {
+                LeaveAudioThread();
+            }
+
+            AudioThreadScope(const AudioThreadScope&) = delete;
+            AudioThreadScope& operator = (const AudioThreadScope&) = delete;
+        };
+
+        class AuditTag
+        {
+        public:
+            explicit AuditTag(const char *tag)
+            {
+                PushTag(tag);
+            }
+
+            ~AuditTag()
+            {
+                PopTag();
+            }
+
+            AuditTag(const AuditTag&) = delete;
+            AuditTag& operator = (const AuditTag&) = delete;
+        };
+#else
+        class AudioThreadScope
+        {
+        public:
+            explicit AudioThreadScope(const char *) {}
+        };
+
+        class AuditTag
+        {
+        public:
+            explicit AuditTag(const char *) {}
+        };
+
+        inline long Count(Violation) { return 0; }
+        inline long TotalCount() { return 0; }
+        inline void Reset() {}
+        inline void PrintReport(FILE *) {}
+#endif
+    }
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+// rtaudit_impl.hpp  -  Interceptors for the real-time safety audit described in rtaudit.hpp.
+// Include this header in exactly one translation unit of a program.
+// It has no effect unless the program is compiled with -DTHUNDER_RT_AUDIT.
+
+#include "rtaudit.hpp"
+
+#ifdef THUNDER_RT_AUDIT
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if !defined(__GLIBC__)
+    #error The real-time audit interceptors currently require glibc.
+#endif
+
+extern "C"
+{
+    void *__libc_malloc(size_t);
+    void *__libc_calloc(size_t, size_t);
+    void *__libc_realloc(void *, size_t);
+    void *__libc_memalign(size_t, size_t);
+    void __libc_free(void *);
+}
+
+namespace Sapphire
+{
+    namespace RealTimeAudit
+    {
+        namespace Internal
+        {
+            const int MaxTagDepth = 16;
+            const int MaxEntries = 64;
+            const int MaxStackFrames = 24;
+
+            struct Entry
+            {
+                std::atomic<const char *> tag;
+                std::atomic<long> count[ViolationKinds];
+                std::atomic<bool> stackCaptured[ViolationKinds];
+                void *stack[ViolationKinds][MaxStackFrames];
+                int stackDepth[ViolationKinds];
+            };
+
+            // Everything here is statically allocated, because the interceptors
+            // themselves must never allocate memory.
+            static Entry entries[MaxEntries];
+            static std::atomic<long> untaggedOverflow{0};
+
+            static thread_local int audioDepth = 0;
+            static thread_local int tagDepth = 0;
+            static thread_local const char *tagStack[MaxTagDepth];
+            static thread_local bool insideHook = false;
+
+            inline Entry *FindEntry(const char *tag)
+            {
+                for (Entry& e : entries)
+                {
+                    const char *existing = e.tag.load();
+                    if (existing == tag)
+                        return &e;
+
+                    if (existing == nullptr)
+                    {
+                        const char *expected = nullptr;
+                        if (e.tag.compare_exchange_strong(expected, tag) || expected == tag)
+                            return &e;
+                    }
+                }
+                return nullptr;
+            }
+
+            inline void Record(Violation v)
+            {
+                if (audioDepth == 0 || insideHook)
+                    return;
+
+                insideHook = true;
+                const char *tag = (tagDepth > 0) ? tagStack[std::min(tagDepth, MaxTagDepth) - 1] : "(untagged)";
+                Entry *e = FindEntry(tag);
+                if (e == nullptr)
+                {
+                    ++untaggedOverflow;
+                }
+                else
+                {
+                    const int k = static_cast<int>(v);
+                    if (e->count[k]++ == 0 && !e->stackCaptured[k].exchange(true))
+                        e->stackDepth[k] = backtrace(e->stack[k], MaxStackFrames);
+                }
+                insideHook = false;
+            }
+
+            struct Initializer
+            {
+                Initializer()
+                {
+                    // backtrace() may allocate the first time it is called, when it loads the unwinder.
+                    // Get that out of the way now, before any audio thread is running.
+                    void *frames[4];
+                    backtrace(frames, 4);
+                }
+            };
+
+            static Initializer initializer;
+
+            typedef int (*MutexFunc)(pthread_mutex_t *);
+
+            inline MutexFunc NextMutexFunc(const char *name)
+            {
+                bool saved = insideHook;
+                insideHook = true;      // dlsym may allocate
+                MutexFunc func = reinterpret_cast<MutexFunc>(dlsym(RTLD_NEXT, name));
+                insideHook = saved;
+                return func;
+            }
+        }
+
+        void EnterAudioThread(const char *tag)
+        {
+            ++Internal::audioDepth;
+            PushTag(tag);
+        }
+
+        void LeaveAudioThread()
+        {
+            PopTag();
+            --Internal::audioDepth;
+        }
+
+        void PushTag(const char *tag)
+        {
+            if (Internal::tagDepth < Internal::MaxTagDepth)
+                Internal::tagStack[Internal::tagDepth] = tag;
+            ++Internal::tagDepth;
+        }
+
+        void PopTag()
+        {
+            if (Internal::tagDepth > 0)
+                --Internal::tagDepth;
+        }
+
+        long Count(Violation v)
+        {
+            long total = 0;
+            for (const Internal::Entry& e : Internal::entries)
+                total += e.count[static_cast<int>(v)].load();
+            return total;
+        }
+
+        long TotalCount()
+        {
+            long total = Internal::untaggedOverflow.load();
+            for (int k = 0; k < ViolationKinds; ++k)
+                total += Count(static_cast<Violation>(k));
+            return total;
+        }
+
+        void Reset()
+        {
+            for (Internal::Entry& e : Internal::entries)
+            {
+                for (int k = 0; k < ViolationKinds; ++k)
+                {
+                    e.count[k] = 0;
+                    e.stackCaptured[k] = false;
+                    e.stackDepth[k] = 0;
+                }
+            }
+            Internal::untaggedOverflow = 0;
+        }
+
+        void PrintReport(FILE *outfile)
+        {
+            bool saved = Internal::insideHook;
+            Internal::insideHook = true;
+
+            fprintf(outfile, "Real-time audit report:\n");
+            bool any = false;
+            for (Internal::Entry& e : Internal::entries)
+            {
+                const char *tag = e.tag.load();
+                if (tag == nullptr)
+                    continue;
+
+                for (int k = 0; k < ViolationKinds; ++k)
+                {
+                    long n = e.count[k].load();
+                    if (n == 0)
+                        continue;
+
+                    any = true;
+                    fprintf(outfile, "    %-32s %-10s %ld\n", tag, ViolationName(static_cast<Violation>(k)), n);
+                    if (e.stackDepth[k] > 0)
+                    {
+                        fprintf(outfile, "        first occurrence:\n");
+                        fflush(outfile);
+                        backtrace_symbols_fd(e.stack[k], e.stackDepth[k], fileno(outfile));
+                    }
+                }
+            }
+
+            if (Internal::untaggedOverflow.load() > 0)
+            {
+                any = true;
+                fprintf(outfile, "    %ld violations had too many distinct tags to record.\n", Internal::untaggedOverflow.load());
+            }
+
+            if (!any)
+                fprintf(outfile, "    no violations.\n");
+
+            Internal::insideHook = saved;
+        }
+    }
+}
+
+
+// Interceptors for the C++ allocation operators.
+
+void *operator new(std::size_t size)
+{
+    Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+    bool saved = Sapphire::RealTimeAudit::Internal::insideHook;
+    Sapphire::RealTimeAudit::Internal::insideHook = true;      // do not count the malloc below a second time
+    void *p = __libc_malloc(size ? size : 1);
+    Sapphire::RealTimeAudit::Internal::insideHook = saved;
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+    return __libc_malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr)
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Free);
+    __libc_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+
+// Interceptors for the aligned allocation operators, which only exist when the compiler supports
+// aligned new (C++17, or -faligned-new, which the build passes for rtaudit).
+
+#ifdef __cpp_aligned_new
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+    void *p = __libc_memalign(static_cast<std::size_t>(alignment), size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+    return __libc_memalign(static_cast<std::size_t>(alignment), size ? size : 1);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, alignment, tag);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    operator delete(p);
+}
+#endif
+
+
+// Interceptors for the C allocation functions.
+
+extern "C"
+{
+    void *malloc(size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *p, size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        return __libc_realloc(p, size);
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **result, size_t alignment, size_t size) noexcept
+    {
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Allocate);
+        if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+        void *p = __libc_memalign(alignment, size);
+        if (p == nullptr)
+            return ENOMEM;
+        *result = p;
+        return 0;
+    }
+
+    void free(void *p) noexcept
+    {
+        if (p != nullptr)
+            Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Free);
+        __libc_free(p);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t *mutex) noexcept
+    {
+        static const Sapphire::RealTimeAudit::Internal::MutexFunc next = Sapphire::RealTimeAudit::Internal::NextMutexFunc("pthread_mutex_lock");
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Lock);
+        return next(mutex);
+    }
+
+    int pthread_mutex_trylock(pthread_mutex_t *mutex) noexcept
+    {
+        static const Sapphire::RealTimeAudit::Internal::MutexFunc next = Sapphire::RealTimeAudit::Internal::NextMutexFunc("pthread_mutex_trylock");
+        Sapphire::RealTimeAudit::Internal::Record(Sapphire::RealTimeAudit::Violation::Lock);
+        return next(mutex);
+    }
+}
+
+#endif  // THUNDER_RT_AUDIT
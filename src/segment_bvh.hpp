@@ -0,0 +1,485 @@
+#pragma once
+
+// segment_bvh.hpp  -  A bounding volume hierarchy over the segments of a lightning bolt.
+//
+// Build it once per bolt, after LightningBolt::generate, then use it for:
+//
+//     - occlusion: which segments each ear cannot see because an obstacle is in the way,
+//       so Thunder::start can attenuate or drop them
+//     - picking: which segment is nearest a point, or nearest a ray from the viewer's camera
+//
+// Every node holds an axis-aligned box around its segments. The tree is split at the median
+// along the longest axis of the segment midpoints, so building is O(n log n) and the depth is
+// about log2(n / LeafSize), even for bolts with millions of segments.
+//
+// A segment counts as hidden from an ear when the straight line from the ear to the
+// segment's midpoint passes through an obstacle. Every point hidden behind an obstacle
+// lies inside the cone from the ear that just encloses the obstacle's bounding sphere,
+// and no closer to the ear than the near side of that sphere, so whole subtrees outside
+// the cone are skipped without looking at their segments.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "lightning.hpp"
+
+namespace Sapphire
+{
+    // An axis-aligned box that blocks sound, such as a building or a block of terrain.
+    template <typename real_t = double>
+    struct BasicOccluder
+    {
+        BasicBoltPoint<real_t> low;
+        BasicBoltPoint<real_t> high;
+
+        BasicOccluder()
+            {}
+
+        BasicOccluder(const BasicBoltPoint<real_t>& _low, const BasicBoltPoint<real_t>& _high)
+            : low(_low)
+            , high(_high)
+            {}
+    };
+
+
+    template <typename real_t>
+    using BasicOccluderList = std::vector<BasicOccluder<real_t>>;
+
+    using Occluder = BasicOccluder<double>;
+    using OccluderList = BasicOccluderList<double>;
+
+
+    template <typename real_t = double>
+    class BasicSegmentBvh
+    {
+    private:
+        using point_t = BasicBoltPoint<real_t>;
+        using segment_t = BasicBoltSegment<real_t>;
+
+        struct Node
+        {
+            point_t low;
+            point_t high;
+            uint32_t first;     // a leaf's first position in `order`, or an interior node's second child; the first child is the next node
+            uint32_t count;     // the number of segments in a leaf, or 0 for an interior node
+        };
+
+        static const uint32_t LeafSize = 4;
+        static const int MaxDepth = 64;     // median splits keep the depth near log2(n), far below this
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> order;        // bolt segment indices, grouped by leaf
+        std::vector<segment_t> segs;        // the segments themselves in the same order, so leaves read contiguous memory
+        std::vector<point_t> centers;       // scratch memory for building: the midpoint of every segment
+
+        static real_t Coord(const point_t& p, int axis)
+        {
+            return (axis == 0) ? p.x : ((axis == 1) ? p.y : p.z);
+        }
+
+        static point_t Midpoint(const segment_t& s)
+        {
+            return point_t{(s.a.x + s.b.x)/2, (s.a.y + s.b.y)/2, (s.a.z + s.b.z)/2};
+        }
+
+        static void Include(point_t& low, point_t& high, const point_t& p)
+        {
+            low.x = std::min(low.x, p.x);
+            low.y = std::min(low.y, p.y);
+            low.z = std::min(low.z, p.z);
+            high.x = std::max(high.x, p.x);
+            high.y = std::max(high.y, p.y);
+            high.z = std::max(high.z, p.z);
+        }
+
+        static real_t Dot(const point_t& a, const point_t& b)
+        {
+            return a.x*b.x + a.y*b.y + a.z*b.z;
+        }
+
+        static point_t Difference(const point_t& a, const point_t& b)
+        {
+            return point_t{a.x - b.x, a.y - b.y, a.z - b.z};
+        }
+
+        static real_t BoxDistanceSquared(const point_t& p, const point_t& low, const point_t& high)
+        {
+            const real_t dx = std::max(std::max(low.x - p.x, p.x - high.x), static_cast<real_t>(0));
+            const real_t dy = std::max(std::max(low.y - p.y, p.y - high.y), static_cast<real_t>(0));
+            const real_t dz = std::max(std::max(low.z - p.z, p.z - high.z), static_cast<real_t>(0));
+            return dx*dx + dy*dy + dz*dz;
+        }
+
+        static real_t SegmentDistanceSquared(const point_t& p, const segment_t& s)
+        {
+            const point_t e = Difference(s.b, s.a);
+            const point_t w = Difference(p, s.a);
+            const real_t ee = Dot(e, e);
+            real_t u = (ee > 0) ? Dot(w, e) / ee : 0;
+            u = std::min(std::max(u, static_cast<real_t>(0)), static_cast<real_t>(1));
+            const point_t d{w.x - u*e.x, w.y - u*e.y, w.z - u*e.z};
+            return Dot(d, d);
+        }
+
+        static real_t RayDistanceSquared(const point_t& origin, const point_t& direction, const segment_t& s)
+        {
+            // The closest approach between the ray origin + t*direction (t >= 0)
+            // and the segment a + u*(b - a) (0 <= u <= 1).
+            const point_t e = Difference(s.b, s.a);
+            const point_t r = Difference(s.a, origin);
+            const real_t ee = Dot(e, e);
+            const real_t dd = Dot(direction, direction);
+            const real_t ed = Dot(e, direction);
+            const real_t er = Dot(e, r);
+            const real_t dr = Dot(direction, r);
+            const real_t zero = 0;
+            const real_t one = 1;
+
+            real_t u = 0;
+            real_t t;
+            if (ee > 0)
+            {
+                const real_t denom = ee*dd - ed*ed;
+                if (denom > 0)
+                    u = std::min(std::max((ed*dr - er*dd) / denom, zero), one);
+                t = (ed*u + dr) / dd;
+                if (t < 0)
+                {
+                    t = 0;
+                    u = std::min(std::max(-er / ee, zero), one);
+                }
+            }
+            else
+            {
+                t = std::max(dr / dd, zero);
+            }
+
+            const point_t d{r.x + u*e.x - t*direction.x, r.y + u*e.y - t*direction.y, r.z + u*e.z - t*direction.z};
+            return Dot(d, d);
+        }
+
+        static bool LineHitsBox(const point_t& origin, const point_t& direction, real_t tmin, real_t tmax, const point_t& low, const point_t& high)
+        {
+            // Slab test: does origin + t*direction pass through the box for some t in [tmin, tmax]?
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const real_t o = Coord(origin, axis);
+                const real_t d = Coord(direction, axis);
+                const real_t lo = Coord(low, axis);
+                const real_t hi = Coord(high, axis);
+                if (d == 0)
+                {
+                    if (o < lo || o > hi)
+                        return false;
+                }
+                else
+                {
+                    real_t t1 = (lo - o) / d;
+                    real_t t2 = (hi - o) / d;
+                    if (t1 > t2)
+                        std::swap(t1, t2);
+                    tmin = std::max(tmin, t1);
+                    tmax = std::min(tmax, t2);
+                    if (tmin > tmax)
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        static std::size_t NodeCount(std::size_t n)
+        {
+            // The exact number of nodes buildNode creates for `n` segments.
+            // Median splits divide every node into halves whose sizes differ by at most one,
+            // so each level of the tree has nodes of at most two sizes, `size` and `size + 1`.
+            if (n == 0)
+                return 0;
+
+            std::size_t total = 0;
+            std::size_t size = n;
+            std::size_t small = 1;      // nodes at this level with `size` segments
+            std::size_t large = 0;      // nodes at this level with `size + 1` segments
+            while (small + large > 0)
+            {
+                total += small + large;
+                std::size_t nextSmall = 0;
+                std::size_t nextLarge = 0;
+                if (size > LeafSize)
+                {
+                    nextSmall += small;
+                    ((size % 2 == 0) ? nextSmall : nextLarge) += small;
+                }
+                if (size + 1 > LeafSize)
+                {
+                    nextLarge += large;
+                    ((size % 2 == 0) ? nextSmall : nextLarge) += large;
+                }
+                size /= 2;
+                small = nextSmall;
+                large = nextLarge;
+            }
+            return total;
+        }
+
+        uint32_t buildNode(uint32_t begin, uint32_t end)
+        {
+            // `nodes` has enough capacity reserved that this never reallocates,
+            // but refer to the node by index anyway, because the recursion adds more nodes.
+            const uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node());
+
+            point_t low = centers[order[begin]];
+            point_t high = low;
+            point_t clow = low;
+            point_t chigh = low;
+            for (uint32_t k = begin; k < end; ++k)
+            {
+                const segment_t& s = segs[order[k]];
+                Include(low, high, s.a);
+                Include(low, high, s.b);
+                Include(clow, chigh, centers[order[k]]);
+            }
+            nodes[index].low = low;
+            nodes[index].high = high;
+
+            if (end - begin <= LeafSize)
+            {
+                nodes[index].first = begin;
+                nodes[index].count = end - begin;
+                return index;
+            }
+
+            // Split at the median of the segment midpoints along their longest extent.
+            const real_t ex = chigh.x - clow.x;
+            const real_t ey = chigh.y - clow.y;
+            const real_t ez = chigh.z - clow.z;
+            const int axis = (ex >= ey && ex >= ez) ? 0 : ((ey >= ez) ? 1 : 2);
+            const uint32_t middle = begin + (end - begin)/2;
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                [&](uint32_t a, uint32_t b) { return Coord(centers[a], axis) < Coord(centers[b], axis); });
+
+            buildNode(begin, middle);
+            const uint32_t second = buildNode(middle, end);
+            nodes[index].first = second;
+            nodes[index].count = 0;
+            return index;
+        }
+
+    public:
+        static const std::size_t npos = static_cast<std::size_t>(-1);
+
+        // Reserves all the memory needed for bolts of up to `maxSegments` segments,
+        // so that building the tree for them never allocates.
+        // Fewer segments never need more nodes, so one reservation covers every smaller bolt.
+        void reserve(std::size_t maxSegments)
+        {
+            nodes.reserve(NodeCount(maxSegments));
+            order.reserve(maxSegments);
+            segs.reserve(maxSegments);
+            centers.reserve(maxSegments);
+        }
+
+        template <typename bolt_real_t>
+        void build(const BasicLightningBolt<bolt_real_t>& bolt)
+        {
+            const BasicBoltSegmentList<bolt_real_t>& list = bolt.segments();
+            const std::size_t n = list.size();
+            if (n > static_cast<std::size_t>(std::numeric_limits<uint32_t>::max()))
+                throw std::range_error("Too many bolt segments for SegmentBvh.");
+
+            reserve(n);
+            nodes.clear();
+            order.resize(n);
+            segs.resize(n);
+            centers.resize(n);
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                segs[k] = segment_t{point_t(list[k].a), point_t(list[k].b)};
+                centers[k] = Midpoint(segs[k]);
+                order[k] = static_cast<uint32_t>(k);
+            }
+
+            if (n == 0)
+                return;
+
+            buildNode(0, static_cast<uint32_t>(n));
+
+            // Store the segments in leaf order, so queries read them sequentially.
+            for (std::size_t k = 0; k < n; ++k)
+                segs[k] = segment_t{point_t(list[order[k]].a), point_t(list[order[k]].b)};
+        }
+
+        std::size_t size() const
+        {
+            return segs.size();
+        }
+
+        // Fills `gain` with one value per bolt segment, in the bolt's order:
+        // `occludedGain` for a segment whose midpoint `ear` cannot see past the `occluders`, otherwise 1.
+        // Reuses the capacity of `gain`, so it does not allocate once `gain` is large enough.
+        void visibility(const point_t& ear, const BasicOccluderList<real_t>& occluders, real_t occludedGain, std::vector<real_t>& gain) const
+        {
+            gain.assign(segs.size(), 1);
+            if (nodes.empty())
+                return;
+
+            uint32_t stack[MaxDepth];
+            for (const BasicOccluder<real_t>& box : occluders)
+            {
+                // The cone from the ear around the obstacle's bounding sphere.
+                const point_t center{(box.low.x + box.high.x)/2, (box.low.y + box.high.y)/2, (box.low.z + box.high.z)/2};
+                const real_t radius = Distance(box.low, box.high) / 2;
+                const point_t axis = Difference(center, ear);
+                const real_t axisLength = std::sqrt(Dot(axis, axis));
+                const bool cone = (axisLength > radius);      // otherwise the ear is too close for the cone to rule anything out
+                const real_t coneAngle = cone ? std::asin(radius / axisLength) : 0;
+                const real_t nearest = axisLength - radius;
+
+                int depth = 0;
+                stack[depth++] = 0;
+                while (depth > 0)
+                {
+                    const Node& node = nodes[stack[--depth]];
+                    if (cone)
+                    {
+                        const point_t nodeCenter{(node.low.x + node.high.x)/2, (node.low.y + node.high.y)/2, (node.low.z + node.high.z)/2};
+                        const real_t nodeRadius = Distance(node.low, node.high) / 2;
+                        const point_t v = Difference(nodeCenter, ear);
+                        const real_t vLength = std::sqrt(Dot(v, v));
+
+                        // Skip nodes entirely in front of the obstacle.
+                        if (vLength + nodeRadius < nearest)
+                            continue;
+
+                        // Skip nodes whose bounding sphere lies entirely outside the cone.
+                        if (vLength > nodeRadius)
+                        {
+                            const real_t cosine = std::min(std::max(Dot(v, axis) / (vLength * axisLength), static_cast<real_t>(-1)), static_cast<real_t>(1));
+                            if (std::acos(cosine) - std::asin(nodeRadius / vLength) > coneAngle)
+                                continue;
+                        }
+                    }
+
+                    if (node.count == 0)
+                    {
+                        stack[depth++] = node.first;
+                        stack[depth++] = static_cast<uint32_t>(&node - nodes.data()) + 1;
+                        continue;
+                    }
+
+                    for (uint32_t k = node.first; k < node.first + node.count; ++k)
+                    {
+                        const uint32_t index = order[k];
+                        if (gain[index] != 1)
+                            continue;   // already hidden by another obstacle
+
+                        const point_t toMidpoint = Difference(Midpoint(segs[k]), ear);
+                        if (LineHitsBox(ear, toMidpoint, 0, 1, box.low, box.high))
+                            gain[index] = occludedGain;
+                    }
+                }
+            }
+        }
+
+        // Returns the index of the bolt segment nearest `point`, and its distance,
+        // or npos if the tree is empty.
+        std::size_t nearest(const point_t& point, real_t& distance) const
+        {
+            std::size_t best = npos;
+            real_t bestSquared = std::numeric_limits<real_t>::infinity();
+            if (!nodes.empty())
+            {
+                uint32_t stack[MaxDepth];
+                int depth = 0;
+                stack[depth++] = 0;
+                while (depth > 0)
+                {
+                    const uint32_t index = stack[--depth];
+                    const Node& node = nodes[index];
+                    if (BoxDistanceSquared(point, node.low, node.high) >= bestSquared)
+                        continue;
+
+                    if (node.count == 0)
+                    {
+                        // Visit the nearer child first, so its segments can rule out the farther one.
+                        const uint32_t a = index + 1;
+                        const uint32_t b = node.first;
+                        const bool aFirst = BoxDistanceSquared(point, nodes[a].low, nodes[a].high) <= BoxDistanceSquared(point, nodes[b].low, nodes[b].high);
+                        stack[depth++] = aFirst ? b : a;
+                        stack[depth++] = aFirst ? a : b;
+                        continue;
+                    }
+
+                    for (uint32_t k = node.first; k < node.first + node.count; ++k)
+                    {
+                        const real_t d2 = SegmentDistanceSquared(point, segs[k]);
+                        if (d2 < bestSquared)
+                        {
+                            bestSquared = d2;
+                            best = order[k];
+                        }
+                    }
+                }
+            }
+            distance = std::sqrt(bestSquared);
+            return best;
+        }
+
+        // Returns the index of the bolt segment that passes closest to the ray
+        // from `origin` in `direction`, considering only segments within `radius` of the ray,
+        // or npos if there are none. Used for picking a segment with the mouse.
+        std::size_t pick(const point_t& origin, const point_t& direction, real_t radius) const
+        {
+            if (!(Dot(direction, direction) > 0))
+                throw std::range_error("SegmentBvh::pick needs a nonzero ray direction.");
+
+            std::size_t best = npos;
+            real_t bestSquared = radius * radius;
+            real_t bestRadius = radius;
+            if (!nodes.empty() && radius >= 0)
+            {
+                const real_t infinity = std::numeric_limits<real_t>::infinity();
+                uint32_t stack[MaxDepth];
+                int depth = 0;
+                stack[depth++] = 0;
+                while (depth > 0)
+                {
+                    const uint32_t index = stack[--depth];
+                    const Node& node = nodes[index];
+
+                    // Any segment within `bestRadius` of the ray lies in a box around the node
+                    // widened by that much, so the ray must pass through the widened box.
+                    const point_t low{node.low.x - bestRadius, node.low.y - bestRadius, node.low.z - bestRadius};
+                    const point_t high{node.high.x + bestRadius, node.high.y + bestRadius, node.high.z + bestRadius};
+                    if (!LineHitsBox(origin, direction, 0, infinity, low, high))
+                        continue;
+
+                    if (node.count == 0)
+                    {
+                        stack[depth++] = node.first;
+                        stack[depth++] = index + 1;
+                        continue;
+                    }
+
+                    for (uint32_t k = node.first; k < node.first + node.count; ++k)
+                    {
+                        const real_t d2 = RayDistanceSquared(origin, direction, segs[k]);
+                        if (d2 <= bestSquared)
+                        {
+                            bestSquared = d2;
+                            bestRadius = std::sqrt(d2);
+                            best = order[k];
+                        }
+                    }
+                }
+            }
+            return best;
+        }
+    };
+
+    using SegmentBvh = BasicSegmentBvh<double>;
+}
@@ -0,0 +1,590 @@
+#pragma once
+
+// snapshot.hpp  -  Compact binary archive of lightning bolts and their thunder segment lists.
+//
+// File layout (all values are stored in the host's native byte order, checked by `endianMarker`):
+//
+//     SnapshotFileHeader
+//     record 0
+//     record 1
+//     ...
+//
+// Each record is 8-byte aligned and has the layout:
+//
+//     SnapshotRecordHeader
+//     int32_t[3] x pointCount          quantized points, each delta-encoded from the previous point
+//     uint32_t[2] x segmentCount       point indices of each segment (only when SNAPSHOT_FLAG_TOPOLOGY is set)
+//     padding to a multiple of 8 bytes
+//     earCount x {
+//         SnapshotEarHeader
+//         SnapshotDistancePair x segmentCount     sorted exactly as Thunder::start sorts them
+//         double x segmentCount                   segment gains (only when SNAPSHOT_FLAG_GAINS is set)
+//     }
+//
+// When a bolt is a single unbroken chain of segments, as LightningBolt::generate produces,
+// segment k runs from point k to point k+1 and no topology needs to be stored.
+// Gains are only stored when some segment is not at full strength, as after starting
+// the thunder with occlusion, so records without them have the same layout as version 1.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lightning.hpp"
+
+namespace Sapphire
+{
+    const uint32_t SNAPSHOT_VERSION = 2;
+    const uint32_t SNAPSHOT_ENDIAN_MARKER = 0x01020304;
+    const uint32_t SNAPSHOT_FLAG_TOPOLOGY = 1;
+    const uint32_t SNAPSHOT_FLAG_GAINS = 2;
+
+    struct SnapshotFileHeader
+    {
+        char signature[8];              // "THNDSNAP"
+        uint32_t version;
+        uint32_t endianMarker;
+        uint64_t reserved[2];
+    };
+
+    struct SnapshotRecordHeader
+    {
+        uint64_t recordBytes;           // total size of the record, including this header
+        uint32_t segmentCount;
+        uint32_t pointCount;
+        uint32_t earCount;
+        uint32_t flags;
+        double quantum;                 // meters per quantization step
+        double origin[3];               // the first point is quantized relative to this origin
+        double minDistance;             // Thunder::getMinDistance at the time of writing
+        double maxDistance;             // Thunder::getMaxDistance at the time of writing
+    };
+
+    struct SnapshotEarHeader
+    {
+        uint64_t segmentCount;
+        double position[3];
+    };
+
+    struct SnapshotDistancePair
+    {
+        double distance1;
+        double distance2;
+    };
+
+    static_assert(sizeof(SnapshotFileHeader) % 8 == 0, "Snapshot file header must be 8-byte aligned.");
+    static_assert(sizeof(SnapshotRecordHeader) % 8 == 0, "Snapshot record header must be 8-byte aligned.");
+    static_assert(sizeof(SnapshotEarHeader) % 8 == 0, "Snapshot ear header must be 8-byte aligned.");
+    static_assert(sizeof(SnapshotDistancePair) == 16, "Snapshot distance pairs must be tightly packed.");
+
+
+    inline std::size_t SnapshotPadding(std::size_t nbytes)
+    {
+        return (8 - (nbytes % 8)) % 8;
+    }
+
+
+    class SnapshotWriter
+    {
+    private:
+        FILE *outfile = nullptr;
+        double quantum;
+        std::vector<uint8_t> record;
+        std::vector<BoltPoint> points;
+        std::vector<uint32_t> topology;
+
+        template <typename value_t>
+        void append(const value_t& value)
+        {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+            record.insert(record.end(), bytes, bytes + sizeof(value_t));
+        }
+
+        int32_t quantize(double x) const
+        {
+            double q = std::round(x / quantum);
+            if (q < INT32_MIN || q > INT32_MAX)
+                throw std::range_error("Coordinate is out of range for snapshot quantization.");
+            return static_cast<int32_t>(q);
+        }
+
+        template <typename real_t>
+        void appendBolt(const BasicLightningBolt<real_t>& bolt, SnapshotRecordHeader& header)
+        {
+            // Collect unique points, sharing a point between consecutive segments whenever possible.
+            points.clear();
+            topology.clear();
+            bool chain = true;
+            for (const BasicBoltSegment<real_t>& seg : bolt.segments())
+            {
+                BoltPoint a(seg.a);
+                BoltPoint b(seg.b);
+                bool shared = !points.empty() && points.back().x == a.x && points.back().y == a.y && points.back().z == a.z;
+                if (!shared)
+                {
+                    chain = chain && points.empty();
+                    points.push_back(a);
+                }
+                topology.push_back(static_cast<uint32_t>(points.size() - 1));
+                points.push_back(b);
+                topology.push_back(static_cast<uint32_t>(points.size() - 1));
+            }
+
+            header.segmentCount = static_cast<uint32_t>(bolt.segments().size());
+            header.pointCount = static_cast<uint32_t>(points.size());
+            header.flags = chain ? 0 : SNAPSHOT_FLAG_TOPOLOGY;
+            header.quantum = quantum;
+            header.origin[0] = points.empty() ? 0.0 : points[0].x;
+            header.origin[1] = points.empty() ? 0.0 : points[0].y;
+            header.origin[2] = points.empty() ? 0.0 : points[0].z;
+
+            // Delta-encode the quantized points. We accumulate the quantized positions, not the
+            // original coordinates, so that roundoff errors do not build up along the chain.
+            int32_t prev[3] = {0, 0, 0};
+            for (const BoltPoint& p : points)
+            {
+                int32_t q[3] = {
+                    quantize(p.x - header.origin[0]),
+                    quantize(p.y - header.origin[1]),
+                    quantize(p.z - header.origin[2])
+                };
+                for (int k = 0; k < 3; ++k)
+                {
+                    append<int32_t>(q[k] - prev[k]);
+                    prev[k] = q[k];
+                }
+            }
+
+            if (!chain)
+                for (uint32_t index : topology)
+                    append(index);
+
+            record.resize(record.size() + SnapshotPadding(record.size()));
+        }
+
+        void writeRecord(SnapshotRecordHeader& header)
+        {
+            header.recordBytes = record.size();
+            std::memcpy(record.data(), &header, sizeof(header));
+            if (fwrite(record.data(), 1, record.size(), outfile) != record.size())
+                throw std::runtime_error("Cannot write record to snapshot file.");
+        }
+
+    public:
+        explicit SnapshotWriter(double _quantumMeters = 1.0e-3)
+            : quantum(_quantumMeters)
+        {
+            if (!(quantum > 0.0))
+                throw std::range_error("Snapshot quantum must be positive.");
+        }
+
+        ~SnapshotWriter()
+        {
+            Close();
+        }
+
+        void Close()
+        {
+            if (outfile != nullptr)
+            {
+                fclose(outfile);
+                outfile = nullptr;
+            }
+        }
+
+        bool Open(const char *filename, bool appendToExisting = true)
+        {
+            // Open a snapshot file for writing. By default, new records are appended to an
+            // existing file, so that a single archive can grow to hold any number of bolts.
+            // Returns false if the existing file is not a snapshot of this version and byte order,
+            // because the new records would be unreadable or would change the meaning of the file.
+            Close();
+
+            outfile = fopen(filename, appendToExisting ? "a+b" : "wb");
+            if (outfile == nullptr)
+                return false;
+
+            if (fseek(outfile, 0, SEEK_END) != 0)
+            {
+                Close();
+                return false;
+            }
+
+            if (ftell(outfile) != 0)
+            {
+                SnapshotFileHeader header{};
+                bool valid =
+                    fseek(outfile, 0, SEEK_SET) == 0 &&
+                    fread(&header, sizeof(header), 1, outfile) == 1 &&
+                    !memcmp(header.signature, "THNDSNAP", 8) &&
+                    header.version == SNAPSHOT_VERSION &&
+                    header.endianMarker == SNAPSHOT_ENDIAN_MARKER &&
+                    fseek(outfile, 0, SEEK_END) == 0;
+
+                if (!valid)
+                {
+                    Close();
+                    return false;
+                }
+            }
+            else
+            {
+                SnapshotFileHeader header{};
+                std::memcpy(header.signature, "THNDSNAP", 8);
+                header.version = SNAPSHOT_VERSION;
+                header.endianMarker = SNAPSHOT_ENDIAN_MARKER;
+                if (fwrite(&header, sizeof(header), 1, outfile) != 1)
+                {
+                    Close();
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        template <typename real_t>
+        void Write(const BasicLightningBolt<real_t>& bolt)
+        {
+            if (outfile == nullptr)
+                throw std::logic_error("SnapshotWriter is not open.");
+
+            SnapshotRecordHeader header{};
+            record.assign(sizeof(header), 0);
+            appendBolt(bolt, header);
+            writeRecord(header);
+        }
+
+        template <typename real_t>
+        void Write(const BasicLightningBolt<real_t>& bolt, const BasicThunder<real_t>& thunder)
+        {
+            if (outfile == nullptr)
+                throw std::logic_error("SnapshotWriter is not open.");
+
+            SnapshotRecordHeader header{};
+            record.assign(sizeof(header), 0);
+            appendBolt(bolt, header);
+
+            const std::size_t n = thunder.numEars();
+            header.earCount = static_cast<uint32_t>(n);
+            bool gains = false;
+            for (std::size_t i = 0; i < n; ++i)
+                for (const BasicThunderSegment<real_t>& ts : thunder.segments(i))
+                    gains = gains || (ts.gain != 1);
+            if (gains)
+                header.flags |= SNAPSHOT_FLAG_GAINS;
+
+            header.minDistance = thunder.getMinDistance();
+            header.maxDistance = thunder.getMaxDistance();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                SnapshotEarHeader ear{};
+                ear.segmentCount = thunder.segments(i).size();
+                ear.position[0] = thunder.ear(i).x;
+                ear.position[1] = thunder.ear(i).y;
+                ear.position[2] = thunder.ear(i).z;
+                append(ear);
+
+                for (const BasicThunderSegment<real_t>& ts : thunder.segments(i))
+                {
+                    SnapshotDistancePair pair;
+                    pair.distance1 = ts.distance1;
+                    pair.distance2 = ts.distance2;
+                    append(pair);
+                }
+
+                if (gains)
+                    for (const BasicThunderSegment<real_t>& ts : thunder.segments(i))
+                        append(static_cast<double>(ts.gain));
+            }
+
+            writeRecord(header);
+        }
+    };
+
+
+    // A zero-copy view of one ear's distance list inside a memory-mapped snapshot.
+    struct SnapshotEarView
+    {
+        BoltPoint position;
+        std::size_t segmentCount = 0;
+        const SnapshotDistancePair *distances = nullptr;
+        const double *gains = nullptr;      // null when every segment has full gain
+    };
+
+
+    class SnapshotReader
+    {
+    private:
+        int fd = -1;
+        const uint8_t *base = nullptr;
+        std::size_t length = 0;
+        std::vector<std::size_t> recordOffsets;
+
+        const SnapshotRecordHeader& header(std::size_t index) const
+        {
+            return *reinterpret_cast<const SnapshotRecordHeader *>(base + recordOffsets.at(index));
+        }
+
+        bool validRecord(std::size_t offset) const
+        {
+            // Checks that every count in the record agrees with the record's size,
+            // so that nothing read from the record later can run past its end.
+            const SnapshotRecordHeader& h = *reinterpret_cast<const SnapshotRecordHeader *>(base + offset);
+            const bool chain = !(h.flags & SNAPSHOT_FLAG_TOPOLOGY);
+            if (chain && h.pointCount != ((h.segmentCount == 0) ? 0 : static_cast<uint64_t>(h.segmentCount) + 1))
+                return false;   // a chain of n segments has n+1 points
+
+            uint64_t nbytes = sizeof(SnapshotRecordHeader) + static_cast<uint64_t>(3*sizeof(int32_t)) * h.pointCount;
+            if (!chain)
+                nbytes += static_cast<uint64_t>(2*sizeof(uint32_t)) * h.segmentCount;
+            nbytes += SnapshotPadding(nbytes);
+
+            const uint64_t segmentBytes = sizeof(SnapshotDistancePair) + ((h.flags & SNAPSHOT_FLAG_GAINS) ? sizeof(double) : 0);
+            for (uint32_t i = 0; i < h.earCount; ++i)
+            {
+                if (nbytes + sizeof(SnapshotEarHeader) > h.recordBytes)
+                    return false;
+
+                const SnapshotEarHeader *eh = reinterpret_cast<const SnapshotEarHeader *>(base + offset + nbytes);
+                if (eh->segmentCount > h.segmentCount)
+                    return false;   // an ear cannot hear more segments than the bolt has
+
+                nbytes += sizeof(SnapshotEarHeader) + segmentBytes * eh->segmentCount;
+            }
+            return nbytes <= h.recordBytes;
+        }
+
+        std::size_t earOffset(std::size_t index) const
+        {
+            const SnapshotRecordHeader& h = header(index);
+            std::size_t nbytes = sizeof(SnapshotRecordHeader) + 3*sizeof(int32_t)*h.pointCount;
+            if (h.flags & SNAPSHOT_FLAG_TOPOLOGY)
+                nbytes += 2*sizeof(uint32_t)*h.segmentCount;
+            nbytes += SnapshotPadding(nbytes);
+            return recordOffsets.at(index) + nbytes;
+        }
+
+    public:
+        ~SnapshotReader()
+        {
+            Close();
+        }
+
+        void Close()
+        {
+            if (base != nullptr)
+            {
+                munmap(const_cast<uint8_t *>(base), length);
+                base = nullptr;
+            }
+
+            if (fd >= 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+
+            length = 0;
+            recordOffsets.clear();
+        }
+
+        bool Open(const char *filename)
+        {
+            Close();
+
+            fd = open(filename, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(SnapshotFileHeader))
+            {
+                Close();
+                return false;
+            }
+
+            length = static_cast<std::size_t>(info.st_size);
+            void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                length = 0;
+                Close();
+                return false;
+            }
+            base = static_cast<const uint8_t *>(map);
+
+            const SnapshotFileHeader *fh = reinterpret_cast<const SnapshotFileHeader *>(base);
+            if (memcmp(fh->signature, "THNDSNAP", 8) || fh->version < 1 || fh->version > SNAPSHOT_VERSION || fh->endianMarker != SNAPSHOT_ENDIAN_MARKER)
+            {
+                Close();
+                return false;
+            }
+
+            // Index the records by walking their sizes, checking each record's layout once,
+            // so later reads can trust the counts. This touches only the record and ear headers.
+            std::size_t offset = sizeof(SnapshotFileHeader);
+            while (offset + sizeof(SnapshotRecordHeader) <= length)
+            {
+                const SnapshotRecordHeader *rh = reinterpret_cast<const SnapshotRecordHeader *>(base + offset);
+                if (rh->recordBytes < sizeof(SnapshotRecordHeader) || rh->recordBytes % 8 != 0 || rh->recordBytes > length - offset || !validRecord(offset))
+                    break;  // truncated or corrupt record: keep the valid records before it
+                recordOffsets.push_back(offset);
+                offset += rh->recordBytes;
+            }
+
+            return true;
+        }
+
+        std::size_t size() const
+        {
+            return recordOffsets.size();
+        }
+
+        std::size_t segmentCount(std::size_t index) const
+        {
+            return header(index).segmentCount;
+        }
+
+        std::size_t earCount(std::size_t index) const
+        {
+            return header(index).earCount;
+        }
+
+        SnapshotEarView ear(std::size_t index, std::size_t earIndex) const
+        {
+            const SnapshotRecordHeader& h = header(index);
+            if (earIndex >= h.earCount)
+                throw std::range_error("Snapshot ear index is out of range.");
+
+            const bool gains = (h.flags & SNAPSHOT_FLAG_GAINS) != 0;
+            std::size_t offset = earOffset(index);
+            for (std::size_t i = 0; ; ++i)
+            {
+                const SnapshotEarHeader *eh = reinterpret_cast<const SnapshotEarHeader *>(base + offset);
+                offset += sizeof(SnapshotEarHeader);
+                if (i == earIndex)
+                {
+                    SnapshotEarView view;
+                    view.position = BoltPoint{eh->position[0], eh->position[1], eh->position[2]};
+                    view.segmentCount = eh->segmentCount;
+                    view.distances = reinterpret_cast<const SnapshotDistancePair *>(base + offset);
+                    if (gains)
+                        view.gains = reinterpret_cast<const double *>(base + offset + sizeof(SnapshotDistancePair) * eh->segmentCount);
+                    return view;
+                }
+                offset += sizeof(SnapshotDistancePair) * eh->segmentCount;
+                if (gains)
+                    offset += sizeof(double) * eh->segmentCount;
+            }
+        }
+
+        BoltPointList ears(std::size_t index) const
+        {
+            BoltPointList list;
+            const std::size_t n = earCount(index);
+            for (std::size_t i = 0; i < n; ++i)
+                list.push_back(ear(index, i).position);
+            return list;
+        }
+
+        template <typename real_t>
+        void LoadBolt(std::size_t index, BasicLightningBolt<real_t>& bolt) const
+        {
+            using point_t = BasicBoltPoint<real_t>;
+
+            const SnapshotRecordHeader& h = header(index);
+            if (h.segmentCount > bolt.getMaxSegments())
+                throw std::range_error("Snapshot bolt has too many segments for this LightningBolt object.");
+
+            const int32_t *delta = reinterpret_cast<const int32_t *>(base + recordOffsets[index] + sizeof(SnapshotRecordHeader));
+            const uint32_t *topology = reinterpret_cast<const uint32_t *>(delta + 3*h.pointCount);
+            const bool chain = !(h.flags & SNAPSHOT_FLAG_TOPOLOGY);
+
+            // Decode the points as we go. A chain needs only the previous point,
+            // but explicit topology can refer to any point, so we decode those up front.
+            std::vector<point_t> decoded;
+            if (!chain)
+                decoded.reserve(h.pointCount);
+
+            bolt.clear();
+            int64_t q[3] = {0, 0, 0};
+            point_t prev;
+            for (uint32_t p = 0; p < h.pointCount; ++p)
+            {
+                for (int k = 0; k < 3; ++k)
+                    q[k] += delta[3*p + k];
+
+                point_t point(
+                    static_cast<real_t>(h.origin[0] + q[0]*h.quantum),
+                    static_cast<real_t>(h.origin[1] + q[1]*h.quantum),
+                    static_cast<real_t>(h.origin[2] + q[2]*h.quantum)
+                );
+
+                if (chain)
+                {
+                    if (p > 0)
+                        bolt.addSegment(BasicBoltSegment<real_t>{prev, point});
+                    prev = point;
+                }
+                else
+                {
+                    decoded.push_back(point);
+                }
+            }
+
+            if (!chain)
+            {
+                for (uint32_t s = 0; s < h.segmentCount; ++s)
+                {
+                    uint32_t a = topology[2*s];
+                    uint32_t b = topology[2*s + 1];
+                    if (a >= h.pointCount || b >= h.pointCount)
+                        throw std::range_error("Snapshot topology refers to a nonexistent point.");
+                    bolt.addSegment(BasicBoltSegment<real_t>{decoded[a], decoded[b]});
+                }
+            }
+        }
+
+        template <typename real_t>
+        void LoadThunder(std::size_t index, BasicThunder<real_t>& thunder) const
+        {
+            // The distance lists are stored exactly, so the reconstructed thunder
+            // renders identically to the original, regardless of point quantization.
+            // They are only valid for the ears they were measured from.
+            const std::size_t n = earCount(index);
+            if (n != thunder.numEars())
+                throw std::range_error("Snapshot has a different number of ears than this Thunder object.");
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                const BoltPoint p = ear(index, i).position;
+                const BasicBoltPoint<real_t>& q = thunder.ear(i);
+                if (static_cast<real_t>(p.x) != q.x || static_cast<real_t>(p.y) != q.y || static_cast<real_t>(p.z) != q.z)
+                    throw std::range_error("Snapshot ears are in different places than this Thunder object's ears.");
+            }
+
+            thunder.beginRestore();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                SnapshotEarView view = ear(index, i);
+                for (std::size_t k = 0; k < view.segmentCount; ++k)
+                {
+                    BasicThunderSegment<real_t> ts;
+                    ts.distance1 = static_cast<real_t>(view.distances[k].distance1);
+                    ts.distance2 = static_cast<real_t>(view.distances[k].distance2);
+                    if (view.gains != nullptr)
+                        ts.gain = static_cast<real_t>(view.gains[k]);
+                    thunder.restoreSegment(i, ts);
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+// sparse_convolution.hpp  -  Convolves thunder with an impulse response directly from
+// the ThunderSegment lists, without rasterizing the thunder first.
+//
+// The raw thunder rendered by Thunder::renderAudio is piecewise linear: each segment
+// contributes a straight ramp from amp1 at frame f1 to amp2 just before frame f2.
+// The second difference of such a ramp is zero everywhere except at four frames:
+//
+//     f1      a1
+//     f1+1    m - a1
+//     f2      -a2
+//     f2+1    a2 - m           where m = (a2 - a1) / (f2 - f1)
+//
+// So if G2 is the impulse response summed twice (a discrete double integral),
+// the convolution of the thunder with the impulse response is the sum of four
+// scaled, shifted copies of G2 per segment. Past the end of the impulse response,
+// G2 grows linearly, and because the four weights and their first moment both sum
+// to zero, each segment's contribution vanishes beyond f2 + (IR length).
+// The cost per segment is therefore proportional to (f2 - f1) + (IR length),
+// rather than (f2 - f1) * (IR length) for direct convolution.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "lightning.hpp"
+#include "convolution.hpp"
+
+namespace Sapphire
+{
+    enum class ConvolutionMethod
+    {
+        Automatic,      // pick whichever of the other methods has the lower estimated cost
+        Sparse,         // sum shifted copies of the doubly integrated impulse response
+        Dense,          // rasterize the thunder and convolve it using FFTs
+    };
+
+
+    class ThunderConvolver
+    {
+    private:
+        AudioBuffer impulse;
+        std::vector<std::vector<double>> integrated;    // G2 for each impulse response channel, extended as needed
+        std::vector<double> impulseSum;                 // slope of G2 past the end of the impulse response
+        std::vector<double> accum;
+        AudioBuffer raw;                                // rasterized thunder for the dense method
+        FftWorkspace workspace;
+        ConvolutionMethod lastMethod = ConvolutionMethod::Automatic;
+
+        void extendIntegrated(std::size_t length)
+        {
+            // G2 is linear beyond the impulse response, so extending it is trivial.
+            for (std::size_t c = 0; c < integrated.size(); ++c)
+            {
+                std::vector<double>& g2 = integrated[c];
+                while (g2.size() < length)
+                    g2.push_back(g2.back() + impulseSum[c]);
+            }
+        }
+
+        template <typename real_t>
+        static void SegmentFrames(const BasicThunderSegment<real_t>& s, real_t minDistance, int sampleRateHz, int& f1, int& f2)
+        {
+            // Exactly the same frame snapping as Thunder::renderAudio.
+            const real_t speed = static_cast<real_t>(SPEED_OF_SOUND_IN_AIR);
+            real_t t1 = (s.distance1 - minDistance) / speed;
+            real_t t2 = (s.distance2 - minDistance) / speed;
+            f1 = static_cast<int>(std::round(t1 * sampleRateHz));
+            f2 = static_cast<int>(std::round(t2 * sampleRateHz));
+        }
+
+        int impulseChannelFor(int channel, int nchannels) const
+        {
+            const int ic = impulse.channels();
+            if (ic == 1)
+                return 0;
+            if (ic == nchannels)
+                return channel;
+            throw std::range_error("The impulse response has an incompatible number of channels for this thunder.");
+        }
+
+    public:
+        explicit ThunderConvolver(const AudioBuffer& _impulse)
+            : impulse(_impulse)
+            , integrated(static_cast<std::size_t>(_impulse.channels()))
+            , impulseSum(static_cast<std::size_t>(_impulse.channels()))
+        {
+            // Precompute G2 over the length of the impulse response, once.
+            const int m = impulse.frames();
+            for (int c = 0; c < impulse.channels(); ++c)
+            {
+                std::vector<double>& g2 = integrated[c];
+                g2.reserve(static_cast<std::size_t>(m) + 1);
+                double g1 = 0.0;
+                double sum = 0.0;
+                for (int k = 0; k < m; ++k)
+                {
+                    g1 += impulse.get(c, k);
+                    sum += g1;
+                    g2.push_back(sum);
+                }
+                impulseSum[c] = g1;
+                if (g2.empty())
+                    g2.push_back(0.0);
+            }
+        }
+
+        const AudioBuffer& impulseResponse() const
+        {
+            return impulse;
+        }
+
+        ConvolutionMethod lastMethodUsed() const
+        {
+            return lastMethod;
+        }
+
+        template <typename real_t>
+        double sparseCost(const BasicThunder<real_t>& thunder, int sampleRateHz) const
+        {
+            // Four shifted copies of G2 per segment, each as long as the segment plus the impulse response.
+            const double m = impulse.frames();
+            const real_t minDistance = thunder.getMinDistance();
+            double cost = 0.0;
+            for (std::size_t c = 0; c < thunder.numEars(); ++c)
+            {
+                for (const BasicThunderSegment<real_t>& s : thunder.segments(c))
+                {
+                    int f1, f2;
+                    SegmentFrames(s, minDistance, sampleRateHz, f1, f2);
+                    if (f2 > f1)
+                        cost += 4.0 * ((f2 - f1) + m);
+                }
+            }
+            return cost;
+        }
+
+        template <typename real_t>
+        double denseCost(const BasicThunder<real_t>& thunder, int sampleRateHz) const
+        {
+            // Rasterization, then per channel three FFTs plus a spectrum multiply.
+            // Each complex radix-2 butterfly is counted as about 5 operations per point per stage.
+            const double frames = thunder.durationFrames(sampleRateHz);
+            const double n = static_cast<double>(NextPowerOfTwo(static_cast<std::size_t>(frames + impulse.frames())));
+            const double fftCost = 5.0 * n * std::log2(std::max(2.0, n));
+            const double channels = static_cast<double>(thunder.numEars());
+            return channels * (3.0*fftCost + 6.0*n + 2.0*frames);
+        }
+
+        template <typename real_t>
+        AudioBuffer renderSparse(const BasicThunder<real_t>& thunder, int sampleRateHz)
+        {
+            AudioBuffer y;
+            renderSparseInto(thunder, sampleRateHz, y);
+            return y;
+        }
+
+        template <typename real_t>
+        void renderSparseInto(const BasicThunder<real_t>& thunder, int sampleRateHz, AudioBuffer& y)
+        {
+            lastMethod = ConvolutionMethod::Sparse;
+
+            const int nchannels = static_cast<int>(thunder.numEars());
+            const int frames = thunder.durationFrames(sampleRateHz);
+            const int m = impulse.frames();
+            y.reset(frames + m, nchannels, thunder.startFrame(sampleRateHz) + impulse.startFrame());
+            if (frames == 0)
+                return;
+
+            extendIntegrated(static_cast<std::size_t>(frames + m) + 2);
+            const real_t minDistance = thunder.getMinDistance();
+            const int yframes = y.frames();
+
+            for (int c = 0; c < nchannels; ++c)
+            {
+                const std::vector<double>& g2 = integrated[impulseChannelFor(c, nchannels)];
+                accum.assign(static_cast<std::size_t>(yframes), 0.0);
+
+                for (const BasicThunderSegment<real_t>& s : thunder.segments(c))
+                {
+                    int f1, f2;
+                    SegmentFrames(s, minDistance, sampleRateHz, f1, f2);
+                    if (f2 <= f1)
+                        continue;
+
+                    const double a1 = static_cast<double>(s.gain) / (static_cast<double>(s.distance1) * s.distance1);
+                    const double a2 = static_cast<double>(s.gain) / (static_cast<double>(s.distance2) * s.distance2);
+                    const double slope = (a2 - a1) / (f2 - f1);
+
+                    const int position[4] = { f1, f1 + 1, f2, f2 + 1 };
+                    const double weight[4] = { a1, slope - a1, -a2, a2 - slope };
+                    const int stop = std::min(yframes, f2 + m);
+
+                    for (int j = 0; j < 4; ++j)
+                    {
+                        const int p = position[j];
+                        if (p < stop)
+                            Kernels::Accumulate(accum.data() + p, g2.data(), weight[j], static_cast<std::size_t>(stop - p));
+                    }
+                }
+
+                for (int n = 0; n < yframes; ++n)
+                    y.at(c, n) = static_cast<float>(accum[n]);
+            }
+        }
+
+        template <typename real_t>
+        AudioBuffer renderDense(const BasicThunder<real_t>& thunder, int sampleRateHz)
+        {
+            AudioBuffer y;
+            renderDenseInto(thunder, sampleRateHz, y);
+            return y;
+        }
+
+        template <typename real_t>
+        void renderDenseInto(const BasicThunder<real_t>& thunder, int sampleRateHz, AudioBuffer& y)
+        {
+            lastMethod = ConvolutionMethod::Dense;
+            if (impulse.channels() != 1 && impulse.channels() != static_cast<int>(thunder.numEars()))
+                throw std::range_error("The impulse response has an incompatible number of channels for this thunder.");
+            thunder.renderAudioInto(sampleRateHz, raw);
+            FftConvolveInto(y, raw, impulse, workspace);
+        }
+
+        template <typename real_t>
+        AudioBuffer render(const BasicThunder<real_t>& thunder, int sampleRateHz, ConvolutionMethod method = ConvolutionMethod::Automatic)
+        {
+            // Returns the same result as Convolution(thunder.renderAudio(sampleRateHz), impulse),
+            // up to roundoff error, using whichever method is expected to be faster.
+            AudioBuffer y;
+            renderInto(thunder, sampleRateHz, y, method);
+            return y;
+        }
+
+        template <typename real_t>
+        void renderInto(const BasicThunder<real_t>& thunder, int sampleRateHz, AudioBuffer& y, ConvolutionMethod method = ConvolutionMethod::Automatic)
+        {
+            // Same as render, but reuses the memory already owned by `y`, and by this object,
+            // so repeated events stop allocating memory once the buffers have grown to full size.
+            if (method == ConvolutionMethod::Automatic)
+                method = (sparseCost(thunder, sampleRateHz) <= denseCost(thunder, sampleRateHz)) ? ConvolutionMethod::Sparse : ConvolutionMethod::Dense;
+
+            if (method == ConvolutionMethod::Sparse)
+                renderSparseInto(thunder, sampleRateHz, y);
+            else
+                renderDenseInto(thunder, sampleRateHz, y);
+        }
+    };
+}
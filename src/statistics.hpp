@@ -0,0 +1,201 @@
+#pragma once
+
+// statistics.hpp  -  Summary metrics of rendered thunder events,
+// and histograms for aggregating them over many random bolts.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+#include "lightning.hpp"
+#include "fft.hpp"
+
+namespace Sapphire
+{
+    struct ThunderMetrics
+    {
+        double firstArrivalSeconds = 0.0;       // time from the flash until the first sound reaches either ear
+        double durationSeconds = 0.0;           // time from the first sound to the last, over all ears
+        double peak = 0.0;                      // largest absolute sample value over all channels
+        double rms = 0.0;                       // root-mean-square sample value over all channels
+        double envelopePeakSeconds = 0.0;       // time after the first arrival when the RMS envelope is loudest
+        double spectralCentroidHz = 0.0;        // power-weighted mean frequency of the channel mix
+        double arrivalDifferenceSeconds = 0.0;  // first arrival at ear 1 minus first arrival at ear 0
+        double levelDifferenceDb = 0.0;         // RMS level of ear 1 relative to ear 0
+        double segments = 0.0;                  // number of bolt segments heard by each ear
+        std::vector<double> envelope;           // RMS of the channel mix in consecutive windows
+    };
+
+
+    class ThunderAnalyzer
+    {
+    private:
+        const int sampleRateHz;
+        const int envelopeWindowFrames;
+        FourierTransform<double> fft;
+        std::vector<std::complex<double>> spectrumBuffer;
+        std::vector<double> powerSum;
+        std::vector<double> window;
+
+        double spectralCentroid(const AudioBuffer& audio)
+        {
+            // Average the power spectrum of the channel mix over consecutive Hann-windowed blocks.
+            // This costs far less than one huge FFT, and the centroid does not need fine resolution.
+            const std::size_t n = fft.size();
+            const int nchannels = audio.channels();
+            const int nframes = audio.frames();
+            std::fill(powerSum.begin(), powerSum.end(), 0.0);
+
+            for (int start = 0; start < nframes; start += static_cast<int>(n))
+            {
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    const int f = start + static_cast<int>(i);
+                    double sum = 0.0;
+                    if (f < nframes)
+                        for (int c = 0; c < nchannels; ++c)
+                            sum += audio.get(c, f);
+                    spectrumBuffer[i] = std::complex<double>(window[i] * sum, 0.0);
+                }
+
+                fft.forward(spectrumBuffer.data());
+
+                for (std::size_t k = 0; k <= n/2; ++k)
+                    powerSum[k] += std::norm(spectrumBuffer[k]);
+            }
+
+            double weighted = 0.0;
+            double total = 0.0;
+            for (std::size_t k = 0; k <= n/2; ++k)
+            {
+                double hz = static_cast<double>(k) * sampleRateHz / n;
+                weighted += hz * powerSum[k];
+                total += powerSum[k];
+            }
+            return (total > 0.0) ? (weighted / total) : 0.0;
+        }
+
+    public:
+        ThunderAnalyzer(int _sampleRateHz, double envelopeWindowSeconds = 0.05, std::size_t spectrumSize = 4096)
+            : sampleRateHz(_sampleRateHz)
+            , envelopeWindowFrames(std::max(1, static_cast<int>(std::round(envelopeWindowSeconds * _sampleRateHz))))
+            , fft(spectrumSize)
+            , spectrumBuffer(spectrumSize)
+            , powerSum(spectrumSize/2 + 1)
+            , window(spectrumSize)
+        {
+            for (std::size_t i = 0; i < spectrumSize; ++i)
+                window[i] = 0.5 - 0.5*std::cos(2.0 * M_PI * i / spectrumSize);
+        }
+
+        double envelopeWindowSeconds() const
+        {
+            return static_cast<double>(envelopeWindowFrames) / sampleRateHz;
+        }
+
+        template <typename real_t>
+        void analyze(const BasicThunder<real_t>& thunder, const AudioBuffer& audio, ThunderMetrics& metrics)
+        {
+            // Calculate all the metrics for one event, reusing the memory in `metrics.envelope`.
+            const double speed = SPEED_OF_SOUND_IN_AIR;
+            metrics.firstArrivalSeconds = thunder.getMinDistance() / speed;
+            metrics.durationSeconds = (thunder.getMaxDistance() - thunder.getMinDistance()) / speed;
+            metrics.segments = (thunder.numEars() > 0) ? static_cast<double>(thunder.segments(0).size()) : 0.0;
+
+            // Each ear's segment list is sorted by closer distance, so its first arrival is at the front.
+            const std::size_t nears = thunder.numEars();
+            if (nears >= 2 && !thunder.segments(0).empty() && !thunder.segments(1).empty())
+                metrics.arrivalDifferenceSeconds = (thunder.segments(1).front().distance1 - thunder.segments(0).front().distance1) / speed;
+            else
+                metrics.arrivalDifferenceSeconds = 0.0;
+
+            const int nchannels = audio.channels();
+            const int nframes = audio.frames();
+            std::vector<double> channelSquares(static_cast<std::size_t>(nchannels));
+            double peak = 0.0;
+            double sumSquares = 0.0;
+            double windowSquares = 0.0;
+            double loudest = -1.0;
+            int windowCount = 0;
+
+            metrics.envelope.clear();
+            metrics.envelopePeakSeconds = 0.0;
+            for (int f = 0; f < nframes; ++f)
+            {
+                double mix = 0.0;
+                for (int c = 0; c < nchannels; ++c)
+                {
+                    double x = audio.get(c, f);
+                    peak = std::max(peak, std::abs(x));
+                    channelSquares[c] += x*x;
+                    sumSquares += x*x;
+                    mix += x;
+                }
+
+                windowSquares += mix*mix;
+                if (++windowCount == envelopeWindowFrames || f+1 == nframes)
+                {
+                    double level = std::sqrt(windowSquares / windowCount);
+                    if (level > loudest)
+                    {
+                        loudest = level;
+                        metrics.envelopePeakSeconds = static_cast<double>(metrics.envelope.size()) * envelopeWindowSeconds();
+                    }
+                    metrics.envelope.push_back(level);
+                    windowSquares = 0.0;
+                    windowCount = 0;
+                }
+            }
+
+            metrics.peak = peak;
+            metrics.rms = (nframes > 0) ? std::sqrt(sumSquares / (static_cast<double>(nframes) * nchannels)) : 0.0;
+
+            if (nchannels >= 2 && channelSquares[0] > 0.0 && channelSquares[1] > 0.0)
+                metrics.levelDifferenceDb = 10.0 * std::log10(channelSquares[1] / channelSquares[0]);
+            else
+                metrics.levelDifferenceDb = 0.0;
+
+            metrics.spectralCentroidHz = spectralCentroid(audio);
+        }
+    };
+
+
+    class Histogram
+    {
+    private:
+        double lo;
+        double hi;
+        std::vector<long> counts;
+        long underflow = 0;
+        long overflow = 0;
+
+    public:
+        Histogram(double _lo, double _hi, int _bins)
+            : lo(_lo)
+            , hi(_hi)
+            , counts(static_cast<std::size_t>(std::max(1, _bins)))
+        {
+            if (!(lo < hi))
+                throw std::range_error("Histogram range must be non-empty.");
+        }
+
+        void add(double x)
+        {
+            if (x < lo)
+                ++underflow;
+            else if (x >= hi)
+                ++overflow;
+            else
+                ++counts[static_cast<std::size_t>((x - lo) / (hi - lo) * counts.size())];
+        }
+
+        int bins() const { return static_cast<int>(counts.size()); }
+        double lowerBound() const { return lo; }
+        double upperBound() const { return hi; }
+        double binWidth() const { return (hi - lo) / counts.size(); }
+        long count(int bin) const { return counts.at(bin); }
+        long underflowCount() const { return underflow; }
+        long overflowCount() const { return overflow; }
+    };
+}
@@ -0,0 +1,309 @@
+/*
+    MIT License
+
+    Copyright (c) 2023 Don Cross <cosinekitty@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// stats.cpp  -  Monte Carlo analysis of thunder characteristics.
+// Generates many seeded random bolts in parallel, measures each resulting
+// thunder event without writing any audio, then writes per-event metrics
+// as CSV and aggregated histograms as JSON.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lightning.hpp"
+#include "statistics.hpp"
+
+const int SAMPLE_RATE = 44100;
+
+static const Sapphire::BoltPointList Listener
+{
+    Sapphire::BoltPoint{2500.0, +0.1, 0.0},
+    Sapphire::BoltPoint{2500.0, -0.1, 0.0}
+};
+
+
+struct StatsOptions
+{
+    int events = 10000;
+    int threads = 0;            // 0 = use all cores
+    unsigned seed = 1;          // std::default_random_engine treats seeds 0 and 1 the same, so start at 1
+    std::size_t segments = 2000;
+    double heightMeters = 3000.0;
+    double radiusMeters = 1000.0;
+    double jaggedness = 1.0;
+    double toleranceFrames = 0.0;   // 0 = always use all segments
+    int histogramBins = 40;
+    std::string outputPrefix = "output/stats";
+};
+
+
+static int PrintUsage()
+{
+    printf(
+        "USAGE: stats [options]\n"
+        "\n"
+        "    -n events       number of random bolts to analyze (default 10000)\n"
+        "    -t threads      number of worker threads (default: all cores)\n"
+        "    -s seed         random seed of the first bolt; bolt k uses seed+k (default 1)\n"
+        "    -m segments     number of segments per bolt (default 2000)\n"
+        "    -h meters       bolt height (default 3000)\n"
+        "    -r meters       bolt radius (default 1000)\n"
+        "    -j factor       bolt jaggedness (default 1)\n"
+        "    -a frames       adaptive segment budget: stop subdividing when arrival times\n"
+        "                    are resolved within this many frames, or more where the air\n"
+        "                    absorbs the finer detail (default 0 = off)\n"
+        "    -b bins         number of histogram bins (default 40)\n"
+        "    -o prefix       output file prefix; writes prefix.csv and prefix.json (default output/stats)\n"
+    );
+    return 1;
+}
+
+
+static bool ParseOptions(int argc, const char *argv[], StatsOptions& options)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i+1 >= argc)
+            return false;
+
+        const char *flag = argv[i];
+        const char *value = argv[i+1];
+        if (!strcmp(flag, "-n"))
+            options.events = atoi(value);
+        else if (!strcmp(flag, "-t"))
+            options.threads = atoi(value);
+        else if (!strcmp(flag, "-s"))
+            options.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else if (!strcmp(flag, "-m"))
+            options.segments = static_cast<std::size_t>(atol(value));
+        else if (!strcmp(flag, "-h"))
+            options.heightMeters = atof(value);
+        else if (!strcmp(flag, "-r"))
+            options.radiusMeters = atof(value);
+        else if (!strcmp(flag, "-j"))
+            options.jaggedness = atof(value);
+        else if (!strcmp(flag, "-a"))
+            options.toleranceFrames = atof(value);
+        else if (!strcmp(flag, "-b"))
+            options.histogramBins = atoi(value);
+        else if (!strcmp(flag, "-o"))
+            options.outputPrefix = value;
+        else
+            return false;
+    }
+    return options.events > 0 && options.threads >= 0 && options.segments > 0 && options.toleranceFrames >= 0.0 && options.histogramBins > 0;
+}
+
+
+static void Worker(const StatsOptions& options, std::atomic<int>& nextEvent, std::vector<Sapphire::ThunderMetrics>& results)
+{
+    using namespace Sapphire;
+
+    // Each worker owns its own bolt, thunder, analyzer, and audio buffer, so workers never share mutable state.
+    // Events are handed out dynamically for load balancing, but every event's seed depends only
+    // on its index, and its results are stored at that index, so the output is the same
+    // no matter how many threads there are or how they are scheduled.
+    LightningBolt bolt(options.segments);
+    Thunder thunder(Listener, options.segments);
+    ThunderAnalyzer analyzer(SAMPLE_RATE);
+    AudioBuffer audio;
+    if (options.toleranceFrames > 0.0)
+        bolt.setAdaptiveBudget(Listener, SAMPLE_RATE, options.toleranceFrames);
+
+    for (;;)
+    {
+        const int index = nextEvent++;
+        if (index >= options.events)
+            break;
+
+        bolt.setSeed(options.seed + static_cast<unsigned>(index));
+        bolt.generate(options.heightMeters, options.radiusMeters, options.jaggedness);
+        thunder.start(bolt);
+        thunder.renderAudioInto(SAMPLE_RATE, audio);
+        analyzer.analyze(thunder, audio, results[index]);
+    }
+}
+
+
+struct MetricColumn
+{
+    const char *name;
+    double Sapphire::ThunderMetrics::*field;
+};
+
+
+static const MetricColumn Columns[] =
+{
+    { "first_arrival_seconds",      &Sapphire::ThunderMetrics::firstArrivalSeconds      },
+    { "duration_seconds",           &Sapphire::ThunderMetrics::durationSeconds          },
+    { "peak",                       &Sapphire::ThunderMetrics::peak                     },
+    { "rms",                        &Sapphire::ThunderMetrics::rms                      },
+    { "envelope_peak_seconds",      &Sapphire::ThunderMetrics::envelopePeakSeconds      },
+    { "spectral_centroid_hz",       &Sapphire::ThunderMetrics::spectralCentroidHz       },
+    { "arrival_difference_seconds", &Sapphire::ThunderMetrics::arrivalDifferenceSeconds },
+    { "level_difference_db",        &Sapphire::ThunderMetrics::levelDifferenceDb        },
+    { "segments",                   &Sapphire::ThunderMetrics::segments                 },
+};
+
+
+static bool WriteCsv(const std::string& filename, const std::vector<Sapphire::ThunderMetrics>& results, unsigned seed)
+{
+    FILE *outfile = fopen(filename.c_str(), "wt");
+    if (outfile == nullptr)
+        return false;
+
+    fprintf(outfile, "seed");
+    for (const MetricColumn& column : Columns)
+        fprintf(outfile, ",%s", column.name);
+    fprintf(outfile, "\n");
+
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        fprintf(outfile, "%u", seed + static_cast<unsigned>(i));
+        for (const MetricColumn& column : Columns)
+            fprintf(outfile, ",%.9lg", results[i].*column.field);
+        fprintf(outfile, "\n");
+    }
+
+    fclose(outfile);
+    return true;
+}
+
+
+static bool WriteJson(const std::string& filename, const StatsOptions& options, const std::vector<Sapphire::ThunderMetrics>& results, double envelopeWindowSeconds)
+{
+    using namespace Sapphire;
+
+    FILE *outfile = fopen(filename.c_str(), "wt");
+    if (outfile == nullptr)
+        return false;
+
+    fprintf(outfile, "{\n");
+    fprintf(outfile, "  \"events\": %d,\n", options.events);
+    fprintf(outfile, "  \"seed\": %u,\n", options.seed);
+    fprintf(outfile, "  \"segments\": %lu,\n", static_cast<unsigned long>(options.segments));
+    fprintf(outfile, "  \"height_meters\": %.9lg,\n", options.heightMeters);
+    fprintf(outfile, "  \"radius_meters\": %.9lg,\n", options.radiusMeters);
+    fprintf(outfile, "  \"jaggedness\": %.9lg,\n", options.jaggedness);
+    fprintf(outfile, "  \"tolerance_frames\": %.9lg,\n", options.toleranceFrames);
+    fprintf(outfile, "  \"metrics\": {\n");
+
+    const std::size_t ncolumns = sizeof(Columns) / sizeof(Columns[0]);
+    for (std::size_t k = 0; k < ncolumns; ++k)
+    {
+        const MetricColumn& column = Columns[k];
+
+        // Sum in event order, so the aggregates do not depend on thread scheduling.
+        double lo = results[0].*column.field;
+        double hi = lo;
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        for (const ThunderMetrics& m : results)
+        {
+            double x = m.*column.field;
+            lo = std::min(lo, x);
+            hi = std::max(hi, x);
+            sum += x;
+            sumSquares += x*x;
+        }
+        const double n = static_cast<double>(results.size());
+        const double mean = sum / n;
+        const double stdev = std::sqrt(std::max(0.0, sumSquares/n - mean*mean));
+
+        // Widen the upper bound slightly so the maximum value lands in the last bin.
+        Histogram histogram(lo, (hi > lo) ? hi + 1.0e-9*(hi - lo) : lo + 1.0, options.histogramBins);
+        for (const ThunderMetrics& m : results)
+            histogram.add(m.*column.field);
+
+        fprintf(outfile, "    \"%s\": {\n", column.name);
+        fprintf(outfile, "      \"min\": %.9lg, \"max\": %.9lg, \"mean\": %.9lg, \"stdev\": %.9lg,\n", lo, hi, mean, stdev);
+        fprintf(outfile, "      \"histogram\": { \"lower\": %.9lg, \"bin_width\": %.9lg, \"counts\": [", histogram.lowerBound(), histogram.binWidth());
+        for (int b = 0; b < histogram.bins(); ++b)
+            fprintf(outfile, "%s%ld", (b > 0) ? ", " : "", histogram.count(b));
+        fprintf(outfile, "] }\n");
+        fprintf(outfile, "    }%s\n", (k+1 < ncolumns) ? "," : "");
+    }
+    fprintf(outfile, "  },\n");
+
+    // The mean RMS envelope over all events, aligned at each event's first arrival.
+    std::size_t envelopeLength = 0;
+    for (const ThunderMetrics& m : results)
+        envelopeLength = std::max(envelopeLength, m.envelope.size());
+
+    fprintf(outfile, "  \"mean_envelope\": { \"window_seconds\": %.9lg, \"rms\": [", envelopeWindowSeconds);
+    for (std::size_t w = 0; w < envelopeLength; ++w)
+    {
+        double sum = 0.0;
+        for (const ThunderMetrics& m : results)
+            if (w < m.envelope.size())
+                sum += m.envelope[w];
+        fprintf(outfile, "%s%.9lg", (w > 0) ? ", " : "", sum / results.size());
+    }
+    fprintf(outfile, "] }\n");
+    fprintf(outfile, "}\n");
+
+    fclose(outfile);
+    return true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    StatsOptions options;
+    if (!ParseOptions(argc, argv, options))
+        return PrintUsage();
+
+    int nthreads = options.threads;
+    if (nthreads == 0)
+        nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    std::vector<Sapphire::ThunderMetrics> results(static_cast<std::size_t>(options.events));
+    std::atomic<int> nextEvent{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nthreads; ++t)
+        workers.push_back(std::thread(Worker, std::cref(options), std::ref(nextEvent), std::ref(results)));
+    for (std::thread& worker : workers)
+        worker.join();
+
+    const std::string csvFileName = options.outputPrefix + ".csv";
+    if (!WriteCsv(csvFileName, results, options.seed))
+    {
+        printf("stats: cannot write file: %s\n", csvFileName.c_str());
+        return 1;
+    }
+
+    const std::string jsonFileName = options.outputPrefix + ".json";
+    if (!WriteJson(jsonFileName, options, results, Sapphire::ThunderAnalyzer(SAMPLE_RATE).envelopeWindowSeconds()))
+    {
+        printf("stats: cannot write file: %s\n", jsonFileName.c_str());
+        return 1;
+    }
+
+    printf("stats: analyzed %d events using %d threads.\n", options.events, nthreads);
+    return 0;
+}
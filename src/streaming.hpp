@@ -0,0 +1,182 @@
+#pragma once
+
+// streaming.hpp  -  Renders thunder one block at a time, straight into a NormalizingPipeline,
+// so a complete event never has to exist as floating-point audio.
+//
+// Normalizing to full scale needs the peak of the whole event before the first sample
+// can be converted. Instead of rendering everything and then scanning it, the streamer
+// asks for an analytic bound on the peak (Thunder::peakBound, times the impulse responses'
+// L1 norms when convolving) and scales by that. For raw thunder the bound is within
+// a fraction of a percent of the actual peak. For convolved thunder it is only tight
+// when the impulse response is short or mostly one-signed; with a long noise-like
+// impulse response the result can be 20-30 dB quieter than full-scale normalization.
+//
+// Memory use depends only on the block size and the impulse response length,
+// not on how long the thunder lasts, and so does the FFT size used for convolution.
+
+#include <algorithm>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+#include "audio_buffer.hpp"
+#include "convolution.hpp"
+#include "fft.hpp"
+#include "lightning.hpp"
+#include "ir_bank.hpp"
+#include "pipeline.hpp"
+
+namespace Sapphire
+{
+    class ThunderStreamer
+    {
+    private:
+        using complex_t = std::complex<double>;
+
+        const int blockFrames;
+        AudioBuffer block;                      // one block of raw thunder
+        AudioBuffer impulse;                    // the blended impulse response
+        FftWorkspace workspace;
+        std::vector<complex_t> partitions;      // spectrum of each block-long partition of the impulse response
+        std::vector<complex_t> delayLine;       // spectra of the most recent input blocks
+        std::vector<complex_t> spectrum;        // one output block's spectrum, then its samples
+        std::vector<double> overlap;            // the part of the last output block that overlaps the next
+        std::vector<float> output;              // one interleaved block of output
+
+    public:
+        explicit ThunderStreamer(int _blockFrames = 8192)
+            : blockFrames(_blockFrames)
+        {
+            if (blockFrames < 1)
+                throw std::range_error("ThunderStreamer block size must be a positive number of frames.");
+        }
+
+        // Streams the same audio as thunder.renderAudio() through `pipeline`, block by block.
+        // Every sample is bit-identical to rendering first and normalizing by the same peak.
+        // When `leadingSilence` is true, the stream starts at the lightning flash instead of the first arrival.
+        // Returns the peak bound that was used to normalize the audio.
+        template <typename real_t>
+        double streamRaw(const BasicThunder<real_t>& thunder, int sampleRateHz, NormalizingPipeline& pipeline, bool leadingSilence = true)
+        {
+            const std::size_t nchannels = thunder.numEars();
+            const int frames = thunder.durationFrames(sampleRateHz);
+            const double bound = thunder.peakBound(sampleRateHz);
+            const std::size_t silence = leadingSilence ? static_cast<std::size_t>(thunder.startFrame(sampleRateHz)) * nchannels : 0;
+
+            pipeline.Start(static_cast<std::size_t>(frames) * nchannels, static_cast<float>(bound), silence);
+            for (int blockStart = 0; blockStart < frames; blockStart += blockFrames)
+            {
+                thunder.renderBlockInto(sampleRateHz, blockStart, blockFrames, block);
+                pipeline.Feed(block.samples(), block.buffer().size());
+            }
+            pipeline.Finish();
+            return bound;
+        }
+
+        // Streams the thunder convolved with a blend of the impulse responses in `bank`,
+        // the same audio as bank.convolveInto(y, thunder.renderAudio(), gains) up to roundoff error.
+        //
+        // This is uniformly partitioned convolution. The blended impulse response is cut into
+        // partitions one block long, and each partition's spectrum is calculated once per event
+        // at an FFT size of twice the block. Each block of raw thunder is transformed once and kept
+        // in a frequency-domain delay line, one spectrum per partition. The spectrum of each
+        // output block is the sum of the last P input spectra times the P partition spectra;
+        // one inverse FFT turns it into a block of output plus a tail added to the next block.
+        // Every FFT is the same small size, however long the thunder or the impulse responses are.
+        template <typename real_t>
+        double streamConvolved(
+            const BasicThunder<real_t>& thunder,
+            int sampleRateHz,
+            const ImpulseResponseBank& bank,
+            const std::vector<double>& gains,
+            NormalizingPipeline& pipeline,
+            bool leadingSilence = true)
+        {
+            const int inputChannels = static_cast<int>(thunder.numEars());
+            const int nchannels = bank.outputChannels(inputChannels);
+            if (inputChannels != 1 && inputChannels != nchannels)
+                throw std::range_error("The thunder has an incompatible number of channels for the impulse responses.");
+
+            const int frames = thunder.durationFrames(sampleRateHz);
+            const int tail = bank.tailFrames();
+            const int totalFrames = frames + tail;
+            const double bound = bank.peakBound(thunder.peakBound(sampleRateHz), gains, nchannels);
+            const int startFrame = thunder.startFrame(sampleRateHz) + bank.startOffset();
+            const std::size_t silence = leadingSilence ? static_cast<std::size_t>(startFrame) * nchannels : 0;
+
+            const std::size_t B = static_cast<std::size_t>(blockFrames);
+            const std::size_t n = NextPowerOfTwo(2 * B);
+            const std::size_t P = (static_cast<std::size_t>(tail) + B - 1) / B;
+            const std::size_t nin = static_cast<std::size_t>(inputChannels);
+            const std::size_t nout = static_cast<std::size_t>(nchannels);
+            const FourierTransform<double>& fft = workspace.transform(n);
+
+            // Partition spectra, grouped by channel: partitions[(c*P + p)*n + k].
+            bank.blendInto(impulse, gains, nchannels);
+            partitions.assign(nout * P * n, 0.0);
+            for (std::size_t c = 0; c < nout; ++c)
+            {
+                for (std::size_t p = 0; p < P; ++p)
+                {
+                    complex_t *h = &partitions[(c*P + p) * n];
+                    const int first = static_cast<int>(p * B);
+                    const int count = std::min(blockFrames, tail - first);
+                    for (int i = 0; i < count; ++i)
+                        h[i] = impulse.get(static_cast<int>(c), first + i);
+                    fft.forward(h);
+                }
+            }
+
+            // The delay line holds the spectra of the last P input blocks, grouped by channel.
+            // Blocks before the first one are silent, so they start out as zeros.
+            delayLine.assign(nin * P * n, 0.0);
+            overlap.assign(nout * B, 0.0);
+            output.resize(nout * B);
+
+            pipeline.Start(static_cast<std::size_t>(totalFrames) * nout, static_cast<float>(bound), silence);
+            std::size_t newest = 0;
+            for (int blockStart = 0; blockStart < totalFrames; blockStart += blockFrames)
+            {
+                newest = (newest + P - 1) % P;
+                thunder.renderBlockInto(sampleRateHz, std::min(blockStart, frames), blockFrames, block);
+                for (std::size_t c = 0; c < nin; ++c)
+                {
+                    complex_t *x = &delayLine[(c*P + newest) * n];
+                    std::fill(x, x + n, complex_t(0.0));
+                    if (block.frames() > 0)
+                    {
+                        for (int i = 0; i < block.frames(); ++i)
+                            x[i] = block.get(static_cast<int>(c), i);
+                        fft.forward(x);
+                    }
+                }
+
+                const int outFrames = std::min(blockFrames, totalFrames - blockStart);
+                for (std::size_t c = 0; c < nout; ++c)
+                {
+                    // A mono thunder signal feeds every output channel.
+                    const std::size_t ic = (nin == 1) ? 0 : c;
+                    spectrum.assign(n, 0.0);
+                    for (std::size_t p = 0; p < P; ++p)
+                    {
+                        const complex_t *x = &delayLine[(ic*P + (newest + p) % P) * n];
+                        const complex_t *h = &partitions[(c*P + p) * n];
+                        for (std::size_t k = 0; k < n; ++k)
+                            spectrum[k] += x[k] * h[k];
+                    }
+                    fft.inverse(spectrum.data());
+
+                    // The first B samples complete this block; the next B are added to the next one.
+                    double *ov = &overlap[c * B];
+                    for (std::size_t i = 0; i < B; ++i)
+                    {
+                        output[i*nout + c] = static_cast<float>(spectrum[i].real() + ov[i]);
+                        ov[i] = spectrum[B + i].real();
+                    }
+                }
+                pipeline.Feed(output.data(), static_cast<std::size_t>(outFrames) * nout);
+            }
+            pipeline.Finish();
+            return bound;
+        }
+    };
+}
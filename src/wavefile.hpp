@@ -6,6 +6,7 @@
 #ifndef __COSINEKITTY_WAVEFILE_HPP
 #define __COSINEKITTY_WAVEFILE_HPP
 
+#include <algorithm>
 #include <cinttypes>
 #include <cmath>
 #include <cstring>
@@ -160,109 +161,25 @@ namespace Sapphire
             if (outfile == nullptr)
                 throw std::logic_error("WaveFileWriter is not open.");
 
-            for (int i = 0; i < ndata; ++i)
-                buffer.push_back(data[i]);
+            // Integer samples need no conversion, so write them directly
+            // instead of copying them through the internal buffer.
+            Flush();
+            if (fwrite(data, sizeof(int16_t), ndata, outfile) != static_cast<size_t>(ndata))
+                throw std::runtime_error("Cannot write audio to WAV file.");
 
             byteLength += (2 * ndata);
-
-            if (buffer.size() >= 10000)
-                Flush();
         }
-    };
 
-
-    class ScaledWaveFileWriter
-    {
-    private:
-        WaveFileWriter wave;
-        float maximum = 0.0f;
-        FILE *tempFile = nullptr;
-        std::string tempFileName;
-
-    public:
-        ~ScaledWaveFileWriter()
+        void WriteSilence(int ndata)
         {
-            Close();
-        }
-
-        bool Open(const char *filename, int sampleRate, int channels)
-        {
-            tempFileName = std::string(filename) + ".tmp";
-            tempFile = fopen(tempFileName.c_str(), "wb");
-            if (tempFile == nullptr)
-                return false;
-
-            if (!wave.Open(filename, sampleRate, channels))
-            {
-                fclose(tempFile);
-                remove(tempFileName.c_str());
-                return false;
-            }
-
-            maximum = 0.0f;
-            return true;
-        }
-
-        void WriteSamples(const float *data, int ndata)
-        {
-            if (tempFile == nullptr)
-                throw std::logic_error("ScaledWaveFileWriter is not open.");
-
-            for (int i = 0; i < ndata; ++i)
-            {
-                if (!std::isfinite(data[i]))
-                    throw std::range_error("Non-finite audio data not allowed.");
-                maximum = std::max(maximum, std::abs(data[i]));
-            }
-
-            if (static_cast<size_t>(ndata) != fwrite(data, sizeof(float), ndata, tempFile))
-                throw std::runtime_error("Error writing to temporary file.");
-
-        }
-
-        void WriteBuffer(std::vector<float>& buffer)    // write buffer and flush it
-        {
-            int n = static_cast<int>(buffer.size());
-            if (n > 0)
-            {
-                WriteSamples(buffer.data(), n);
-                buffer.clear();
-            }
-        }
+            // Write `ndata` zero samples, without needing a buffer that large.
+            if (outfile == nullptr)
+                throw std::logic_error("WaveFileWriter is not open.");
 
-        void Close()
-        {
-            if (tempFile)
-            {
-                fclose(tempFile);
-                tempFile = nullptr;
-
-                FILE *rfile = fopen(tempFileName.c_str(), "rb");
-                if (rfile == nullptr)
-                    throw std::logic_error(std::string("Coult not re-open temporary file for read: ") + tempFileName);
-
-                // Handle the case where silence was written. Avoid dividing by zero.
-                if (maximum == 0.0f)
-                    maximum = 1.0f;
-
-                std::vector<float> buffer;
-                const size_t bufsize = 1024;
-                buffer.resize(bufsize);
-
-                for(;;)
-                {
-                    size_t nread = fread(buffer.data(), sizeof(float), bufsize, rfile);
-                    for (size_t i = 0; i < nread; ++i)
-                        buffer[i] /= maximum;
-
-                    wave.WriteSamples(buffer.data(), nread);
-                    if (nread < bufsize)
-                        break;
-                }
-
-                fclose(rfile);
-                remove(tempFileName.c_str());
-            }
+            static const int16_t zeros[1024] = {};
+            const int block = static_cast<int>(sizeof(zeros) / sizeof(zeros[0]));
+            for (int offset = 0; offset < ndata; offset += block)
+                WriteSamples(zeros, std::min(block, ndata - offset));
         }
     };
 